@@ -0,0 +1,46 @@
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* gets the current monotonic time in nanoseconds */
+static inline double now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static inline int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * sorts count samples and prints their mean and percentiles, scaled by
+ * divisor and labelled with unit
+ */
+static inline void print_percentiles(const char *label, double *samples,
+                                     size_t count, double divisor,
+                                     const char *unit) {
+    if (count == 0) {
+        printf("%-24s no samples\n", label);
+        return;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    qsort(samples, count, sizeof(double), compare_doubles);
+
+    printf("%-24s mean %9.2f%s  p50 %9.2f%s  p90 %9.2f%s  p99 %9.2f%s\n",
+           label, sum / (double)count / divisor, unit,
+           samples[count / 2] / divisor, unit,
+           samples[count * 90 / 100] / divisor, unit,
+           samples[count * 99 / 100] / divisor, unit);
+}
+
+#endif  // BENCH_UTIL_H_
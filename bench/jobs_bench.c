@@ -0,0 +1,91 @@
+// Microbenchmark for the job list. For each list size it times adding jobs,
+// looking them up by PID and by JID, updating their state and removing them
+// by PID in a shuffled order, the way reap_children does, and prints the cost
+// of each operation in nanoseconds. The cost should stay flat as the list
+// grows. The PIDs are made up, so the list is built without pidfds, which
+// would otherwise be opened for unrelated processes or fail, and the numbers
+// measure the indexes alone
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../jobs.h"
+#include "./bench_util.h"
+
+#define PID_BASE 100000
+
+/* fills order with 0..count-1 in a shuffled order */
+static void shuffle(int *order, int count, unsigned int *seed) {
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand_r(seed) % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+}
+
+int main() {
+    int sizes[] = {10, 100, 1000, 10000, 100000};
+    unsigned int seed = 330;
+
+    printf("%8s %10s %10s %10s %10s %10s\n", "jobs", "add", "jid_of",
+           "pid_of", "update", "remove");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int count = sizes[s];
+        int *order = (int *)malloc(sizeof(int) * (size_t)count);
+        double add = 0, jid_of = 0, pid_of = 0, update = 0, remove = 0;
+
+        // Small lists are repeated so that every size times as many
+        // operations in total
+        int rounds = 100000 / count;
+        for (int round = 0; round < rounds; round++) {
+            job_list_t *job_list = init_job_list_untracked();
+            double start = now_ns();
+            for (int i = 0; i < count; i++) {
+                add_job(job_list, i + 1, PID_BASE + i, RUNNING, "/bin/true");
+            }
+            add += now_ns() - start;
+
+            shuffle(order, count, &seed);
+            start = now_ns();
+            for (int i = 0; i < count; i++) {
+                get_job_jid(job_list, PID_BASE + order[i]);
+            }
+            jid_of += now_ns() - start;
+
+            start = now_ns();
+            for (int i = 0; i < count; i++) {
+                get_job_pid(job_list, order[i] + 1);
+            }
+            pid_of += now_ns() - start;
+
+            start = now_ns();
+            for (int i = 0; i < count; i++) {
+                update_job_pid(job_list, PID_BASE + order[i], STOPPED);
+            }
+            update += now_ns() - start;
+
+            // Every job is removed before the list is cleaned up, since
+            // cleanup_job_list would otherwise signal the made up PIDs
+            shuffle(order, count, &seed);
+            start = now_ns();
+            for (int i = 0; i < count; i++) {
+                remove_job_pid(job_list, PID_BASE + order[i]);
+            }
+            remove += now_ns() - start;
+
+            cleanup_job_list(job_list);
+        }
+
+        double operations = (double)count * rounds;
+        printf("%8d %8.1fns %8.1fns %8.1fns %8.1fns %8.1fns\n", count,
+               add / operations, jid_of / operations, pid_of / operations,
+               update / operations, remove / operations);
+        free(order);
+    }
+
+    return 0;
+}
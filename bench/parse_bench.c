@@ -0,0 +1,101 @@
+// Parser benchmark. For each argument count it builds a command line of that
+// many words, some of them quoted, with an input and an output redirect, and
+// times parse_command on it the way parse_input calls it, resetting the arena
+// before every line. It prints the per-line latency percentiles and the
+// throughput in megabytes of input per second. It then times the same line
+// through the parse cache, where every line after the first is a hit, except
+// for lines too long to be remembered
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../parse_cache.h"
+#include "../parser.h"
+#include "./bench_util.h"
+
+#define SAMPLES 2000
+
+/* builds a command line with argc words into a new string */
+static char *build_line(int argc, size_t *length) {
+    size_t capacity = (size_t)argc * 24 + 64;
+    char *line = (char *)malloc(capacity);
+    size_t used = (size_t)snprintf(line, capacity, "/bin/echo");
+
+    for (int i = 1; i < argc; i++) {
+        if (i % 10 == 0) {
+            used += (size_t)snprintf(line + used, capacity - used,
+                                     " \"quoted arg %d\"", i);
+        } else {
+            used += (size_t)snprintf(line + used, capacity - used,
+                                     " argument%d", i);
+        }
+    }
+    used += (size_t)snprintf(line + used, capacity - used,
+                             " < /dev/null >> /tmp/out");
+
+    *length = used;
+    return line;
+}
+
+/*
+ * times parsing a line of argc words, directly and through the cache, and
+ * prints the results, returns 0 on success, -1 if the line was not parsed
+ */
+static int bench_size(parse_arena_t *arena, parse_cache_t *cache, int argc,
+                      double *samples) {
+    size_t length = 0;
+    char *line = build_line(argc, &length);
+    command_t command;
+    double total = 0;
+    char label[64];
+
+    for (int i = 0; i < SAMPLES; i++) {
+        double start = now_ns();
+        reset_parse_arena(arena);
+        if (parse_command(arena, line, length, &command) != 1 ||
+            command.argc != argc) {
+            free(line);
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+        total += samples[i];
+    }
+
+    snprintf(label, sizeof(label), "parse %5d args", argc);
+    print_percentiles(label, samples, SAMPLES, 1e3, "us");
+    printf("%-24s %.1f MB/s\n", "", (double)length * SAMPLES / total * 1e3);
+
+    for (int i = 0; i < SAMPLES; i++) {
+        double start = now_ns();
+        if (parse_cached(cache, line, length, &command) != 1 ||
+            command.argc != argc) {
+            free(line);
+            return -1;
+        }
+        samples[i] = now_ns() - start;
+    }
+
+    snprintf(label, sizeof(label), "cached %5d args", argc);
+    print_percentiles(label, samples, SAMPLES, 1e3, "us");
+    free(line);
+    return 0;
+}
+
+int main() {
+    int sizes[] = {4, 64, 1024, 16384};
+    parse_arena_t *arena = init_parse_arena();
+    parse_cache_t *cache = init_parse_cache(256);
+    double *samples = (double *)malloc(sizeof(double) * SAMPLES);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        if (bench_size(arena, cache, sizes[s], samples) == -1) {
+            fprintf(stderr, "parse_bench: line was not parsed\n");
+            return 1;
+        }
+    }
+
+    free(samples);
+    cleanup_parse_arena(arena);
+    cleanup_parse_cache(cache);
+    return 0;
+}
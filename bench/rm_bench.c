@@ -0,0 +1,148 @@
+// Recursive remove benchmark. It builds a tree of empty files spread across
+// a number of directories, and times removing it with the rm builtin of
+// 33noprompt, run as "rm -r <tree>" on its standard input, and with
+// "/bin/rm -rf <tree>"
+// Usage: rm_bench [files] [directories]
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "./bench_util.h"
+
+#define RUNS 3
+
+/*
+ * builds a tree at path holding files empty files, spread evenly across
+ * directories subdirectories, returns 0 on success, -1 on failure
+ */
+static int build_tree(const char *path, int files, int directories) {
+    char name[64];
+
+    if (mkdir(path, 0755) == -1) {
+        perror(path);
+        return -1;
+    }
+    int root_fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (root_fd == -1) {
+        perror(path);
+        return -1;
+    }
+
+    for (int d = 0; d < directories; d++) {
+        snprintf(name, sizeof(name), "dir%d", d);
+        if (mkdirat(root_fd, name, 0755) == -1) {
+            perror(name);
+            close(root_fd);
+            return -1;
+        }
+        int dir_fd = openat(root_fd, name, O_RDONLY | O_DIRECTORY);
+        int count = files / directories + (d < files % directories);
+        for (int f = 0; f < count; f++) {
+            snprintf(name, sizeof(name), "file%d", f);
+            int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+            if (fd == -1) {
+                perror(name);
+                close(dir_fd);
+                close(root_fd);
+                return -1;
+            }
+            close(fd);
+        }
+        close(dir_fd);
+    }
+
+    close(root_fd);
+    return 0;
+}
+
+/*
+ * runs a program with its standard input read from input, which may be NULL,
+ * returns its exit status, or -1 if it could not be run
+ */
+static int run(const char *path, char *const argv[], const char *input) {
+    int input_pipe[2];
+    if (pipe(input_pipe) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(input_pipe[0], 0);
+        close(input_pipe[0]);
+        close(input_pipe[1]);
+        execv(path, argv);
+        perror(path);
+        _exit(127);
+    }
+
+    close(input_pipe[0]);
+    if (input != NULL &&
+        write(input_pipe[1], input, strlen(input)) != (ssize_t)strlen(input)) {
+        perror("write");
+    }
+    close(input_pipe[1]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+typedef struct contender {
+    const char *label;
+    char **argv;
+    const char *input;
+} contender_t;
+
+int main(int argc, char *argv[]) {
+    int files = argc > 1 ? atoi(argv[1]) : 100000;
+    int directories = argc > 2 ? atoi(argv[2]) : 100;
+    char tree[] = "/tmp/33sh_rm_bench_XXXXXX";
+    char input[128];
+
+    if (files < 0 || directories < 1 || mkdtemp(tree) == NULL) {
+        fprintf(stderr, "usage: rm_bench [files] [directories]\n");
+        return 1;
+    }
+    rmdir(tree);
+    snprintf(input, sizeof(input), "rm -r %s\n", tree);
+    printf("removing %d files in %d directories\n", files, directories);
+
+    char *shell_argv[] = {"./33noprompt", NULL};
+    char *rm_argv[] = {"/bin/rm", "-rf", tree, NULL};
+    contender_t contenders[] = {
+        {"rm -r 33noprompt", shell_argv, input},
+        {"rm -rf /bin/rm", rm_argv, NULL},
+    };
+    size_t count = sizeof(contenders) / sizeof(contenders[0]);
+    double samples[2][RUNS];
+
+    // The contenders take turns, each removing a freshly built tree
+    for (int run_index = 0; run_index < RUNS; run_index++) {
+        for (size_t i = 0; i < count; i++) {
+            if (build_tree(tree, files, directories) == -1) {
+                return 1;
+            }
+            double start = now_ns();
+            run(contenders[i].argv[0], contenders[i].argv,
+                contenders[i].input);
+            samples[i][run_index] = now_ns() - start;
+
+            if (access(tree, F_OK) == 0) {
+                fprintf(stderr, "%s did not remove %s\n", contenders[i].label,
+                        tree);
+                run(rm_argv[0], rm_argv, NULL);
+                return 1;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        print_percentiles(contenders[i].label, samples[i], RUNS, 1e6, "ms");
+    }
+    return 0;
+}
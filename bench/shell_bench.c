@@ -0,0 +1,367 @@
+// Shell benchmark. It drives 33noprompt, in each of its launch modes, and
+// dash and bash when they are installed, through pipes, and measures
+//   - launch latency: the round trip of one "/bin/echo ." command line, from
+//     writing the line to reading the output back
+//   - batch throughput: commands per second for a file of "/bin/true" lines
+//   - wrapper latency: the time to run "<shell> -c /bin/true" to completion,
+//     for each shell once, where a shell that execs its last command saves
+//     a fork
+//   - server latency (33noprompt only, in each launch mode): the round trip
+//     of one "/bin/true" request to a shell running with --server, from
+//     sending the line to receiving its status
+//   - reap latency (33noprompt only, since the other shells do not report
+//     background jobs): the time from a background job exiting to the shell
+//     printing its termination message
+// Usage: shell_bench [iterations]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../server.h"
+#include "./bench_util.h"
+
+#define WARMUP 50
+#define BATCH_RUNS 5
+
+typedef struct contender {
+    const char *name;
+    const char *path;
+    const char *setup;
+} contender_t;
+
+static contender_t contenders[] = {
+    {"33noprompt fork", "./33noprompt", "launch fork\n"},
+    {"33noprompt spawn", "./33noprompt", "launch spawn\n"},
+    {"33noprompt zygote", "./33noprompt", "launch zygote\n"},
+    {"dash", "/bin/dash", ""},
+    {"bash", "/bin/bash", ""},
+};
+
+/*
+ * starts a shell with pipes on its standard input and output, returns its
+ * pid, or -1 on failure
+ */
+static pid_t start_shell(const char *path, int *to_shell, int *from_shell) {
+    int input[2];
+    int output[2];
+    if (pipe(input) == -1 || pipe(output) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(input[0], 0);
+        dup2(output[1], 1);
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+        execl(path, path, (char *)NULL);
+        perror(path);
+        _exit(127);
+    }
+
+    close(input[0]);
+    close(output[1]);
+    *to_shell = input[1];
+    *from_shell = output[0];
+    return pid;
+}
+
+/* writes a whole string, returns 0 on success, -1 on failure */
+static int write_all(int fd, const char *text) {
+    size_t length = strlen(text);
+    while (length > 0) {
+        ssize_t written = write(fd, text, length);
+        if (written <= 0) {
+            return -1;
+        }
+        text += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/* reads a line of at most size - 1 bytes, returns 0 on success, -1 at EOF */
+static int read_line_from(int fd, char *line, size_t size) {
+    size_t used = 0;
+    while (used + 1 < size) {
+        if (read(fd, line + used, 1) != 1) {
+            return -1;
+        }
+        if (line[used++] == '\n') {
+            break;
+        }
+    }
+    line[used] = '\0';
+    return 0;
+}
+
+/* stops a shell by closing its input, and waits for it */
+static void stop_shell(pid_t pid, int to_shell, int from_shell) {
+    close(to_shell);
+    close(from_shell);
+    waitpid(pid, NULL, 0);
+}
+
+static void bench_launch(contender_t *contender, int iterations) {
+    int to_shell;
+    int from_shell;
+    char line[256];
+    double *samples = (double *)malloc(sizeof(double) * (size_t)iterations);
+
+    pid_t pid = start_shell(contender->path, &to_shell, &from_shell);
+    if (pid == -1 || write_all(to_shell, contender->setup) == -1) {
+        free(samples);
+        return;
+    }
+
+    for (int i = -WARMUP; i < iterations; i++) {
+        double start = now_ns();
+        if (write_all(to_shell, "/bin/echo .\n") == -1 ||
+            read_line_from(from_shell, line, sizeof(line)) == -1) {
+            fprintf(stderr, "%s: shell stopped responding\n", contender->name);
+            break;
+        }
+        if (i >= 0) {
+            samples[i] = now_ns() - start;
+        }
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "launch %s", contender->name);
+    print_percentiles(label, samples, (size_t)iterations, 1e3, "us");
+    stop_shell(pid, to_shell, from_shell);
+    free(samples);
+}
+
+static void bench_batch(contender_t *contender, int iterations) {
+    char path[] = "/tmp/33sh_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return;
+    }
+    write_all(fd, contender->setup);
+    for (int i = 0; i < iterations; i++) {
+        write_all(fd, "/bin/true\n");
+    }
+
+    double samples[BATCH_RUNS];
+    for (int run = 0; run < BATCH_RUNS; run++) {
+        lseek(fd, 0, SEEK_SET);
+        double start = now_ns();
+        pid_t pid = fork();
+        if (pid == 0) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            dup2(fd, 0);
+            dup2(null_fd, 1);
+            execl(contender->path, contender->path, (char *)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+
+        // Each sample is the throughput of a run, in commands per second
+        samples[run] = (double)iterations / ((now_ns() - start) / 1e9);
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "batch %s", contender->name);
+    print_percentiles(label, samples, BATCH_RUNS, 1, "/s");
+
+    close(fd);
+    unlink(path);
+}
+
+static void bench_wrapper(const char *path, int iterations) {
+    double *samples = (double *)malloc(sizeof(double) * (size_t)iterations);
+
+    for (int i = -WARMUP; i < iterations; i++) {
+        double start = now_ns();
+        pid_t pid = fork();
+        if (pid == 0) {
+            execl(path, path, "-c", "/bin/true", (char *)NULL);
+            _exit(127);
+        }
+        waitpid(pid, NULL, 0);
+        if (i >= 0) {
+            samples[i] = now_ns() - start;
+        }
+    }
+
+    const char *name = strrchr(path, '/');
+    char label[64];
+    snprintf(label, sizeof(label), "wrapper %s", name + 1);
+    print_percentiles(label, samples, (size_t)iterations, 1e3, "us");
+    free(samples);
+}
+
+/*
+ * starts a shell with --server on a socket at path, and connects to it,
+ * returns the connected descriptor, or -1 on failure
+ */
+static int start_server(const char *path, pid_t *pid) {
+    struct sockaddr_un address;
+
+    *pid = fork();
+    if (*pid == 0) {
+        execl("./33noprompt", "./33noprompt", "--server", path, (char *)NULL);
+        _exit(127);
+    }
+
+    // The server is given a moment to create its socket
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    for (int attempt = 0; attempt < 100; attempt++) {
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        usleep(10000);
+    }
+    close(fd);
+    return -1;
+}
+
+/*
+ * sends a line to the server and waits for its status frame, skipping any
+ * output, returns 0 on success, -1 on failure
+ */
+static int request(int fd, const char *line) {
+    char reply[sizeof(server_frame_t) + 65536];
+    server_frame_t frame;
+
+    if (send(fd, line, strlen(line), 0) == -1) {
+        return -1;
+    }
+    do {
+        if (recv(fd, reply, sizeof(reply), 0) < (ssize_t)sizeof(frame)) {
+            return -1;
+        }
+        memcpy(&frame, reply, sizeof(frame));
+    } while (frame.type != SERVER_STATUS);
+    return 0;
+}
+
+static void bench_server(contender_t *contender, int iterations) {
+    char path[] = "/tmp/33sh_bench_server";
+    char setup[64];
+    double *samples = (double *)malloc(sizeof(double) * (size_t)iterations);
+    int count = 0;
+    pid_t pid;
+
+    // The launch mode is selected by the first request, without its newline
+    snprintf(setup, sizeof(setup), "%.*s",
+             (int)strcspn(contender->setup, "\n"), contender->setup);
+
+    int fd = start_server(path, &pid);
+    if (fd != -1 && request(fd, setup) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    for (int i = -WARMUP; i < iterations && fd != -1; i++) {
+        double start = now_ns();
+        if (request(fd, "/bin/true") == -1) {
+            fprintf(stderr, "%s: server stopped responding\n",
+                    contender->name);
+            break;
+        }
+        if (i >= 0) {
+            samples[count++] = now_ns() - start;
+        }
+    }
+
+    char label[64];
+    snprintf(label, sizeof(label), "server %s", contender->name);
+    print_percentiles(label, samples, (size_t)count, 1e3, "us");
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(path);
+    free(samples);
+}
+
+static void bench_reap(const char *self, int iterations) {
+    int to_shell;
+    int from_shell;
+    char line[256];
+    char command[512];
+    double *samples = (double *)malloc(sizeof(double) * (size_t)iterations);
+    int count = 0;
+
+    pid_t pid = start_shell("./33noprompt", &to_shell, &from_shell);
+    if (pid == -1) {
+        free(samples);
+        return;
+    }
+
+    // The background job prints the time just before it exits, and the
+    // latency is how much later the termination message arrives
+    snprintf(command, sizeof(command), "%s --exit-stamp &\n", self);
+    for (int i = 0; i < iterations; i++) {
+        double exited = 0;
+        if (write_all(to_shell, command) == -1) {
+            break;
+        }
+        while (read_line_from(from_shell, line, sizeof(line)) == 0) {
+            if (strncmp(line, "exit-stamp ", 11) == 0) {
+                exited = atof(line + 11);
+            } else if (strstr(line, "terminated") != NULL) {
+                samples[count++] = now_ns() - exited;
+                break;
+            }
+        }
+    }
+
+    print_percentiles("reap 33noprompt", samples, (size_t)count, 1e3, "us");
+    stop_shell(pid, to_shell, from_shell);
+    free(samples);
+}
+
+int main(int argc, char *argv[]) {
+    // Run as a background job by the reap benchmark
+    if (argc > 1 && strcmp(argv[1], "--exit-stamp") == 0) {
+        printf("exit-stamp %.0f\n", now_ns());
+        return 0;
+    }
+
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t count = sizeof(contenders) / sizeof(contenders[0]);
+    for (size_t i = 0; i < count; i++) {
+        if (access(contenders[i].path, X_OK) == 0) {
+            bench_launch(&contenders[i], iterations);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (access(contenders[i].path, X_OK) == 0) {
+            bench_batch(&contenders[i], iterations);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        // The launch mode does not apply to -c, so each shell runs once
+        if (access(contenders[i].path, X_OK) == 0 &&
+            (i == 0 || strcmp(contenders[i].path, contenders[i - 1].path))) {
+            bench_wrapper(contenders[i].path, iterations);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(contenders[i].path, "./33noprompt") == 0 &&
+            access(contenders[i].path, X_OK) == 0) {
+            bench_server(&contenders[i], iterations);
+        }
+    }
+    bench_reap(argv[0], iterations / 10 > 0 ? iterations / 10 : 1);
+
+    return 0;
+}
@@ -0,0 +1,262 @@
+// Syscall benchmark. It runs 33noprompt on a file of command lines, traced
+// with ptrace, and counts the system calls the shell process makes itself,
+// not those of its children, for
+//   - each launch mode: a file of "/bin/true" lines, run in the foreground
+//   - a builtin: a file of "cd ." lines
+// A run of the same file without the commands is counted too, and taken
+// away, so that each row is the cost of one command line. The calls that
+// make up the cost are listed by name after each row. strace -c gives the
+// same counts where it is installed.
+// Usage: syscall_bench [commands] [limit ...]
+// With limits, it exits with 1 if any row costs more calls per command than
+// its limit. The limits are given for the rows in order, and a single limit
+// applies to every row
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_SYSCALLS 1024
+// The most calls listed by name under each row
+#define LISTED_SYSCALLS 8
+
+typedef struct workload {
+    const char *name;
+    const char *setup;
+    const char *line;
+} workload_t;
+
+static workload_t workloads[] = {
+    {"fork /bin/true", "launch fork\n", "/bin/true\n"},
+    {"spawn /bin/true", "launch spawn\n", "/bin/true\n"},
+    {"zygote /bin/true", "launch zygote\n", "/bin/true\n"},
+    {"builtin cd .", "", "cd .\n"},
+};
+
+typedef struct syscall_name {
+    long number;
+    const char *name;
+} syscall_name_t;
+
+// The calls the shell is expected to make, by name. Any other is listed by
+// its number
+static syscall_name_t syscall_names[] = {
+    {SYS_read, "read"},
+    {SYS_write, "write"},
+    {SYS_close, "close"},
+    {SYS_openat, "openat"},
+    {SYS_clone, "clone"},
+    {SYS_clone3, "clone3"},
+    {SYS_execve, "execve"},
+    {SYS_wait4, "wait4"},
+    {SYS_waitid, "waitid"},
+    {SYS_rt_sigaction, "rt_sigaction"},
+    {SYS_rt_sigprocmask, "rt_sigprocmask"},
+    {SYS_ioctl, "ioctl"},
+    {SYS_setpgid, "setpgid"},
+    {SYS_pipe2, "pipe2"},
+    {SYS_ppoll, "ppoll"},
+#ifdef SYS_poll
+    {SYS_poll, "poll"},
+#endif
+    {SYS_epoll_ctl, "epoll_ctl"},
+#ifdef SYS_epoll_wait
+    {SYS_epoll_wait, "epoll_wait"},
+#endif
+    {SYS_epoll_pwait, "epoll_pwait"},
+    {SYS_pidfd_open, "pidfd_open"},
+    {SYS_sendmsg, "sendmsg"},
+    {SYS_recvmsg, "recvmsg"},
+    {SYS_recvfrom, "recvfrom"},
+    {SYS_newfstatat, "newfstatat"},
+    {SYS_statx, "statx"},
+    {SYS_mmap, "mmap"},
+    {SYS_munmap, "munmap"},
+    {SYS_chdir, "chdir"},
+    {SYS_getcwd, "getcwd"},
+    {SYS_getpgid, "getpgid"},
+    {SYS_clock_gettime, "clock_gettime"},
+    {SYS_getrusage, "getrusage"},
+};
+
+/* returns the name of a system call, or its number as text in buffer */
+static const char *syscall_name(long number, char *buffer, size_t size) {
+    for (size_t i = 0; i < sizeof(syscall_names) / sizeof(syscall_names[0]);
+         i++) {
+        if (syscall_names[i].number == number) {
+            return syscall_names[i].name;
+        }
+    }
+    snprintf(buffer, size, "#%ld", number);
+    return buffer;
+}
+
+/*
+ * writes a file with the setup line, then count copies of line, returns the
+ * descriptor of the file, positioned at its start, or -1 on failure
+ */
+static int write_input(const workload_t *workload, int count) {
+    char path[] = "/tmp/syscall_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+
+    FILE *file = fdopen(dup(fd), "w");
+    fputs(workload->setup, file);
+    for (int i = 0; i < count; i++) {
+        fputs(workload->line, file);
+    }
+    fclose(file);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/*
+ * runs the shell on the input, and adds the number of times it made each
+ * system call to counts, returns the total, or -1 on failure
+ */
+static long count_syscalls(int input_fd, long *counts) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(input_fd, 0);
+        dup2(null_fd, 1);
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        execl("./33noprompt", "33noprompt", (char *)NULL);
+        perror("./33noprompt");
+        _exit(127);
+    }
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+
+    // The shell stops at its exec, and from then on at the entry and the exit
+    // of each system call, which are told apart from other stops by the bit
+    // that PTRACE_O_TRACESYSGOOD sets. Only entries are counted
+    int status = 0;
+    long total = 0;
+    if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status)) {
+        fprintf(stderr, "the shell did not start\n");
+        return -1;
+    }
+    ptrace(PTRACE_SETOPTIONS, pid, NULL,
+           PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL);
+    int signal_number = 0;
+    while (1) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, signal_number) == -1) {
+            perror("ptrace");
+            return -1;
+        }
+        if (waitpid(pid, &status, 0) == -1) {
+            perror("waitpid");
+            return -1;
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            break;
+        }
+
+        signal_number = 0;
+        if (WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+            signal_number = WSTOPSIG(status);
+            continue;
+        }
+
+        struct __ptrace_syscall_info info;
+        if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) > 0 &&
+            info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+            if (info.entry.nr < MAX_SYSCALLS) {
+                counts[info.entry.nr]++;
+            }
+            total++;
+        }
+    }
+    return total;
+}
+
+/*
+ * counts the calls of the workload with and without count commands, prints
+ * the difference per command, and the calls that make it up, returns the
+ * calls per command, or -1 on failure
+ */
+static double bench_workload(const workload_t *workload, int count) {
+    static long with_commands[MAX_SYSCALLS];
+    static long without_commands[MAX_SYSCALLS];
+    memset(with_commands, 0, sizeof(with_commands));
+    memset(without_commands, 0, sizeof(without_commands));
+
+    int fd = write_input(workload, count);
+    int empty_fd = write_input(workload, 0);
+    if (fd == -1 || empty_fd == -1) {
+        return -1;
+    }
+    long total = count_syscalls(fd, with_commands);
+    long baseline = count_syscalls(empty_fd, without_commands);
+    close(fd);
+    close(empty_fd);
+    if (total == -1 || baseline == -1) {
+        return -1;
+    }
+
+    double per_command = (double)(total - baseline) / (double)count;
+    printf("%-24s %8.2f syscalls per command\n", workload->name, per_command);
+
+    // The calls are listed from the most frequent, each per command
+    for (int listed = 0; listed < LISTED_SYSCALLS; listed++) {
+        long most = 0;
+        long number = -1;
+        for (long i = 0; i < MAX_SYSCALLS; i++) {
+            long extra = with_commands[i] - without_commands[i];
+            if (extra > most) {
+                most = extra;
+                number = i;
+            }
+        }
+        if (number == -1 || (double)most / (double)count < 0.05) {
+            break;
+        }
+
+        char buffer[32];
+        const char *name = syscall_name(number, buffer, sizeof(buffer));
+        printf("    %-20s %8.2f\n", name, (double)most / (double)count);
+        with_commands[number] = without_commands[number];
+    }
+    return per_command;
+}
+
+int main(int argc, char *argv[]) {
+    size_t workload_count = sizeof(workloads) / sizeof(workloads[0]);
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    size_t limit_count = argc > 2 ? (size_t)argc - 2 : 0;
+    int over_limit = 0;
+
+    if (count <= 0 || (limit_count > 1 && limit_count != workload_count)) {
+        fprintf(stderr, "usage: syscall_bench [commands] [limit ...]\n");
+        return 2;
+    }
+
+    for (size_t i = 0; i < workload_count; i++) {
+        double per_command = bench_workload(&workloads[i], count);
+        if (per_command < 0) {
+            return 1;
+        }
+        double limit = limit_count == 0   ? 0
+                       : limit_count == 1 ? atof(argv[2])
+                                          : atof(argv[2 + i]);
+        if (limit > 0 && per_command > limit) {
+            printf("%-24s over the limit of %.2f\n", workloads[i].name, limit);
+            over_limit = 1;
+        }
+    }
+    return over_limit;
+}
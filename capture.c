@@ -0,0 +1,306 @@
+#include "./capture.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// The most finished captures kept, once their jobs have gone
+#define MAX_FINISHED 64
+// The size of each read from a pipe, and the most events handled at once
+#define READ_SIZE 4096
+#define MAX_EVENTS 16
+
+// A capture keeps the last ring_size bytes of a job's output in ring, which
+// starts at start and holds length bytes, and counts the bytes it dropped.
+// read_fd is the read end of the job's pipe, or -1 once it has ended
+struct capture {
+    int jid;
+    int read_fd;
+    int relay;
+    char *ring;
+    size_t start;
+    size_t length;
+    unsigned long dropped;
+    struct capture *next;
+};
+typedef struct capture capture_t;
+
+// captures is the list of captures, newest first, and epoll_fd the epoll set
+// of the pipes still open, each registered with its capture
+struct capture_set {
+    capture_t *captures;
+    size_t ring_size;
+    int epoll_fd;
+    int open_count;
+};
+
+/* initializes an empty set of captures, returns pointer */
+capture_set_t *init_capture_set(size_t ring_size) {
+    capture_set_t *set = (capture_set_t *)calloc(1, sizeof(capture_set_t));
+    set->ring_size = ring_size > 0 ? ring_size : 1;
+    set->epoll_fd = -1;
+    return set;
+}
+
+/* closes the pipe of a capture, once it has ended */
+static void close_capture(capture_set_t *set, capture_t *capture) {
+    epoll_ctl(set->epoll_fd, EPOLL_CTL_DEL, capture->read_fd, NULL);
+    close(capture->read_fd);
+    capture->read_fd = -1;
+    capture->relay = 0;
+    set->open_count--;
+}
+
+/* frees a capture */
+static void free_capture(capture_set_t *set, capture_t *capture) {
+    if (capture->read_fd != -1) {
+        close_capture(set, capture);
+    }
+    free(capture->ring);
+    free(capture);
+}
+
+/*
+ * cleans up the set
+ * Note: this function will free the set pointer
+ */
+void cleanup_capture_set(capture_set_t *set) {
+    if (set == NULL) {
+        return;
+    }
+
+    capture_t *capture = set->captures;
+    while (capture != NULL) {
+        capture_t *next = capture->next;
+        free_capture(set, capture);
+        capture = next;
+    }
+    if (set->epoll_fd != -1) {
+        close(set->epoll_fd);
+    }
+    free(set);
+}
+
+/* finds the capture of a job, given its JID, returns NULL if there is none */
+static capture_t *find_capture(capture_set_t *set, int jid) {
+    capture_t *capture = set->captures;
+    while (capture != NULL && capture->jid != jid) {
+        capture = capture->next;
+    }
+    return capture;
+}
+
+/* frees the finished captures beyond the newest MAX_FINISHED */
+static void forget_finished(capture_set_t *set) {
+    int finished = 0;
+    capture_t **link = &set->captures;
+    while (*link != NULL) {
+        capture_t *capture = *link;
+        if (capture->read_fd == -1 && ++finished > MAX_FINISHED) {
+            *link = capture->next;
+            free_capture(set, capture);
+        } else {
+            link = &capture->next;
+        }
+    }
+}
+
+/* starts capturing the output of a job, returns the write end of its pipe */
+int start_capture(capture_set_t *set, int jid) {
+    int pipe_fds[2];
+    struct epoll_event event;
+
+    // The epoll set is only created once a job is captured
+    if (set->epoll_fd == -1 &&
+        (set->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        perror("epoll_create1");
+        return -1;
+    }
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+    capture_t *capture = (capture_t *)calloc(1, sizeof(capture_t));
+    capture->jid = jid;
+    capture->read_fd = pipe_fds[0];
+    capture->ring = (char *)malloc(set->ring_size);
+
+    event.events = EPOLLIN;
+    event.data.ptr = capture;
+    if (epoll_ctl(set->epoll_fd, EPOLL_CTL_ADD, capture->read_fd, &event) ==
+        -1) {
+        perror("epoll_ctl");
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        free(capture->ring);
+        free(capture);
+        return -1;
+    }
+
+    // A capture left behind for the same JID is replaced
+    capture_t *old = find_capture(set, jid);
+    if (old != NULL) {
+        capture_t **link = &set->captures;
+        while (*link != old) {
+            link = &(*link)->next;
+        }
+        *link = old->next;
+        free_capture(set, old);
+    }
+
+    capture->next = set->captures;
+    set->captures = capture;
+    set->open_count++;
+    return pipe_fds[1];
+}
+
+/* gets the epoll file descriptor of the open captures */
+int get_capture_epoll_fd(capture_set_t *set) {
+    return set->open_count > 0 ? set->epoll_fd : -1;
+}
+
+/* gets the number of captures whose pipes are still open */
+int get_open_capture_count(capture_set_t *set) { return set->open_count; }
+
+/* appends bytes to the ring of a capture, dropping its oldest bytes */
+static void append_ring(capture_set_t *set, capture_t *capture,
+                        const char *bytes, size_t count) {
+    // Only the last ring_size bytes of a large read can be kept
+    if (count > set->ring_size) {
+        capture->dropped += count - set->ring_size;
+        bytes += count - set->ring_size;
+        count = set->ring_size;
+    }
+    if (capture->length + count > set->ring_size) {
+        size_t excess = capture->length + count - set->ring_size;
+        capture->start = (capture->start + excess) % set->ring_size;
+        capture->length -= excess;
+        capture->dropped += excess;
+    }
+
+    // The bytes are copied in at the end, in at most two pieces
+    size_t end = (capture->start + capture->length) % set->ring_size;
+    size_t first = set->ring_size - end < count ? set->ring_size - end : count;
+    memcpy(capture->ring + end, bytes, first);
+    memcpy(capture->ring, bytes + first, count - first);
+    capture->length += count;
+}
+
+/* writes a whole buffer to fd, returns 0 on success, -1 on failure */
+static int write_all(int fd, const char *bytes, size_t count) {
+    while (count > 0) {
+        ssize_t written = write(fd, bytes, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        count -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * reads what is waiting in the pipe of a capture, closing it at its end
+ */
+static void drain_capture(capture_set_t *set, capture_t *capture) {
+    char buffer[READ_SIZE];
+
+    while (capture->read_fd != -1) {
+        ssize_t count = read(capture->read_fd, buffer, sizeof(buffer));
+        if (count > 0) {
+            append_ring(set, capture, buffer, (size_t)count);
+            if (capture->relay) {
+                write_all(1, buffer, (size_t)count);
+            }
+        } else if (count == 0) {
+            close_capture(set, capture);
+        } else if (errno != EINTR) {
+            if (errno != EAGAIN) {
+                perror("read");
+                close_capture(set, capture);
+            }
+            return;
+        }
+    }
+}
+
+/* reads the output waiting in every open capture into its ring */
+void drain_captures(capture_set_t *set) {
+    struct epoll_event events[MAX_EVENTS];
+    int closed = 0;
+
+    if (set->open_count == 0) {
+        return;
+    }
+
+    // Each capture with output waiting is read until its pipe is empty, and
+    // the set is asked again until no pipe has anything left
+    while (1) {
+        int count = epoll_wait(set->epoll_fd, events, MAX_EVENTS, 0);
+        if (count <= 0) {
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            capture_t *capture = (capture_t *)events[i].data.ptr;
+            drain_capture(set, capture);
+            closed |= capture->read_fd == -1;
+        }
+    }
+
+    if (closed) {
+        forget_finished(set);
+    }
+}
+
+/* sets whether the output of a job is written to standard output */
+int relay_capture(capture_set_t *set, int jid, int relay) {
+    capture_t *capture = find_capture(set, jid);
+    if (capture == NULL) {
+        return -1;
+    }
+
+    capture->relay = relay && capture->read_fd != -1;
+    return 0;
+}
+
+/* writes out the output kept for a job to fd */
+int print_capture(capture_set_t *set, int jid, int fd) {
+    capture_t *capture = find_capture(set, jid);
+    if (capture == NULL) {
+        return -1;
+    }
+
+    if (capture->dropped > 0) {
+        dprintf(fd, "[%d] (%lu bytes dropped)\n", jid, capture->dropped);
+    }
+    size_t first = set->ring_size - capture->start < capture->length
+                       ? set->ring_size - capture->start
+                       : capture->length;
+    if (write_all(fd, capture->ring + capture->start, first) == -1 ||
+        write_all(fd, capture->ring, capture->length - first) == -1) {
+        perror("write");
+    }
+    return 0;
+}
+
+/* joblog command with no job, lists every capture */
+void list_captures(capture_set_t *set) {
+    for (capture_t *capture = set->captures; capture != NULL;
+         capture = capture->next) {
+        printf("[%d] %s %lu bytes", capture->jid,
+               capture->read_fd != -1 ? "Open" : "Closed",
+               (unsigned long)capture->length);
+        if (capture->dropped > 0) {
+            printf(" (%lu dropped)", capture->dropped);
+        }
+        printf("\n");
+    }
+}
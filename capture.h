@@ -0,0 +1,65 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stddef.h>
+
+typedef struct capture_set capture_set_t;
+
+/*
+ * initializes an empty set of captures, each of which keeps the last
+ * ring_size bytes of the output of one background job, returns pointer
+ */
+capture_set_t *init_capture_set(size_t ring_size);
+/*
+ * cleans up the set, closing the pipes of the captures still open
+ * Note: this function will free the set pointer
+ */
+void cleanup_capture_set(capture_set_t *set);
+
+/*
+ * starts capturing the output of the job with the given JID, through a pipe
+ * that the shell reads without blocking, returns the write end of the pipe,
+ * which the caller hands to the job's processes and then closes, or -1 on
+ * failure. The pipe reaches its end once every process holding the write end
+ * has exited or closed it
+ */
+int start_capture(capture_set_t *set, int jid);
+
+/*
+ * gets the epoll file descriptor that becomes readable when any open capture
+ * has output waiting, returns -1 if the set has none
+ */
+int get_capture_epoll_fd(capture_set_t *set);
+/* gets the number of captures whose pipes are still open */
+int get_open_capture_count(capture_set_t *set);
+
+/*
+ * reads the output waiting in every open capture into its ring, without
+ * blocking, dropping the oldest bytes of a ring that fills up. The output of
+ * a capture that is being relayed is also written to standard output. A
+ * capture whose pipe has reached its end is closed, and its output kept,
+ * until too many captures have finished after it
+ */
+void drain_captures(capture_set_t *set);
+
+/*
+ * sets whether the output of the job with the given JID is written to
+ * standard output as it is read, as well as kept in its ring, returns 0 on
+ * success, -1 if the job's output is not captured
+ */
+int relay_capture(capture_set_t *set, int jid, int relay);
+
+/*
+ * writes out the output kept for the job with the given JID to fd, after a
+ * note of how many bytes were dropped if its ring has overflowed, returns 0
+ * on success, -1 if the job's output is not captured
+ */
+int print_capture(capture_set_t *set, int jid, int fd);
+
+/*
+ * joblog command with no job, lists every capture with its JID, whether it is
+ * still open, and the number of bytes it has kept and dropped
+ */
+void list_captures(capture_set_t *set);
+
+#endif  // CAPTURE_H_
@@ -0,0 +1,219 @@
+#include "./command_hash.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COMMAND_HASH_BUCKETS 128
+
+struct command_entry {
+    char *name;
+    char *path;
+    unsigned long hits;
+    struct command_entry *next;
+};
+typedef struct command_entry command_entry_t;
+
+// buckets holds the chains of entries, indexed by the hash of the name
+// path_variable is a copy of PATH as it was when the entries were resolved
+struct command_hash {
+    command_entry_t *buckets[COMMAND_HASH_BUCKETS];
+    char *path_variable;
+};
+
+/* FNV-1a hash of a command name, reduced to a bucket index */
+static size_t bucket_index(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash & (COMMAND_HASH_BUCKETS - 1);
+}
+
+/* checks that a path names a regular file that we may execute */
+static int is_executable(const char *path) {
+    struct stat file_info;
+    if (stat(path, &file_info) == -1 || !S_ISREG(file_info.st_mode)) {
+        return 0;
+    }
+    return access(path, X_OK) == 0;
+}
+
+/* initializes the command hash table, returns pointer */
+command_hash_t *init_command_hash() {
+    command_hash_t *command_hash =
+        (command_hash_t *)calloc(1, sizeof(command_hash_t));
+    return command_hash;
+}
+
+/*
+ * cleans up the command hash table
+ * Note: this function will free the command_hash pointer
+ * DO NOT use the pointer after this function is called
+ */
+void cleanup_command_hash(command_hash_t *command_hash) {
+    if (command_hash == NULL) {
+        return;
+    }
+
+    clear_command_hash(command_hash);
+    free(command_hash);
+}
+
+/*
+ * searches PATH for a command name without touching the table,
+ * copies the path into path and returns 0 on success, -1 on failure
+ */
+int search_path(const char *name, char *path, size_t size) {
+    const char *path_variable = getenv("PATH");
+    if (path_variable == NULL) {
+        path_variable = "/usr/local/bin:/usr/bin:/bin";
+    }
+
+    // Each PATH component is tried in order, with an empty component
+    // standing for the current directory
+    const char *start = path_variable;
+    while (1) {
+        const char *end = strchr(start, ':');
+        size_t length = end == NULL ? strlen(start) : (size_t)(end - start);
+
+        int written;
+        if (length == 0) {
+            written = snprintf(path, size, "./%s", name);
+        } else {
+            written = snprintf(path, size, "%.*s/%s", (int)length, start, name);
+        }
+
+        if (written > 0 && (size_t)written < size && is_executable(path)) {
+            return 0;
+        }
+
+        if (end == NULL) {
+            return -1;
+        }
+        start = end + 1;
+    }
+}
+
+/*
+ * resolves a command name to the path of an executable, first from the table
+ * and otherwise by searching PATH, remembering the result for next time.
+ * returns the path on success, NULL if no executable was found
+ */
+const char *lookup_command(command_hash_t *command_hash, const char *name) {
+    if (command_hash == NULL || name == NULL) {
+        return NULL;
+    }
+
+    // Every remembered path depends on PATH, so the table is emptied if PATH
+    // is no longer the value it was resolved against
+    const char *path_variable = getenv("PATH");
+    if (path_variable == NULL) {
+        path_variable = "";
+    }
+    if (command_hash->path_variable != NULL &&
+        strcmp(command_hash->path_variable, path_variable) != 0) {
+        clear_command_hash(command_hash);
+    }
+
+    size_t index = bucket_index(name);
+    command_entry_t *cur = command_hash->buckets[index];
+    while (cur != NULL) {
+        if (strcmp(cur->name, name) == 0) {
+            cur->hits++;
+            return cur->path;
+        }
+        cur = cur->next;
+    }
+
+    // On a miss PATH is walked once, and the result is remembered
+    char path[4096];
+    if (search_path(name, path, sizeof(path)) == -1) {
+        return NULL;
+    }
+
+    if (command_hash->path_variable == NULL) {
+        command_hash->path_variable = strdup(path_variable);
+    }
+
+    command_entry_t *new = (command_entry_t *)malloc(sizeof(command_entry_t));
+    new->name = strdup(name);
+    new->path = strdup(path);
+    new->hits = 1;
+    new->next = command_hash->buckets[index];
+    command_hash->buckets[index] = new;
+
+    return new->path;
+}
+
+/* forgets the remembered path of a command,
+    returns 0 on success, -1 if the command was not in the table */
+int forget_command(command_hash_t *command_hash, const char *name) {
+    if (command_hash == NULL || name == NULL) {
+        return -1;
+    }
+
+    command_entry_t **link = &command_hash->buckets[bucket_index(name)];
+    while (*link != NULL) {
+        command_entry_t *cur = *link;
+        if (strcmp(cur->name, name) == 0) {
+            *link = cur->next;
+            free(cur->name);
+            free(cur->path);
+            free(cur);
+            return 0;
+        }
+        link = &cur->next;
+    }
+
+    return -1;
+}
+
+/* forgets every remembered path */
+void clear_command_hash(command_hash_t *command_hash) {
+    if (command_hash == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < COMMAND_HASH_BUCKETS; i++) {
+        command_entry_t *cur = command_hash->buckets[i];
+        while (cur != NULL) {
+            command_entry_t *next_entry = cur->next;
+            free(cur->name);
+            free(cur->path);
+            free(cur);
+            cur = next_entry;
+        }
+        command_hash->buckets[i] = NULL;
+    }
+
+    free(command_hash->path_variable);
+    command_hash->path_variable = NULL;
+}
+
+/* hash command, prints out the remembered commands and their hit counts */
+void print_command_hash(command_hash_t *command_hash) {
+    if (command_hash == NULL) {
+        return;
+    }
+
+    int empty = 1;
+    for (size_t i = 0; i < COMMAND_HASH_BUCKETS; i++) {
+        command_entry_t *cur = command_hash->buckets[i];
+        while (cur != NULL) {
+            if (empty) {
+                printf("hits\tcommand\n");
+                empty = 0;
+            }
+            printf("%4lu\t%s\n", cur->hits, cur->path);
+            cur = cur->next;
+        }
+    }
+
+    if (empty) {
+        printf("hash: hash table empty\n");
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef COMMAND_HASH_H_
+#define COMMAND_HASH_H_
+
+#include <stddef.h>
+
+typedef struct command_hash command_hash_t;
+
+/* initializes the command hash table, returns pointer */
+command_hash_t *init_command_hash();
+/*
+ * cleans up the command hash table
+ * Note: this function will free the command_hash pointer
+ * DO NOT use the pointer after this function is called
+ */
+void cleanup_command_hash(command_hash_t *command_hash);
+
+/*
+ * resolves a command name to the path of an executable, first from the table
+ * and otherwise by searching PATH, remembering the result for next time.
+ * The whole table is forgotten when PATH changes between calls.
+ * returns the path on success, NULL if no executable was found.
+ * The path is owned by the table, and is valid until the entry is forgotten
+ */
+const char *lookup_command(command_hash_t *command_hash, const char *name);
+
+/* searches PATH for a command name without touching the table,
+        copies the path into path and returns 0 on success, -1 on failure */
+int search_path(const char *name, char *path, size_t size);
+
+/* forgets the remembered path of a command,
+        returns 0 on success, -1 if the command was not in the table */
+int forget_command(command_hash_t *command_hash, const char *name);
+
+/* forgets every remembered path */
+void clear_command_hash(command_hash_t *command_hash);
+
+/* hash command, prints out the remembered commands and their hit counts */
+void print_command_hash(command_hash_t *command_hash);
+
+#endif  // COMMAND_HASH_H_
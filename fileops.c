@@ -0,0 +1,536 @@
+#include "./fileops.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// copy_file_range and sendfile are asked for up to RANGE_CHUNK bytes at a
+// time, and a pipe is filled with up to PIPE_CHUNK bytes, which is the size
+// the scratch pipes are grown to. Copies that go through user space use a
+// buffer of BUFFER_SIZE bytes
+#define RANGE_CHUNK (1 << 30)
+#define PIPE_CHUNK (1 << 20)
+#define BUFFER_SIZE (1 << 20)
+#define MAX_THREADS 16
+
+// The files copied by cp, shared by its worker threads. next is the index of
+// the next source to copy, and failed is set once any copy has failed
+typedef struct copy_batch {
+    char **sources;
+    int count;
+    const char *destination;
+    int into_directory;
+    int next;
+    int failed;
+} copy_batch_t;
+
+/*
+ * checks whether an in-kernel copy failed only because it does not apply to
+ * the two descriptors, in which case the next way of copying is tried
+ */
+static int unsupported(int error) {
+    return error == EINVAL || error == EXDEV || error == ENOSYS ||
+           error == EOPNOTSUPP || error == EBADF;
+}
+
+/*
+ * writes all length bytes of buffer to fd, returns 0 on success, -1 on
+ * failure
+ */
+static int write_all(int fd, const char *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, buffer, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+ * copies in_fd to out_fd through a buffer in user space, reading at most
+ * limit bytes, or everything if limit is -1. returns the number of bytes
+ * copied on success, -1 on failure
+ */
+static ssize_t copy_through_buffer(int in_fd, int out_fd, ssize_t limit) {
+    char *buffer = (char *)malloc(BUFFER_SIZE);
+    ssize_t total = 0;
+
+    while (limit == -1 || total < limit) {
+        size_t wanted = BUFFER_SIZE;
+        if (limit != -1 && (size_t)(limit - total) < wanted) {
+            wanted = (size_t)(limit - total);
+        }
+
+        ssize_t length = read(in_fd, buffer, wanted);
+        if (length == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            total = -1;
+            break;
+        }
+        if (length == 0) {
+            break;
+        }
+        if (write_all(out_fd, buffer, (size_t)length) == -1) {
+            total = -1;
+            break;
+        }
+        total += length;
+    }
+
+    free(buffer);
+    return total;
+}
+
+/*
+ * moves exactly length bytes out of a pipe into out_fd with splice, falling
+ * back to a buffer if out_fd does not support it. returns 0 on success, -1
+ * on failure
+ */
+static int drain_pipe(int pipe_fd, int out_fd, ssize_t length) {
+    while (length > 0) {
+        ssize_t moved = splice(pipe_fd, NULL, out_fd, NULL, (size_t)length,
+                               SPLICE_F_MOVE);
+        if (moved == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (!unsupported(errno)) {
+                return -1;
+            }
+            return copy_through_buffer(pipe_fd, out_fd, length) == length
+                       ? 0
+                       : -1;
+        }
+        length -= moved;
+    }
+    return 0;
+}
+
+/* opens a pipe to stage data in, as large as the kernel allows up to
+    PIPE_CHUNK, returns 0 on success, -1 on failure */
+static int open_scratch_pipe(int pipe_fds[2]) {
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        return -1;
+    }
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, PIPE_CHUNK);
+    return 0;
+}
+
+/*
+ * copies everything that can be read from in_fd to out_fd, starting at the
+ * current offset of in_fd, inside the kernel wherever possible.
+ * returns the number of bytes copied on success, -1 on failure
+ */
+ssize_t copy_fd(int in_fd, int out_fd) {
+    struct stat in_stat;
+    struct stat out_stat;
+    ssize_t total = 0;
+    ssize_t moved = 0;
+
+    if (fstat(in_fd, &in_stat) == -1 || fstat(out_fd, &out_stat) == -1) {
+        return -1;
+    }
+
+    // Between regular files copy_file_range lets the filesystem share or
+    // copy the extents itself, without the data ever leaving the kernel
+    if (S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode)) {
+        while ((moved = copy_file_range(in_fd, NULL, out_fd, NULL, RANGE_CHUNK,
+                                        0)) > 0) {
+            total += moved;
+        }
+        if (moved == 0) {
+            return total;
+        }
+        if (!unsupported(errno)) {
+            return -1;
+        }
+    }
+
+    // Out of a regular file, sendfile copies from the page cache straight
+    // into the output, whatever it is
+    if (S_ISREG(in_stat.st_mode)) {
+        while ((moved = sendfile(out_fd, in_fd, NULL, RANGE_CHUNK)) > 0) {
+            total += moved;
+        }
+        if (moved == 0) {
+            return total;
+        }
+        if (!unsupported(errno)) {
+            return -1;
+        }
+    }
+
+    // If either side is a pipe, splice moves pages between it and the other
+    // side directly
+    if (S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode)) {
+        while ((moved = splice(in_fd, NULL, out_fd, NULL, PIPE_CHUNK,
+                               SPLICE_F_MOVE)) > 0) {
+            total += moved;
+        }
+        if (moved == 0) {
+            return total;
+        }
+        if (!unsupported(errno)) {
+            return -1;
+        }
+    } else {
+        // Otherwise the pages are spliced into a scratch pipe and out again
+        int scratch[2];
+        if (open_scratch_pipe(scratch) == 0) {
+            while ((moved = splice(in_fd, NULL, scratch[1], NULL, PIPE_CHUNK,
+                                   SPLICE_F_MOVE)) > 0) {
+                if (drain_pipe(scratch[0], out_fd, moved) == -1) {
+                    break;
+                }
+                total += moved;
+            }
+            int error = errno;
+            close(scratch[0]);
+            close(scratch[1]);
+            if (moved == 0) {
+                return total;
+            }
+            if (moved > 0 || !unsupported(error)) {
+                errno = error;
+                return -1;
+            }
+        }
+    }
+
+    // Nothing else applies, so the data goes through a buffer
+    if ((moved = copy_through_buffer(in_fd, out_fd, -1)) == -1) {
+        return -1;
+    }
+    return total + moved;
+}
+
+/*
+ * cat command, copies each of the files in paths to out_fd in turn, or in_fd
+ * if there are none. returns 0 on success, -1 if any file could not be copied
+ */
+int cat_files(char *paths[], int in_fd, int out_fd) {
+    int result = 0;
+
+    if (paths[0] == NULL) {
+        if (copy_fd(in_fd, out_fd) == -1) {
+            perror("cat");
+            return -1;
+        }
+        return 0;
+    }
+
+    for (int i = 0; paths[i] != NULL; i++) {
+        int fd = open(paths[i], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "cat: ");
+            perror(paths[i]);
+            result = -1;
+            continue;
+        }
+
+        if (copy_fd(fd, out_fd) == -1) {
+            fprintf(stderr, "cat: ");
+            perror(paths[i]);
+            result = -1;
+        }
+        close(fd);
+    }
+
+    return result;
+}
+
+/*
+ * copies a pipe to every descriptor in outputs. Each chunk waiting in the
+ * pipe is duplicated into a scratch pipe with tee(2) for every output but the
+ * last, and spliced out of the input pipe itself into the last one, so that
+ * the input is only consumed once every output has its copy.
+ * returns 0 on success, -1 on failure
+ */
+static int tee_pipe(int in_fd, int outputs[], int count) {
+    int scratch[2];
+    int result = 0;
+
+    if (open_scratch_pipe(scratch) == -1) {
+        return -1;
+    }
+
+    while (1) {
+        // The first tee blocks until there is data, and returns 0 once every
+        // writer has closed the pipe
+        ssize_t available = tee(in_fd, scratch[1], PIPE_CHUNK, 0);
+        if (available == -1 && errno == EINTR) {
+            continue;
+        }
+        if (available <= 0) {
+            result = (int)available;
+            break;
+        }
+        if (drain_pipe(scratch[0], outputs[0], available) == -1) {
+            result = -1;
+            break;
+        }
+
+        // The data is still at the head of the input pipe, so it can be
+        // duplicated again for each of the other outputs. The scratch pipe
+        // is empty, and took the whole chunk the first time, so each tee
+        // duplicates all of it
+        for (int i = 1; i < count - 1 && result == 0; i++) {
+            if (tee(in_fd, scratch[1], (size_t)available, 0) != available ||
+                drain_pipe(scratch[0], outputs[i], available) == -1) {
+                result = -1;
+            }
+        }
+
+        if (result == -1 || drain_pipe(in_fd, outputs[count - 1], available) ==
+                                -1) {
+            result = -1;
+            break;
+        }
+    }
+
+    close(scratch[0]);
+    close(scratch[1]);
+    return result;
+}
+
+/*
+ * copies anything that is not a pipe to every descriptor in outputs. A
+ * regular file is copied to each output in turn from where it started,
+ * through copy_fd, and anything else goes through a buffer.
+ * returns 0 on success, -1 on failure
+ */
+static int tee_other(int in_fd, int outputs[], int count) {
+    off_t start = lseek(in_fd, 0, SEEK_CUR);
+
+    if (start != -1) {
+        for (int i = 0; i < count; i++) {
+            if (lseek(in_fd, start, SEEK_SET) == -1 ||
+                copy_fd(in_fd, outputs[i]) == -1) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    char *buffer = (char *)malloc(BUFFER_SIZE);
+    int result = 0;
+    while (1) {
+        ssize_t length = read(in_fd, buffer, BUFFER_SIZE);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            result = (int)length;
+            break;
+        }
+        for (int i = 0; i < count && result == 0; i++) {
+            result = write_all(outputs[i], buffer, (size_t)length);
+        }
+        if (result == -1) {
+            break;
+        }
+    }
+
+    free(buffer);
+    return result;
+}
+
+/*
+ * tee command, copies in_fd to out_fd and to each of the files in paths,
+ * which are truncated, or appended to if append is set.
+ * returns 0 on success, -1 on failure
+ */
+int tee_files(char *paths[], int append, int in_fd, int out_fd) {
+    int count = 1;
+    while (paths[count - 1] != NULL) {
+        count++;
+    }
+
+    // The output descriptor comes first, followed by the files
+    int *outputs = (int *)malloc(sizeof(int) * (size_t)count);
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC);
+    int opened = 1;
+    int result = 0;
+    outputs[0] = out_fd;
+    for (int i = 0; paths[i] != NULL; i++) {
+        if ((outputs[opened] = open(paths[i], flags, 0777)) == -1) {
+            fprintf(stderr, "tee: ");
+            perror(paths[i]);
+            result = -1;
+            continue;
+        }
+        opened++;
+    }
+
+    struct stat in_stat;
+    int copy_result = 0;
+    if (opened == 1) {
+        copy_result = copy_fd(in_fd, out_fd) == -1 ? -1 : 0;
+    } else if (fstat(in_fd, &in_stat) == 0 && S_ISFIFO(in_stat.st_mode)) {
+        copy_result = tee_pipe(in_fd, outputs, opened);
+    } else {
+        copy_result = tee_other(in_fd, outputs, opened);
+    }
+    if (copy_result == -1) {
+        perror("tee");
+        result = -1;
+    }
+
+    for (int i = 1; i < opened; i++) {
+        close(outputs[i]);
+    }
+    free(outputs);
+    return result;
+}
+
+/*
+ * copies one file to a path, which is replaced if it exists. The copy is
+ * first made as a reflink with FICLONE, sharing the extents of the source on
+ * filesystems that support it, and otherwise by copy_fd, which tries
+ * copy_file_range before falling back to a large buffer.
+ * returns 0 on success, -1 on failure after printing an error
+ */
+static int copy_file(const char *source, const char *destination) {
+    struct stat source_stat;
+    struct stat destination_stat;
+    int result = 0;
+
+    int in_fd = open(source, O_RDONLY | O_CLOEXEC);
+    if (in_fd == -1) {
+        fprintf(stderr, "cp: %s: %s\n", source, strerror(errno));
+        return -1;
+    }
+    if (fstat(in_fd, &source_stat) == -1) {
+        fprintf(stderr, "cp: %s: %s\n", source, strerror(errno));
+        close(in_fd);
+        return -1;
+    }
+    if (S_ISDIR(source_stat.st_mode)) {
+        fprintf(stderr, "cp: %s: is a directory\n", source);
+        close(in_fd);
+        return -1;
+    }
+
+    // Truncating the destination would destroy the source if they are the
+    // same file
+    if (stat(destination, &destination_stat) == 0 &&
+        destination_stat.st_dev == source_stat.st_dev &&
+        destination_stat.st_ino == source_stat.st_ino) {
+        fprintf(stderr, "cp: %s and %s are the same file\n", source,
+                destination);
+        close(in_fd);
+        return -1;
+    }
+
+    int out_fd = open(destination, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      source_stat.st_mode & 0777);
+    if (out_fd == -1) {
+        fprintf(stderr, "cp: %s: %s\n", destination, strerror(errno));
+        close(in_fd);
+        return -1;
+    }
+
+    if (ioctl(out_fd, FICLONE, in_fd) == -1 && copy_fd(in_fd, out_fd) == -1) {
+        fprintf(stderr, "cp: %s: %s\n", destination, strerror(errno));
+        result = -1;
+    }
+
+    close(in_fd);
+    close(out_fd);
+    return result;
+}
+
+/* takes the next source off the batch and copies it, until none are left */
+static void *run_copy_worker(void *argument) {
+    copy_batch_t *batch = (copy_batch_t *)argument;
+    int index;
+
+    while ((index = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) <
+           batch->count) {
+        const char *source = batch->sources[index];
+        int result;
+
+        // A file copied into a directory keeps the last component of its
+        // path as its name
+        if (batch->into_directory) {
+            const char *name = strrchr(source, '/');
+            name = name == NULL ? source : name + 1;
+            size_t length = strlen(batch->destination) + strlen(name) + 2;
+            char *path = (char *)malloc(length);
+            snprintf(path, length, "%s/%s", batch->destination, name);
+            result = copy_file(source, path);
+            free(path);
+        } else {
+            result = copy_file(source, batch->destination);
+        }
+
+        if (result == -1) {
+            __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * cp command, copies each of the count files in sources to destination,
+ * which must be a directory if there is more than one source, with up to
+ * threads files being copied at once.
+ * returns 0 on success, -1 if any file could not be copied
+ */
+int copy_files(char *sources[], int count, const char *destination,
+               int threads) {
+    struct stat destination_stat;
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+    copy_batch_t batch;
+
+    batch.sources = sources;
+    batch.count = count;
+    batch.destination = destination;
+    batch.into_directory = stat(destination, &destination_stat) == 0 &&
+                           S_ISDIR(destination_stat.st_mode);
+    batch.next = 0;
+    batch.failed = 0;
+
+    if (count > 1 && !batch.into_directory) {
+        fprintf(stderr, "cp: %s: not a directory\n", destination);
+        return -1;
+    }
+
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (threads > count) {
+        threads = count;
+    }
+
+    // The calling thread copies files too, alongside threads - 1 others
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, run_copy_worker, &batch) ==
+            0) {
+            started++;
+        }
+    }
+    run_copy_worker(&batch);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    return batch.failed ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef FILEOPS_H_
+#define FILEOPS_H_
+
+#include <sys/types.h>
+
+/*
+ * copies everything that can be read from in_fd to out_fd, starting at the
+ * current offset of in_fd. The data is moved inside the kernel wherever the
+ * two descriptors allow it, with copy_file_range between regular files,
+ * sendfile out of a regular file, and splice into or out of a pipe, and is
+ * only read into user space when none of them applies.
+ * returns the number of bytes copied on success, -1 on failure
+ */
+ssize_t copy_fd(int in_fd, int out_fd);
+
+/*
+ * cat command, copies each of the files in the null terminated paths array
+ * to out_fd in turn, or in_fd if there are none. Errors are printed to
+ * standard error, and a file that cannot be opened does not stop the others.
+ * returns 0 on success, -1 if any file could not be copied
+ */
+int cat_files(char *paths[], int in_fd, int out_fd);
+
+/*
+ * tee command, copies in_fd to out_fd and to each of the files in the null
+ * terminated paths array, which are truncated, or appended to if append is
+ * set. When in_fd is a pipe the data is duplicated with tee(2) and moved with
+ * splice, so that it is never copied through user space.
+ * returns 0 on success, -1 on failure
+ */
+int tee_files(char *paths[], int append, int in_fd, int out_fd);
+
+/*
+ * cp command, copies each of the count files in sources to destination. If
+ * destination is a directory the copies are made inside it, under the last
+ * component of each source's path, and otherwise there must be a single
+ * source. Each copy is made as a reflink where the filesystem supports it,
+ * then with copy_file_range, and then through a large buffer. Up to threads
+ * files are copied at once, by that many threads. Errors are printed to
+ * standard error, and a file that cannot be copied does not stop the others.
+ * returns 0 on success, -1 if any file could not be copied
+ */
+int copy_files(char *sources[], int count, const char *destination,
+               int threads);
+
+#endif  // FILEOPS_H_
@@ -1,32 +1,427 @@
 #include "./jobs.h"
+#include <errno.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
+#define INITIAL_INDEX_BUCKETS 64
+// Queued jobs are kept in one queue for each priority, which is a nice value
+// from -20 to 19
+#define MIN_PRIORITY -20
+#define PRIORITY_LEVELS 40
+
+// Signals sent through a pidfd with this flag go to the whole process group
+// of the process the pidfd refers to (Linux 6.9 and later)
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1U << 2)
+#endif
+
+// A job is made up of one process for each stage of its pipeline, all in one
+// process group. Each process is held by a pidfd of its own, and is kept until
+// it has been reaped, so that any of its PIDs finds the job. exited is the
+// time it was seen to exit, if that was before it could be reaped, and zero
+// otherwise
+struct job_process {
+    pid_t pid;
+    int pidfd;
+    struct timespec exited;
+    struct job_element *job;
+    struct job_process *next;
+    struct job_process *next_by_pid;
+};
+typedef struct job_process job_process_t;
+
+// pid is the PID of the first process of the job, which is also the ID of its
+// process group. processes lists the processes that have not been reaped yet,
+// in pipeline order, and last_pid is the PID of the last stage, whose status
+// is kept in status once it has been reaped. usage sums the resources used by
+// every process reaped so far, and end is the time the last of them was reaped
+// pidfd is the pidfd of the first process, kept open until the job is removed
+// rather than until that process is reaped, since the group keeps the ID of
+// its first process for as long as it has a member
+// A queued job has no processes, and a pid of 0, until it is taken out of the
+// queue. Its priority orders the queue, in which it is linked by next_queued
+// and prev_queued, and queue_position is its place there as of the last time
+// the queue was numbered. data is what the shell needs to start it, freed with
+// free_data if the job is removed before it starts
 struct job_element {
     int jid;
     pid_t pid;
+    int pidfd;
     process_state_t state;
+    int priority;
+    int queue_position;
+    struct job_element *next_queued;
+    struct job_element *prev_queued;
+    void *data;
+    void (*free_data)(void *);
     char *command;
+    job_process_t *processes;
+    job_process_t *last_process;
+    pid_t last_pid;
+    int status;
+    struct rusage usage;
+    struct timespec start;
+    struct timespec end;
     struct job_element *next;
+    struct job_element *prev;
+    struct job_element *next_by_jid;
 };
 typedef struct job_element job_element_t;
 
-// head is the head of the list
+// head and tail are the ends of the list, which is kept in insertion order
 // current is the current element being iterated over
+// pid_index chains the processes of every job by PID, and jid_index chains
+// the jobs by JID, each with index_buckets buckets, so that no lookup walks the
+// list
+// count is the number of jobs in the list, queued_count and running_count the
+// number of those that are queued and running, and process_count the number
+// of processes in them
+// queue_heads and queue_tails are the ends of the queue of each priority,
+// oldest first, and queue_mask has a bit set for each queue that is not empty
+// epoll_fd watches the pidfd of every process, and becomes readable when any
+// of them exits. It is -1 if the kernel does not support pidfds
 struct job_list {
     job_element_t *head;
+    job_element_t *tail;
     job_element_t *current;
+    job_process_t **pid_index;
+    job_element_t **jid_index;
+    size_t index_buckets;
+    size_t count;
+    size_t queued_count;
+    size_t running_count;
+    size_t process_count;
+    job_element_t *queue_heads[PRIORITY_LEVELS];
+    job_element_t *queue_tails[PRIORITY_LEVELS];
+    uint64_t queue_mask;
+    int epoll_fd;
     pid_t shell_pid;
 };
 
-/* initializes job list, returns pointer */
-job_list_t *init_job_list() {
+/* opens a pidfd for a process, returns the pidfd or -1 on failure */
+static int pidfd_open(pid_t pid) {
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+/* sends a signal through a pidfd, returns 0 on success, -1 on failure */
+static int pidfd_send_signal(int pidfd, int sig, unsigned int flags) {
+    return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, flags);
+}
+
+/*
+ * sends a signal to the process group of a job through the pidfd of its first
+ * process, whose PID is the ID of the group. The pidfd is held for as long as
+ * the job is, so the group can be signalled through it even once its first
+ * process has been reaped. Kernels before 6.9 cannot signal a group through a
+ * pidfd, so the group is then signalled by its ID. That is still safe, since
+ * the job is only in the list while it has a process that has not been
+ * reaped, and the ID of a group cannot be reused while the group has a
+ * member. A queued job has no process to signal.
+ * returns 0 on success, -1 on failure
+ */
+static int signal_job(job_element_t *job, int sig) {
+    if (job->state == QUEUED) {
+        return 0;
+    }
+    if (job->pidfd != -1 &&
+        pidfd_send_signal(job->pidfd, sig, PIDFD_SIGNAL_PROCESS_GROUP) == 0) {
+        return 0;
+    }
+
+    return kill(-job->pid, sig);
+}
+
+/* converts the siginfo filled in by waitid into a waitpid status */
+int siginfo_to_status(const siginfo_t *info) {
+    switch (info->si_code) {
+        case CLD_EXITED:
+            return (info->si_status & 0xff) << 8;
+        case CLD_KILLED:
+            return info->si_status & 0x7f;
+        case CLD_DUMPED:
+            return (info->si_status & 0x7f) | 0x80;
+        case CLD_STOPPED:
+        case CLD_TRAPPED:
+            return ((info->si_status & 0xff) << 8) | 0x7f;
+        case CLD_CONTINUED:
+            return 0xffff;
+        default:
+            return 0;
+    }
+}
+
+/* mixes the bits of a PID or JID and reduces it to a bucket index */
+static size_t bucket_index(const job_list_t *job_list, int key) {
+    uint32_t hash = (uint32_t)key;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    hash ^= hash >> 16;
+    return hash & (job_list->index_buckets - 1);
+}
+
+/* finds the process with the given PID, returns NULL if there is none */
+static job_process_t *find_process(const job_list_t *job_list, pid_t pid) {
+    job_process_t *cur = job_list->pid_index[bucket_index(job_list, pid)];
+    while (cur != NULL && cur->pid != pid) {
+        cur = cur->next_by_pid;
+    }
+    return cur;
+}
+
+/* finds the job with a process with the given PID, returns NULL if there is
+    none */
+static job_element_t *find_by_pid(const job_list_t *job_list, pid_t pid) {
+    job_process_t *process = find_process(job_list, pid);
+    return process == NULL ? NULL : process->job;
+}
+
+/* finds the job with the given JID, returns NULL if there is none */
+static job_element_t *find_by_jid(const job_list_t *job_list, int jid) {
+    job_element_t *cur = job_list->jid_index[bucket_index(job_list, jid)];
+    while (cur != NULL && cur->jid != jid) {
+        cur = cur->next_by_jid;
+    }
+    return cur;
+}
+
+/* links a process into the PID index */
+static void index_process(job_list_t *job_list, job_process_t *process) {
+    size_t pid_bucket = bucket_index(job_list, process->pid);
+    process->next_by_pid = job_list->pid_index[pid_bucket];
+    job_list->pid_index[pid_bucket] = process;
+}
+
+/* unlinks a process from the PID index */
+static void unindex_process(job_list_t *job_list, job_process_t *process) {
+    job_process_t **link =
+        &job_list->pid_index[bucket_index(job_list, process->pid)];
+    while (*link != process) {
+        link = &(*link)->next_by_pid;
+    }
+    *link = process->next_by_pid;
+}
+
+/* links a job and its processes into both indexes */
+static void index_job(job_list_t *job_list, job_element_t *job) {
+    for (job_process_t *cur = job->processes; cur != NULL; cur = cur->next) {
+        index_process(job_list, cur);
+    }
+
+    size_t jid_bucket = bucket_index(job_list, job->jid);
+    job->next_by_jid = job_list->jid_index[jid_bucket];
+    job_list->jid_index[jid_bucket] = job;
+}
+
+/* doubles the number of buckets in both indexes and relinks every job */
+static void grow_indexes(job_list_t *job_list) {
+    free(job_list->pid_index);
+    free(job_list->jid_index);
+
+    job_list->index_buckets *= 2;
+    job_list->pid_index = (job_process_t **)calloc(job_list->index_buckets,
+                                                   sizeof(job_process_t *));
+    job_list->jid_index = (job_element_t **)calloc(job_list->index_buckets,
+                                                   sizeof(job_element_t *));
+
+    for (job_element_t *cur = job_list->head; cur != NULL; cur = cur->next) {
+        index_job(job_list, cur);
+    }
+}
+
+/*
+ * creates a process of a job and opens a pidfd for it, which cannot be
+ * confused with a later process that reuses the PID, and which is watched by
+ * the epoll set. The pidfd of the job's first process is also the job's own
+ */
+static job_process_t *new_process(job_list_t *job_list, job_element_t *job,
+                                  pid_t pid) {
+    job_process_t *process = (job_process_t *)malloc(sizeof(job_process_t));
+    process->pid = pid;
+    process->job = job;
+    process->next = NULL;
+    process->pidfd = -1;
+    process->exited.tv_sec = 0;
+    process->exited.tv_nsec = 0;
+    if (job_list->epoll_fd != -1 && (process->pidfd = pidfd_open(pid)) != -1) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = (uint64_t)pid;
+        epoll_ctl(job_list->epoll_fd, EPOLL_CTL_ADD, process->pidfd, &event);
+        if (pid == job->pid) {
+            job->pidfd = process->pidfd;
+        }
+    }
+    job_list->process_count++;
+    return process;
+}
+
+/*
+ * frees a process and closes its pidfd, unless it is the pidfd of the job,
+ * which is closed along with the job. The pidfd is taken out of the epoll
+ * set first, since a child forked for a later stage holds a copy of it until
+ * it calls exec, and the set only forgets a pidfd once every copy is closed
+ */
+static void free_process(job_list_t *job_list, job_process_t *process) {
+    if (process->pidfd != -1) {
+        epoll_ctl(job_list->epoll_fd, EPOLL_CTL_DEL, process->pidfd, NULL);
+        if (process->pidfd != process->job->pidfd) {
+            close(process->pidfd);
+        }
+    }
+    job_list->process_count--;
+    free(process);
+}
+
+/*
+ * sets the state of a job, keeping the count of running jobs. A job only
+ * enters and leaves the queue through queue_job and take_queued_job, so
+ * returns -1 if the job is queued or state is QUEUED, 0 otherwise
+ */
+static int set_job_state(job_list_t *job_list, job_element_t *job,
+                         process_state_t state) {
+    if (job->state == QUEUED || state == QUEUED) {
+        return -1;
+    }
+    job_list->running_count -= job->state == RUNNING;
+    job_list->running_count += state == RUNNING;
+    job->state = state;
+    return 0;
+}
+
+/* gets the index of the queue of a priority */
+static int queue_level(int priority) {
+    if (priority < MIN_PRIORITY) {
+        return 0;
+    }
+    if (priority >= MIN_PRIORITY + PRIORITY_LEVELS) {
+        return PRIORITY_LEVELS - 1;
+    }
+    return priority - MIN_PRIORITY;
+}
+
+/* adds a job to the end of the queue of its priority */
+static void enqueue_job(job_list_t *job_list, job_element_t *job) {
+    int level = queue_level(job->priority);
+    job->next_queued = NULL;
+    job->prev_queued = job_list->queue_tails[level];
+    if (job->prev_queued != NULL) {
+        job->prev_queued->next_queued = job;
+    } else {
+        job_list->queue_heads[level] = job;
+    }
+    job_list->queue_tails[level] = job;
+    job_list->queue_mask |= (uint64_t)1 << level;
+    job_list->queued_count++;
+}
+
+/* takes a job out of the queue of its priority */
+static void dequeue_job(job_list_t *job_list, job_element_t *job) {
+    int level = queue_level(job->priority);
+    if (job->prev_queued != NULL) {
+        job->prev_queued->next_queued = job->next_queued;
+    } else {
+        job_list->queue_heads[level] = job->next_queued;
+    }
+    if (job->next_queued != NULL) {
+        job->next_queued->prev_queued = job->prev_queued;
+    } else {
+        job_list->queue_tails[level] = job->prev_queued;
+    }
+    if (job_list->queue_heads[level] == NULL) {
+        job_list->queue_mask &= ~((uint64_t)1 << level);
+    }
+    job_list->queued_count--;
+}
+
+/* unlinks a job from the list and both indexes, then frees it */
+static void unlink_job(job_list_t *job_list, job_element_t *job) {
+    job_process_t *process = job->processes;
+    while (process != NULL) {
+        job_process_t *next_process = process->next;
+        unindex_process(job_list, process);
+        free_process(job_list, process);
+        process = next_process;
+    }
+
+    job_element_t **link =
+        &job_list->jid_index[bucket_index(job_list, job->jid)];
+    while (*link != job) {
+        link = &(*link)->next_by_jid;
+    }
+    *link = job->next_by_jid;
+
+    if (job->prev != NULL) {
+        job->prev->next = job->next;
+    } else {
+        job_list->head = job->next;
+    }
+    if (job->next != NULL) {
+        job->next->prev = job->prev;
+    } else {
+        job_list->tail = job->prev;
+    }
+    if (job_list->current == job) {
+        job_list->current = job->next;
+    }
+    job_list->count--;
+    if (job->state == QUEUED) {
+        dequeue_job(job_list, job);
+    }
+    job_list->running_count -= job->state == RUNNING;
+    if (job->pidfd != -1) {
+        close(job->pidfd);
+    }
+    if (job->data != NULL && job->free_data != NULL) {
+        job->free_data(job->data);
+    }
+
+    if (job->command != NULL) {
+        free(job->command);
+        job->command = NULL;
+    }
+    free(job);
+}
+
+/* initializes a job list without pidfds, returns pointer */
+job_list_t *init_job_list_untracked() {
     job_list_t *job_list = (job_list_t *)malloc(sizeof(job_list_t));
     job_list->head = NULL;
+    job_list->tail = NULL;
     job_list->current = NULL;
+    job_list->index_buckets = INITIAL_INDEX_BUCKETS;
+    job_list->pid_index = (job_process_t **)calloc(job_list->index_buckets,
+                                                   sizeof(job_process_t *));
+    job_list->jid_index = (job_element_t **)calloc(job_list->index_buckets,
+                                                   sizeof(job_element_t *));
+    job_list->count = 0;
+    job_list->queued_count = 0;
+    job_list->running_count = 0;
+    job_list->process_count = 0;
+    memset(job_list->queue_heads, 0, sizeof(job_list->queue_heads));
+    memset(job_list->queue_tails, 0, sizeof(job_list->queue_tails));
+    job_list->queue_mask = 0;
     job_list->shell_pid = getpid();
+    job_list->epoll_fd = -1;
+    return job_list;
+}
+
+/* initializes job list, returns pointer */
+job_list_t *init_job_list() {
+    job_list_t *job_list = init_job_list_untracked();
+
+    // pidfds are only used if the kernel supports them
+    int pidfd = pidfd_open(job_list->shell_pid);
+    if (pidfd != -1) {
+        close(pidfd);
+        job_list->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
     return job_list;
 }
 
@@ -47,11 +442,24 @@ void cleanup_job_list(job_list_t *job_list) {
         // if we are cleaning up the shell's job list and not a child's
         if (getpid() == job_list->shell_pid) {
             /* kill process */
-            if (kill(-cur->pid, SIGKILL) < 0) {
+            if (signal_job(cur, SIGKILL) < 0) {
                 perror("kill");
             }
         }
 
+        job_process_t *process = cur->processes;
+        while (process != NULL) {
+            job_process_t *next_process = process->next;
+            free_process(job_list, process);
+            process = next_process;
+        }
+        if (cur->pidfd != -1) {
+            close(cur->pidfd);
+        }
+
+        if (cur->data != NULL && cur->free_data != NULL) {
+            cur->free_data(cur->data);
+        }
         if (cur->command != NULL) {
             free(cur->command);
             cur->command = NULL;
@@ -61,7 +469,15 @@ void cleanup_job_list(job_list_t *job_list) {
         cur = nextElement;
     }
 
+    if (job_list->epoll_fd != -1) {
+        close(job_list->epoll_fd);
+    }
+    free(job_list->pid_index);
+    free(job_list->jid_index);
+    job_list->pid_index = NULL;
+    job_list->jid_index = NULL;
     job_list->head = NULL;
+    job_list->tail = NULL;
     job_list->current = NULL;
     job_list->shell_pid = 0;
 
@@ -79,15 +495,29 @@ int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
     job_element_t *new = (job_element_t *)malloc(sizeof(job_element_t));
     new->jid = jid;
     new->pid = pid;
+    new->pidfd = -1;
+    new->priority = 0;
+    new->data = NULL;
+    new->free_data = NULL;
 
     // allocate new char*'s and copy buffers in to protect our code
     new->state = state;
+    job_list->running_count += state == RUNNING;
 
     size_t cmdlen = strlen(command);
     new->command = (char *)malloc(sizeof(char) * (cmdlen + 1));
     memcpy(new->command, command, cmdlen);
     new->command[cmdlen] = 0;
     new->next = NULL;
+    new->prev = job_list->tail;
+    clock_gettime(CLOCK_MONOTONIC, &new->start);
+
+    // the job starts with a single process, the first of its pipeline
+    new->processes = new_process(job_list, new, pid);
+    new->last_process = new->processes;
+    new->last_pid = pid;
+    new->status = 0;
+    memset(&new->usage, 0, sizeof(new->usage));
 
     if (job_list->head == NULL) {
         // add to head
@@ -95,91 +525,260 @@ int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
         job_list->current = new;
     } else {
         // add to tail
-        job_element_t *cur = job_list->head;
-        while (cur->next != NULL) {
-            cur = cur->next;
-        }
-        cur->next = new;
+        job_list->tail->next = new;
+    }
+    job_list->tail = new;
+
+    // the indexes are kept at no more than one job or process per bucket on
+    // average
+    job_list->count++;
+    if (job_list->process_count > job_list->index_buckets ||
+        job_list->count > job_list->index_buckets) {
+        grow_indexes(job_list);
+    } else {
+        index_job(job_list, new);
     }
 
     return 0;
 }
 
-/* removes job from list, given job's JID,
-    returns 0 on success, -1 on failure */
-int remove_job_jid(job_list_t *job_list, int jid) {
+/* adds a queued job to the list, returns 0 on success, -1 on failure */
+int queue_job(job_list_t *job_list, int jid, int priority, char *command,
+              void *data, void (*free_data)(void *)) {
+    if (job_list == NULL || command == NULL) {
+        return -1;
+    }
+
+    job_element_t *new = (job_element_t *)calloc(1, sizeof(job_element_t));
+    new->jid = jid;
+    new->pidfd = -1;
+    new->state = QUEUED;
+    new->priority = priority;
+    new->data = data;
+    new->free_data = free_data;
+    new->command = strdup(command);
+    new->prev = job_list->tail;
+    clock_gettime(CLOCK_MONOTONIC, &new->start);
+
+    if (job_list->head == NULL) {
+        job_list->head = new;
+        job_list->current = new;
+    } else {
+        job_list->tail->next = new;
+    }
+    job_list->tail = new;
+
+    job_list->count++;
+    enqueue_job(job_list, new);
+    if (job_list->count > job_list->index_buckets) {
+        grow_indexes(job_list);
+    } else {
+        index_job(job_list, new);
+    }
+    return 0;
+}
+
+/*
+ * finds the queued job that starts next: the oldest in the queue of the
+ * lowest priority value that is not empty, returns NULL if none is queued
+ */
+static job_element_t *find_next_queued(const job_list_t *job_list) {
+    if (job_list->queue_mask == 0) {
+        return NULL;
+    }
+    return job_list->queue_heads[__builtin_ctzll(job_list->queue_mask)];
+}
+
+/*
+ * takes a queued job out of the list, given its JID, or the job that starts
+ * next if jid is -1, returns its data, or NULL if there is no such job
+ */
+void *take_queued_job(job_list_t *job_list, int jid, int *taken_jid,
+                      int *priority) {
+    if (job_list == NULL || job_list->queued_count == 0) {
+        return NULL;
+    }
+
+    job_element_t *job =
+        jid == -1 ? find_next_queued(job_list) : find_by_jid(job_list, jid);
+    if (job == NULL || job->state != QUEUED) {
+        return NULL;
+    }
+
+    void *data = job->data;
+    *taken_jid = job->jid;
+    *priority = job->priority;
+    job->data = NULL;
+    unlink_job(job_list, job);
+    return data;
+}
+
+/* gets the number of queued jobs in the list, returns -1 on failure */
+int get_queued_job_count(job_list_t *job_list) {
     if (job_list == NULL) {
         return -1;
     }
 
-    job_element_t *prev = NULL;
-    job_element_t *cur = job_list->head;
-    while (cur != NULL) {
-        if (cur->jid == jid) {
-            if (prev != NULL) {
-                prev->next = cur->next;
-            }
-            if (job_list->head == cur) {
-                job_list->head = cur->next;
-            }
-            if (job_list->current == cur) {
-                job_list->current = cur->next;
-            }
+    return (int)job_list->queued_count;
+}
 
-            if (cur->command != NULL) {
-                free(cur->command);
-                cur->command = NULL;
-            }
+/* gets the number of running jobs in the list, returns -1 on failure */
+int get_running_job_count(job_list_t *job_list) {
+    if (job_list == NULL) {
+        return -1;
+    }
 
-            free(cur);
-            cur = NULL;
+    return (int)job_list->running_count;
+}
 
-            return 0;
+/*
+ * numbers every queued job with its position in the order the queue is
+ * started in, counting from 1, in one pass over the queues
+ */
+static void number_queue(job_list_t *job_list) {
+    int position = 1;
+    for (int level = 0; level < PRIORITY_LEVELS; level++) {
+        for (job_element_t *cur = job_list->queue_heads[level]; cur != NULL;
+             cur = cur->next_queued) {
+            cur->queue_position = position++;
         }
+    }
+}
 
-        prev = cur;
-        cur = cur->next;
+/*
+ * adds another process to a job, given job's JID, as the next stage of its
+ * pipeline, returns 0 on success, -1 on failure
+ */
+int add_job_process(job_list_t *job_list, int jid, pid_t pid) {
+    if (job_list == NULL) {
+        return -1;
     }
 
-    return -1;
+    job_element_t *job = find_by_jid(job_list, jid);
+    if (job == NULL) {
+        return -1;
+    }
+
+    job_process_t *process = new_process(job_list, job, pid);
+    if (job->last_process != NULL) {
+        job->last_process->next = process;
+    } else {
+        job->processes = process;
+    }
+    job->last_process = process;
+    job->last_pid = pid;
+
+    if (job_list->process_count > job_list->index_buckets) {
+        grow_indexes(job_list);
+    } else {
+        index_process(job_list, process);
+    }
+
+    return 0;
 }
 
-/* removes job from list, given job's PID,
-    returns 0 on success, -1 on failure */
-int remove_job_pid(job_list_t *job_list, pid_t pid) {
+/* adds the resources in usage to those in total */
+static void add_usage(struct rusage *total, const struct rusage *usage) {
+    struct timeval sum;
+    timeradd(&total->ru_utime, &usage->ru_utime, &sum);
+    total->ru_utime = sum;
+    timeradd(&total->ru_stime, &usage->ru_stime, &sum);
+    total->ru_stime = sum;
+    if (usage->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/*
+ * records that a process of a job has terminated, given its PID, and takes
+ * it out of the job. status and usage hold the status and resources of the
+ * process, and once every process has terminated they are replaced by those
+ * of the whole job. returns the number of processes of the job that are
+ * still running, 0 if the job has finished, -1 on failure
+ */
+int finish_job_process(job_list_t *job_list, pid_t pid, int *status,
+                       struct rusage *usage) {
     if (job_list == NULL) {
         return -1;
     }
 
-    job_element_t *prev = NULL;
-    job_element_t *cur = job_list->head;
-    while (cur != NULL) {
-        if (cur->pid == pid) {
-            if (prev != NULL) {
-                prev->next = cur->next;
-            }
-            if (job_list->head == cur) {
-                job_list->head = cur->next;
-            }
-            if (job_list->current == cur) {
-                job_list->current = cur->next;
-            }
+    job_process_t *process = find_process(job_list, pid);
+    if (process == NULL) {
+        return -1;
+    }
+    job_element_t *job = process->job;
 
-            if (cur->command != NULL) {
-                free(cur->command);
-                cur->command = NULL;
-            }
-            free(cur);
-            cur = NULL;
+    if (pid == job->last_pid) {
+        job->status = *status;
+    }
+    if (usage != NULL) {
+        add_usage(&job->usage, usage);
+    }
+    if (process->exited.tv_sec != 0 || process->exited.tv_nsec != 0) {
+        job->end = process->exited;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &job->end);
+    }
 
-            return 0;
+    // unlinking the process from the job
+    job_process_t **link = &job->processes;
+    job_process_t *previous = NULL;
+    while (*link != process) {
+        previous = *link;
+        link = &(*link)->next;
+    }
+    *link = process->next;
+    if (job->last_process == process) {
+        job->last_process = previous;
+    }
+    unindex_process(job_list, process);
+    free_process(job_list, process);
+
+    int remaining = 0;
+    for (process = job->processes; process != NULL; process = process->next) {
+        remaining++;
+    }
+    if (remaining == 0) {
+        *status = job->status;
+        if (usage != NULL) {
+            *usage = job->usage;
         }
+    }
+    return remaining;
+}
 
-        prev = cur;
-        cur = cur->next;
+/* removes job from list, given job's JID,
+    returns 0 on success, -1 on failure */
+int remove_job_jid(job_list_t *job_list, int jid) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *job = find_by_jid(job_list, jid);
+    if (job == NULL) {
+        return -1;
     }
 
-    return -1;
+    unlink_job(job_list, job);
+    return 0;
+}
+
+/* removes job from list, given job's PID,
+    returns 0 on success, -1 on failure */
+int remove_job_pid(job_list_t *job_list, pid_t pid) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *job = find_by_pid(job_list, pid);
+    if (job == NULL) {
+        return -1;
+    }
+
+    unlink_job(job_list, job);
+    return 0;
 }
 
 /* updates job's state, given job's JID, returns 0 on success, -1 on failure */
@@ -188,17 +787,12 @@ int update_job_jid(job_list_t *job_list, int jid, process_state_t state) {
         return -1;
     }
 
-    job_element_t *cur = job_list->head;
-    while (cur != NULL) {
-        if (cur->jid == jid) {
-            cur->state = state;
-            return 0;
-        }
-
-        cur = cur->next;
+    job_element_t *job = find_by_jid(job_list, jid);
+    if (job == NULL) {
+        return -1;
     }
 
-    return -1;
+    return set_job_state(job_list, job, state);
 }
 
 /* updates job's state, given job's PID, returns 0 on success, -1 on failure */
@@ -207,17 +801,12 @@ int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state) {
         return -1;
     }
 
-    job_element_t *cur = job_list->head;
-    while (cur != NULL) {
-        if (cur->pid == pid) {
-            cur->state = state;
-            return 0;
-        }
-
-        cur = cur->next;
+    job_element_t *job = find_by_pid(job_list, pid);
+    if (job == NULL) {
+        return -1;
     }
 
-    return -1;
+    return set_job_state(job_list, job, state);
 }
 
 /* gets PID of job, given job's JID, returns PID on success, -1 on failure */
@@ -226,34 +815,49 @@ pid_t get_job_pid(job_list_t *job_list, int jid) {
         return -1;
     }
 
-    job_element_t *cur = job_list->head;
-    while (cur != NULL) {
-        if (cur->jid == jid) {
-            return cur->pid;
-        }
+    job_element_t *job = find_by_jid(job_list, jid);
+    return job == NULL ? -1 : job->pid;
+}
 
-        cur = cur->next;
+/* gets JID of job, given job's PID, returns JID on success, -1 on failure */
+int get_job_jid(job_list_t *job_list, pid_t pid) {
+    if (job_list == NULL) {
+        return -1;
     }
 
-    return -1;
+    job_element_t *job = find_by_pid(job_list, pid);
+    return job == NULL ? -1 : job->jid;
 }
 
-/* gets JID of job, given job's PID, returns JID on success, -1 on failure */
-int get_job_jid(job_list_t *job_list, pid_t pid) {
+/* gets job's state, given job's PID, returns the state on success,
+    -1 on failure */
+int get_job_state_pid(job_list_t *job_list, pid_t pid) {
     if (job_list == NULL) {
         return -1;
     }
 
-    job_element_t *cur = job_list->head;
-    while (cur != NULL) {
-        if (cur->pid == pid) {
-            return cur->jid;
-        }
+    job_element_t *job = find_by_pid(job_list, pid);
+    return job == NULL ? -1 : (int)job->state;
+}
 
-        cur = cur->next;
+/* gets job's state, given job's JID, returns the state on success,
+    -1 on failure */
+int get_job_state_jid(job_list_t *job_list, int jid) {
+    if (job_list == NULL) {
+        return -1;
     }
 
-    return -1;
+    job_element_t *job = find_by_jid(job_list, jid);
+    return job == NULL ? -1 : (int)job->state;
+}
+
+/* gets the number of jobs in the list, returns -1 on failure */
+int get_job_count(job_list_t *job_list) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    return (int)job_list->count;
 }
 
 /*
@@ -277,17 +881,377 @@ pid_t get_next_pid(job_list_t *job_list) {  // circular iterator
     }
 }
 
+/*
+ * gets the IDs of the process groups of up to size jobs that have been
+ * started, in the order of the list, returns the number of IDs
+ */
+int get_job_pgids(job_list_t *job_list, pid_t *pgids, int size) {
+    int count = 0;
+
+    if (job_list == NULL) {
+        return 0;
+    }
+
+    for (job_element_t *cur = job_list->head; cur != NULL && count < size;
+         cur = cur->next) {
+        if (cur->state != QUEUED) {
+            pgids[count++] = cur->pid;
+        }
+    }
+    return count;
+}
+
+/*
+ * prints out a queued job, with its position in the queue as numbered by
+ * number_queue, and its priority if it has one, returns the result of printf
+ */
+static int print_queued_job(const job_element_t *job) {
+    if (job->priority != 0) {
+        return printf("[%d] Queued #%d (nice %d) %s\n", job->jid,
+                      job->queue_position, job->priority, job->command);
+    }
+    return printf("[%d] Queued #%d %s\n", job->jid, job->queue_position,
+                  job->command);
+}
+
 /* jobs command, prints out the jobs list */
 void jobs(job_list_t *job_list) {
     if (job_list == NULL) {
         return;
     }
 
+    number_queue(job_list);
+    job_element_t *cur = job_list->head;
+    while (cur != NULL) {
+        char *state_string = cur->state == RUNNING ? "Running" : "Stopped";
+        int result = cur->state == QUEUED
+                         ? print_queued_job(cur)
+                         : printf("[%d] (%d) %s %s\n", cur->jid, cur->pid,
+                                  state_string, cur->command);
+        if (result < 0) {
+            fprintf(stderr, "error printing jobs list\n");
+            cleanup_job_list(job_list);
+            exit(1);
+        }
+        cur = cur->next;
+    }
+}
+
+/*
+ * sends a signal to the process group of a job, given job's PID. The signal
+ * goes through the job's pidfd when there is one, so that it can never reach
+ * an unrelated process that has reused the PID.
+ * returns 0 on success, -1 on failure
+ */
+int signal_job_pid(job_list_t *job_list, pid_t pid, int sig) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *job = find_by_pid(job_list, pid);
+    if (job == NULL) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    return signal_job(job, sig);
+}
+
+/*
+ * waits for a change in the state of a process of a job, given its PID. The
+ * wait goes through the process's pidfd when there is one. options are those
+ * of waitpid, and the status is stored as waitpid would store it. If usage is
+ * not NULL the resources used by a process that has terminated are stored in
+ * it. returns the PID on success, 0 if WNOHANG was given and the process has
+ * not changed state, -1 on failure
+ */
+pid_t wait_job_pid(job_list_t *job_list, pid_t pid, int *status, int options,
+                   struct rusage *usage) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_process_t *process = find_process(job_list, pid);
+    if (process == NULL) {
+        errno = ECHILD;
+        return -1;
+    }
+
+    if (process->pidfd == -1) {
+        return wait4(pid, status, options, usage);
+    }
+
+    siginfo_t info;
+    info.si_pid = 0;
+    int wait_options = WEXITED | (options & WNOHANG);
+    if (options & WUNTRACED) {
+        wait_options |= WSTOPPED;
+    }
+    if (options & WCONTINUED) {
+        wait_options |= WCONTINUED;
+    }
+
+    // The waitid system call takes a fifth argument for the resource usage
+    // that the libc wrapper does not expose
+    if (syscall(SYS_waitid, P_PIDFD, process->pidfd, &info, wait_options,
+                usage) == -1) {
+        return -1;
+    }
+    if (info.si_pid == 0) {
+        return 0;
+    }
+
+    *status = siginfo_to_status(&info);
+    return pid;
+}
+
+/*
+ * gets the epoll file descriptor that becomes readable when any process of
+ * any job exits, returns -1 if the jobs are not tracked by pidfds
+ */
+int get_job_epoll_fd(job_list_t *job_list) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    return job_list->epoll_fd;
+}
+
+/*
+ * gets the PID of a process of a job that has exited and is ready to be
+ * waited for, without blocking. returns the PID if there is one, -1 otherwise
+ */
+pid_t get_exited_pid(job_list_t *job_list) {
+    if (job_list == NULL || job_list->epoll_fd == -1) {
+        return -1;
+    }
+
+    struct epoll_event event;
+    if (epoll_wait(job_list->epoll_fd, &event, 1, 0) != 1) {
+        return -1;
+    }
+
+    return (pid_t)event.data.u64;
+}
+
+/* gets the PIDs of up to size processes of jobs that have exited and are
+    ready to be waited for, without blocking. returns the number of PIDs */
+int get_exited_pids(job_list_t *job_list, pid_t *pids, int size) {
+    struct epoll_event events[64];
+
+    if (job_list == NULL || job_list->epoll_fd == -1 || size <= 0) {
+        return 0;
+    }
+
+    int count = epoll_wait(job_list->epoll_fd, events, size < 64 ? size : 64,
+                           0);
+    for (int i = 0; i < count; i++) {
+        pids[i] = (pid_t)events[i].data.u64;
+    }
+    return count < 0 ? 0 : count;
+}
+
+/* records the time that each process which has exited, but has not been
+    reaped yet, was first seen to exit */
+void note_exited_processes(job_list_t *job_list) {
+    struct epoll_event events[64];
+    struct timespec now;
+
+    if (job_list == NULL || job_list->epoll_fd == -1) {
+        return;
+    }
+
+    int count = epoll_wait(job_list->epoll_fd, events, 64, 0);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < count; i++) {
+        job_process_t *process =
+            find_process(job_list, (pid_t)events[i].data.u64);
+        if (process != NULL && process->exited.tv_sec == 0 &&
+            process->exited.tv_nsec == 0) {
+            process->exited = now;
+        }
+    }
+}
+
+/* sets the time a job was launched, given job's PID,
+    returns 0 on success, -1 on failure */
+int set_job_start_pid(job_list_t *job_list, pid_t pid,
+                      const struct timespec *start) {
+    if (job_list == NULL || start == NULL) {
+        return -1;
+    }
+
+    job_element_t *job = find_by_pid(job_list, pid);
+    if (job == NULL) {
+        return -1;
+    }
+
+    job->start = *start;
+    return 0;
+}
+
+/* gets the time a job was launched, given job's PID,
+    returns 0 on success, -1 on failure */
+int get_job_start_pid(job_list_t *job_list, pid_t pid,
+                      struct timespec *start) {
+    if (job_list == NULL || start == NULL) {
+        return -1;
+    }
+
+    job_element_t *job = find_by_pid(job_list, pid);
+    if (job == NULL) {
+        return -1;
+    }
+
+    *start = job->start;
+    return 0;
+}
+
+/* gets the time a finished job's last process was reaped, given job's JID,
+    returns 0 on success, -1 on failure */
+int get_job_end_jid(job_list_t *job_list, int jid, struct timespec *end) {
+    if (job_list == NULL) {
+        return -1;
+    }
+
+    job_element_t *job = find_by_jid(job_list, jid);
+    if (job == NULL || job->processes != NULL || job->state == QUEUED) {
+        return -1;
+    }
+
+    *end = job->end;
+    return 0;
+}
+
+/* gets the seconds elapsed from start to end, or to now if end is NULL */
+static double seconds_since(const struct timespec *start,
+                            const struct timespec *end) {
+    struct timespec now;
+    if (end == NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        end = &now;
+    }
+    return (double)(end->tv_sec - start->tv_sec) +
+           (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * formats the resources used by a process launched at start, and reaped at
+ * end, into buffer, returns the number of characters written, as snprintf
+ * does
+ */
+int format_usage(char *buffer, size_t size, const struct timespec *start,
+                 const struct timespec *end, const struct rusage *usage) {
+    return snprintf(
+        buffer, size,
+        "real %.3fs user %.3fs sys %.3fs maxrss %ldKB csw %ldv/%ldi",
+        seconds_since(start, end),
+        (double)usage->ru_utime.tv_sec + (double)usage->ru_utime.tv_usec / 1e6,
+        (double)usage->ru_stime.tv_sec + (double)usage->ru_stime.tv_usec / 1e6,
+        usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+}
+
+/*
+ * reads the resources a live process has used so far out of /proc into
+ * usage, returns 0 on success, -1 on failure
+ */
+static int read_process_usage(pid_t pid, struct rusage *usage) {
+    char path[64];
+    char line[512];
+    memset(usage, 0, sizeof(*usage));
+
+    // The CPU times are the 14th and 15th fields of stat, counted in clock
+    // ticks. The command name in the 2nd field may contain spaces, so the
+    // fields are counted from the parenthesis that closes it
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char *fields = fgets(line, sizeof(line), file);
+    fclose(file);
+    if (fields == NULL || (fields = strrchr(line, ')')) == NULL) {
+        return -1;
+    }
+
+    unsigned long user_ticks = 0;
+    unsigned long system_ticks = 0;
+    if (sscanf(fields + 2,
+               "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &user_ticks, &system_ticks) != 2) {
+        return -1;
+    }
+    long ticks = sysconf(_SC_CLK_TCK);
+    usage->ru_utime.tv_sec = (time_t)(user_ticks / (unsigned long)ticks);
+    usage->ru_utime.tv_usec = (suseconds_t)(user_ticks % (unsigned long)ticks *
+                                            1000000 / (unsigned long)ticks);
+    usage->ru_stime.tv_sec = (time_t)(system_ticks / (unsigned long)ticks);
+    usage->ru_stime.tv_usec = (suseconds_t)(
+        system_ticks % (unsigned long)ticks * 1000000 / (unsigned long)ticks);
+
+    // The peak resident set size and the context switches are in status
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if ((file = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        sscanf(line, "VmHWM: %ld", &usage->ru_maxrss);
+        sscanf(line, "voluntary_ctxt_switches: %ld", &usage->ru_nvcsw);
+        sscanf(line, "nonvoluntary_ctxt_switches: %ld", &usage->ru_nivcsw);
+    }
+    fclose(file);
+
+    return 0;
+}
+
+/*
+ * jobs -l command, prints out the jobs list along with the time each job has
+ * been running and the resources its processes have used so far
+ */
+void jobs_long(job_list_t *job_list) {
+    if (job_list == NULL) {
+        return;
+    }
+
+    number_queue(job_list);
     job_element_t *cur = job_list->head;
     while (cur != NULL) {
         char *state_string = cur->state == RUNNING ? "Running" : "Stopped";
-        if (printf("[%d] (%d) %s %s\n", cur->jid, cur->pid, state_string,
-                   cur->command) < 0) {
+        char usage_string[256];
+        struct rusage usage;
+
+        // A queued job has used nothing yet
+        if (cur->state == QUEUED) {
+            if (print_queued_job(cur) < 0) {
+                fprintf(stderr, "error printing jobs list\n");
+                cleanup_job_list(job_list);
+                exit(1);
+            }
+            cur = cur->next;
+            continue;
+        }
+
+        // The stages of the pipeline that have been reaped are added to
+        // those still running, each read out of /proc
+        struct rusage total = cur->usage;
+        int read_count = 0;
+        for (job_process_t *process = cur->processes; process != NULL;
+             process = process->next) {
+            if (read_process_usage(process->pid, &usage) == 0) {
+                add_usage(&total, &usage);
+                read_count++;
+            }
+        }
+        if (read_count > 0) {
+            format_usage(usage_string, sizeof(usage_string), &cur->start, NULL,
+                         &total);
+        } else {
+            snprintf(usage_string, sizeof(usage_string), "real %.3fs",
+                     seconds_since(&cur->start, NULL));
+        }
+
+        if (printf("[%d] (%d) %s %s %s\n", cur->jid, cur->pid, state_string,
+                   cur->command, usage_string) < 0) {
             fprintf(stderr, "error printing jobs list\n");
             cleanup_job_list(job_list);
             exit(1);
@@ -1,15 +1,26 @@
 #ifndef JOBS_H_
 #define JOBS_H_
 
+#include <signal.h>
+#include <stddef.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
-typedef enum { RUNNING, STOPPED } process_state_t;
+// A QUEUED job has not been started yet, and waits in the job list for a
+// free slot, which the shell gives to queued jobs in order of priority
+typedef enum { RUNNING, STOPPED, QUEUED } process_state_t;
 
 typedef struct job_list job_list_t;
 
 /* initializes job list, returns pointer */
 job_list_t *init_job_list();
+/*
+ * initializes a job list that never opens pidfds, and tracks its jobs by PID
+ * alone, as on a kernel without pidfds, returns pointer
+ */
+job_list_t *init_job_list_untracked();
 /*
  * cleans up jobs list
  * Note: this function will free the job_list pointer
@@ -17,9 +28,52 @@ job_list_t *init_job_list();
  */
 void cleanup_job_list(job_list_t *job_list);
 
-/* adds new job to list, returns 0 on success, -1 on failure */
+/*
+ * adds new job to list, with pid as its first process and the ID of its
+ * process group, returns 0 on success, -1 on failure
+ */
 int add_job(job_list_t *job_list, int jid, pid_t pid, process_state_t state,
             char *command);
+/*
+ * adds a job that has not been started yet to the list, in the QUEUED state,
+ * with no processes. Queued jobs are started in order of priority, lowest
+ * first, as nice values are, and in the order they were queued for the same
+ * priority. data is what the caller needs to start the job, and is handed
+ * back by take_queued_job, or freed with free_data if the job is removed, or
+ * the list cleaned up, first. returns 0 on success, -1 on failure
+ */
+int queue_job(job_list_t *job_list, int jid, int priority, char *command,
+              void *data, void (*free_data)(void *));
+/*
+ * takes a queued job out of the list, given its JID, or the queued job that
+ * starts next if jid is -1, so that the caller can start it and add it again
+ * with add_job under the same JID. *taken_jid and *priority are set to the
+ * job's JID and priority. returns the job's data, or NULL if there is no such
+ * queued job
+ */
+void *take_queued_job(job_list_t *job_list, int jid, int *taken_jid,
+                      int *priority);
+/* gets the number of queued jobs in the list, returns -1 on failure */
+int get_queued_job_count(job_list_t *job_list);
+/* gets the number of jobs in the RUNNING state, returns -1 on failure */
+int get_running_job_count(job_list_t *job_list);
+
+/*
+ * adds another process to a job, given job's JID, as the next stage of its
+ * pipeline, returns 0 on success, -1 on failure
+ */
+int add_job_process(job_list_t *job_list, int jid, pid_t pid);
+/*
+ * records that a process of a job has terminated, given its PID, and takes
+ * it out of the job. status and usage (which may be NULL) hold the status and
+ * resources of the process, and once every process has terminated they are
+ * replaced by those of the whole job: the status of its last process, and the
+ * resources used by all of them. The job itself stays in the list.
+ * returns the number of processes of the job that are still running, 0 if the
+ * job has finished, -1 on failure
+ */
+int finish_job_process(job_list_t *job_list, pid_t pid, int *status,
+                       struct rusage *usage);
 
 /* removes job from list, given job's JID,
         returns 0 on success, -1 on failure */
@@ -33,10 +87,23 @@ int update_job_jid(job_list_t *job_list, int jid, process_state_t state);
 /* updates job's state, given job's PID, returns 0 on success, -1 on failure */
 int update_job_pid(job_list_t *job_list, pid_t pid, process_state_t state);
 
-/* gets PID of job, given job's JID, returns PID on success, -1 on failure */
+/*
+ * gets PID of job's first process, which is also the ID of its process group,
+ * given job's JID, returns PID on success, -1 on failure
+ */
 pid_t get_job_pid(job_list_t *job_list, int jid);
-/* gets JID of job, given job's PID, returns JID on success, -1 on failure */
+/* gets JID of job, given the PID of any of its processes,
+        returns JID on success, -1 on failure */
 int get_job_jid(job_list_t *job_list, pid_t pid);
+/* gets job's state, given job's PID, returns the state on success,
+        -1 on failure */
+int get_job_state_pid(job_list_t *job_list, pid_t pid);
+/* gets job's state, given job's JID, returns the state on success,
+        -1 on failure */
+int get_job_state_jid(job_list_t *job_list, int jid);
+
+/* gets the number of jobs in the list, returns -1 on failure */
+int get_job_count(job_list_t *job_list);
 
 /*
  * gets next PID in list
@@ -46,7 +113,93 @@ int get_job_jid(job_list_t *job_list, pid_t pid);
  */
 pid_t get_next_pid(job_list_t *job_list);
 
-/* jobs command, prints out the jobs list */
+/*
+ * gets the IDs of the process groups of up to size jobs in the list, leaving
+ * out the queued jobs, which have none, so that the caller can wait for the
+ * children of this list alone. returns the number of IDs stored in pgids
+ */
+int get_job_pgids(job_list_t *job_list, pid_t *pgids, int size);
+
+/*
+ * sends a signal to the process group of a job, given job's PID, through
+ * the job's pidfd when there is one, returns 0 on success, -1 on failure
+ */
+int signal_job_pid(job_list_t *job_list, pid_t pid, int sig);
+
+/*
+ * waits for a change in the state of a process of a job, given its PID,
+ * through the process's pidfd when there is one. options and status are
+ * those of waitpid, and if usage is not NULL the resources used by a process
+ * that has terminated are stored in it, as wait4 would store them.
+ * returns the PID on success, 0 if WNOHANG was given and the process has not
+ * changed state, -1 on failure
+ */
+pid_t wait_job_pid(job_list_t *job_list, pid_t pid, int *status, int options,
+                   struct rusage *usage);
+/*
+ * converts the siginfo filled in by waitid into the status that waitpid
+ * would have returned, so that the W* macros can be used on it
+ */
+int siginfo_to_status(const siginfo_t *info);
+
+/* sets the time a job was launched, given job's PID, which add_job sets to
+        the time the job was added, returns 0 on success, -1 on failure */
+int set_job_start_pid(job_list_t *job_list, pid_t pid,
+                      const struct timespec *start);
+/* gets the time a job was launched, given job's PID,
+        returns 0 on success, -1 on failure */
+int get_job_start_pid(job_list_t *job_list, pid_t pid,
+                      struct timespec *start);
+
+/* gets the time the last process of a finished job was reaped, given job's
+        JID, returns 0 on success, -1 on failure, or if the job has a
+        process that has not been reaped */
+int get_job_end_jid(job_list_t *job_list, int jid, struct timespec *end);
+
+/*
+ * formats the resources used by a process launched at start into buffer,
+ * as the elapsed real time, up to end, or to now if end is NULL, user and
+ * system CPU time, maximum resident set size and voluntary and involuntary
+ * context switches.
+ * returns the number of characters written, as snprintf does
+ */
+int format_usage(char *buffer, size_t size, const struct timespec *start,
+                 const struct timespec *end, const struct rusage *usage);
+
+/*
+ * gets the epoll file descriptor that becomes readable when any process of
+ * any job exits, returns -1 if the jobs are not tracked by pidfds
+ */
+int get_job_epoll_fd(job_list_t *job_list);
+
+/*
+ * gets the PID of a process of a job that has exited and is ready to be
+ * waited for, without blocking. returns the PID if there is one, -1 otherwise
+ */
+pid_t get_exited_pid(job_list_t *job_list);
+/*
+ * gets the PIDs of up to size processes of jobs that have exited and are
+ * ready to be waited for, without blocking, so that the caller can pick
+ * which of them to wait for. returns the number of PIDs stored in pids
+ */
+int get_exited_pids(job_list_t *job_list, pid_t *pids, int size);
+/*
+ * records the time that each process which has exited, but has not been
+ * reaped yet, was first seen to exit, without reaping it. A job whose last
+ * process was seen to exit this way is reported as having ended at that time
+ * once it is reaped, rather than at the time it is reaped
+ */
+void note_exited_processes(job_list_t *job_list);
+
+/*
+ * jobs command, prints out the jobs list. A queued job is listed with its
+ * position in the queue instead of a PID
+ */
 void jobs(job_list_t *job_list);
+/*
+ * jobs -l command, prints out the jobs list along with the time each job has
+ * been running and the resources its process has used so far
+ */
+void jobs_long(job_list_t *job_list);
 
 #endif  // JOBS_H_
@@ -0,0 +1,485 @@
+#include "./launcher.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "./parser.h"
+
+// The launcher is handed its end of the socket on this descriptor
+#define LAUNCHER_FD 3
+// The largest request, holding the request header and every string
+#define MESSAGE_SIZE 131072
+// The descriptors sent with a request: the shell's working directory,
+// standard input, output and error, and the two pipes of a pipeline stage
+#define BASE_FDS 4
+#define MAX_FDS 6
+
+extern char **environ;
+
+// pid is the helper process, and socket_fd the shell's end of its socket
+// message is the buffer requests are built in
+struct launcher {
+    pid_t pid;
+    int socket_fd;
+    char *message;
+};
+
+// The fixed part of a request. It is followed by null terminated strings:
+// the path of the executable, the argc words of argv, and the four entries
+// of the redirect array, each empty if the entry is NULL
+typedef struct launch_request {
+    pid_t pgid;
+    int foreground;
+    int argc;
+    int has_input;
+    int has_output;
+} launch_request_t;
+
+// The reply to a request: the pid of the child, or -1 and the errno of the
+// failure, and the errno of the child's exec if it was started but could not
+// execute the file
+typedef struct launch_reply {
+    pid_t pid;
+    int error;
+    int exec_error;
+} launch_reply_t;
+
+// The control message that carries the descriptors of a request
+typedef union launch_control {
+    char buffer[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    struct cmsghdr align;
+} launch_control_t;
+
+/*
+ * starts the launcher, returns pointer, or NULL on failure
+ */
+launcher_t *start_launcher() {
+    int fds[2];
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    char fd_string[16];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1) {
+        perror("socketpair");
+        return NULL;
+    }
+
+    // The helper's end is moved to LAUNCHER_FD, from a copy that cannot
+    // already be there
+    int helper_fd = fcntl(fds[1], F_DUPFD_CLOEXEC, LAUNCHER_FD + 1);
+    close(fds[1]);
+    if (helper_fd == -1) {
+        perror("fcntl");
+        close(fds[0]);
+        return NULL;
+    }
+
+    snprintf(fd_string, sizeof(fd_string), "%d", LAUNCHER_FD);
+    char *argv[] = {"33sh", "--launcher", fd_string, NULL};
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, helper_fd, LAUNCHER_FD);
+
+    int result =
+        posix_spawn(&pid, "/proc/self/exe", &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(helper_fd);
+
+    if (result != 0) {
+        errno = result;
+        perror("launcher");
+        close(fds[0]);
+        return NULL;
+    }
+
+    launcher_t *launcher = (launcher_t *)malloc(sizeof(launcher_t));
+    launcher->pid = pid;
+    launcher->socket_fd = fds[0];
+    launcher->message = (char *)malloc(MESSAGE_SIZE);
+    return launcher;
+}
+
+/*
+ * stops the launcher
+ * Note: this function will free the launcher pointer
+ */
+void stop_launcher(launcher_t *launcher) {
+    if (launcher == NULL) {
+        return;
+    }
+
+    // The launcher exits once it reads the end of its socket
+    close(launcher->socket_fd);
+    waitpid(launcher->pid, NULL, 0);
+    free(launcher->message);
+    free(launcher);
+}
+
+/*
+ * appends a string, or an empty one for NULL, to a request, returns 0 on
+ * success, -1 if the request would be too large
+ */
+static int append_string(char *message, size_t *length, const char *string) {
+    if (string == NULL) {
+        string = "";
+    }
+
+    size_t string_length = strlen(string) + 1;
+    if (*length + string_length > MESSAGE_SIZE) {
+        return -1;
+    }
+    memcpy(message + *length, string, string_length);
+    *length += string_length;
+    return 0;
+}
+
+/*
+ * asks the launcher to start an executable, returns the pid of the child, or
+ * -1 with errno set on failure
+ */
+pid_t launcher_spawn(launcher_t *launcher, const char *file_path,
+                     char *argv[], char *redirect[], int foreground,
+                     pid_t pgid, int input_fd, int output_fd,
+                     int *exec_error) {
+    launch_request_t request;
+    launch_reply_t reply;
+    launch_control_t control;
+    int fds[MAX_FDS];
+    size_t length = sizeof(request);
+
+    request.pgid = pgid;
+    request.foreground = foreground;
+    request.argc = 0;
+    request.has_input = input_fd != -1;
+    request.has_output = output_fd != -1;
+
+    int too_large = append_string(launcher->message, &length, file_path);
+    for (; argv[request.argc] != NULL && !too_large; request.argc++) {
+        too_large =
+            append_string(launcher->message, &length, argv[request.argc]);
+    }
+    for (int i = 0; i < 4 && !too_large; i++) {
+        too_large = append_string(launcher->message, &length, redirect[i]);
+    }
+    if (too_large) {
+        errno = E2BIG;
+        return -1;
+    }
+    memcpy(launcher->message, &request, sizeof(request));
+
+    // The child starts in the shell's working directory, with its standard
+    // descriptors, which may have changed since the launcher was started
+    int cwd_fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd_fd == -1) {
+        return -1;
+    }
+    int fd_count = 0;
+    fds[fd_count++] = cwd_fd;
+    fds[fd_count++] = 0;
+    fds[fd_count++] = 1;
+    fds[fd_count++] = 2;
+    if (input_fd != -1) {
+        fds[fd_count++] = input_fd;
+    }
+    if (output_fd != -1) {
+        fds[fd_count++] = output_fd;
+    }
+
+    struct iovec iov = {launcher->message, length};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)fd_count);
+
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)fd_count);
+    memcpy(CMSG_DATA(header), fds, sizeof(int) * (size_t)fd_count);
+
+    ssize_t sent;
+    while ((sent = sendmsg(launcher->socket_fd, &message, MSG_NOSIGNAL)) ==
+               -1 &&
+           errno == EINTR) {
+    }
+    close(cwd_fd);
+    if (sent == -1) {
+        return -1;
+    }
+
+    ssize_t received;
+    while ((received = recv(launcher->socket_fd, &reply, sizeof(reply), 0)) ==
+               -1 &&
+           errno == EINTR) {
+    }
+    if (received != (ssize_t)sizeof(reply)) {
+        errno = received == -1 ? errno : EPIPE;
+        return -1;
+    }
+
+    if (reply.pid == -1) {
+        errno = reply.error;
+    }
+    *exec_error = reply.exec_error;
+    return reply.pid;
+}
+
+/*
+ * applies the input and output redirections to standard input and output,
+ * returns 0 on success, -1 on failure
+ */
+int apply_redirects(char *redirect[], const char *name) {
+    // This handles the input redirection. If the input redirection index
+    // in the redirect array is not NULL, the input is redirected to the
+    // specified file
+    if (redirect[INPUT_REDIRECTION] != NULL) {
+        int fd = open(redirect[INPUT_REDIRECTION_FILE], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(name);
+            return -1;
+        }
+        if (dup2(fd, 0) == -1) {
+            perror("dup2");
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+
+    // This handles output redirection for > and >>. The file is truncated
+    // for >, and appended to for >>
+    if (redirect[OUTPUT_REDIRECTION] != NULL) {
+        int flags = strcmp(redirect[OUTPUT_REDIRECTION], ">>") == 0
+                        ? O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC
+                        : O_RDWR | O_TRUNC | O_CREAT | O_CLOEXEC;
+        int fd = open(redirect[OUTPUT_REDIRECTION_FILE], flags, 0777);
+        if (fd == -1) {
+            perror(name);
+            return -1;
+        }
+        if (dup2(fd, 1) == -1) {
+            perror("dup2");
+            close(fd);
+            return -1;
+        }
+        close(fd);
+    }
+
+    return 0;
+}
+
+/*
+ * sets up and executes a child of the launcher, in the same way as a child
+ * forked by the shell. If the exec fails, its errno is written to status_fd
+ * first. Never returns
+ */
+static void run_child(const launch_request_t *request, const int fds[],
+                      const char *file_path, char *argv[], char *redirect[],
+                      int status_fd) {
+    int next_fd = BASE_FDS;
+    sigset_t empty_set;
+
+    // The shell's directory and descriptors take the place of the
+    // launcher's own
+    if (fchdir(fds[0]) == -1 || dup2(fds[1], 0) == -1 ||
+        dup2(fds[2], 1) == -1 || dup2(fds[3], 2) == -1) {
+        _exit(1);
+    }
+
+    // Joining the process group of the first stage of the pipeline, or
+    // starting one, which takes the terminal if it runs in the foreground
+    if (setpgid(0, request->pgid) == -1) {
+        perror("setpgid");
+        _exit(1);
+    }
+    if (request->foreground && request->pgid == 0 &&
+        tcsetpgrp(0, getpgrp()) == -1) {
+        perror("tcsetpgrp");
+        _exit(1);
+    }
+
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    sigemptyset(&empty_set);
+    sigprocmask(SIG_SETMASK, &empty_set, NULL);
+
+    // The pipes are connected before the redirects, so that a redirect wins
+    if ((request->has_input && dup2(fds[next_fd++], 0) == -1) ||
+        (request->has_output && dup2(fds[next_fd], 1) == -1)) {
+        perror("dup2");
+        _exit(1);
+    }
+    if (apply_redirects(redirect, argv[0]) == -1) {
+        _exit(1);
+    }
+
+    // A failed exec is reported to the launcher, and the child exits with
+    // the status the shell gives a failed exec, 127 if there is no such file
+    execve(file_path, argv, environ);
+    int exec_error = errno;
+    if (write(status_fd, &exec_error, sizeof(exec_error)) == -1) {
+        perror("write");
+    }
+    perror("execv");
+    _exit(exec_error == ENOENT ? 127 : 126);
+}
+
+/*
+ * starts the child that a request asks for, and waits until it has executed,
+ * or failed to, in which case its errno is stored in exec_error, returns its
+ * pid, or -1 with errno set on failure
+ */
+static pid_t launch_request(char *message, size_t length, const int fds[],
+                            int fd_count, int *exec_error) {
+    launch_request_t request;
+    char *redirect[4];
+
+    memcpy(&request, message, sizeof(request));
+    if (length < sizeof(request) || request.argc < 1 ||
+        fd_count != BASE_FDS + request.has_input + request.has_output ||
+        message[length - 1] != '\0') {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The strings are pointed to where they are in the message
+    char **argv =
+        (char **)malloc(sizeof(char *) * ((size_t)request.argc + 1));
+    char *cursor = message + sizeof(request);
+    char *end = message + length;
+    const char *file_path = cursor;
+    cursor += strlen(cursor) + 1;
+    for (int i = 0; i < request.argc && cursor < end; i++) {
+        argv[i] = cursor;
+        cursor += strlen(cursor) + 1;
+    }
+    argv[request.argc] = NULL;
+    for (int i = 0; i < 4; i++) {
+        redirect[i] = cursor < end && *cursor != '\0' ? cursor : NULL;
+        cursor += cursor < end ? strlen(cursor) + 1 : 0;
+    }
+
+    // The child reports a failed exec through a pipe that its exec closes
+    // otherwise, as posix_spawn does, so that the shell is told of the
+    // failure rather than left to guess it from the child's exit status
+    int status_fds[2];
+    if (pipe2(status_fds, O_CLOEXEC) == -1) {
+        free(argv);
+        return -1;
+    }
+
+    // With CLONE_PARENT the child is a child of the shell rather than of
+    // the launcher, so the shell can wait for it and is sent its SIGCHLD
+    pid_t pid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, NULL,
+                               NULL, 0);
+    if (pid == 0) {
+        run_child(&request, fds, file_path, argv, redirect, status_fds[1]);
+    }
+
+    close(status_fds[1]);
+    *exec_error = 0;
+    if (pid != -1) {
+        ssize_t count;
+        while ((count = read(status_fds[0], exec_error,
+                             sizeof(*exec_error))) == -1 &&
+               errno == EINTR) {
+        }
+        if (count != (ssize_t)sizeof(*exec_error)) {
+            *exec_error = 0;
+        }
+    }
+    close(status_fds[0]);
+
+    free(argv);
+    return pid;
+}
+
+/*
+ * the main loop of the launcher, returns its exit status once the shell has
+ * closed its end of the socket
+ */
+int run_launcher(int socket_fd) {
+    launch_control_t control;
+    char *message = (char *)malloc(MESSAGE_SIZE);
+
+    // The launcher goes when the shell does, and ignores the signals that
+    // the shell ignores, so that its children start out the same way as the
+    // shell's own
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // The socket was handed over with dup2, which clears FD_CLOEXEC. Without
+    // it, every program the launcher starts would hold the socket, and could
+    // send the shell replies of its own
+    if (fcntl(socket_fd, F_SETFD, FD_CLOEXEC) == -1) {
+        perror("fcntl");
+        free(message);
+        return 1;
+    }
+
+    while (1) {
+        struct iovec iov = {message, MESSAGE_SIZE};
+        struct msghdr header;
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        header.msg_control = control.buffer;
+        header.msg_controllen = sizeof(control.buffer);
+
+        ssize_t length = recvmsg(socket_fd, &header, MSG_CMSG_CLOEXEC);
+        if (length == -1 && errno == EINTR) {
+            continue;
+        }
+        if (length <= 0) {
+            break;
+        }
+
+        int fds[MAX_FDS];
+        int fd_count = 0;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            fd_count =
+                (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (size_t)fd_count);
+        }
+
+        launch_reply_t reply;
+        reply.pid = launch_request(message, (size_t)length, fds, fd_count,
+                                   &reply.exec_error);
+        reply.error = reply.pid == -1 ? errno : 0;
+        for (int i = 0; i < fd_count; i++) {
+            close(fds[i]);
+        }
+
+        if (send(socket_fd, &reply, sizeof(reply), MSG_NOSIGNAL) == -1) {
+            break;
+        }
+    }
+
+    free(message);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef LAUNCHER_H_
+#define LAUNCHER_H_
+
+#include <sys/types.h>
+
+typedef struct launcher launcher_t;
+
+/*
+ * starts the launcher, a helper process that starts children on the shell's
+ * behalf. The helper is a fresh copy of the shell's executable, run with
+ * --launcher, so its address space stays small however large the shell
+ * grows, and a fork from it costs the same at any time. It is connected to
+ * the shell by a UNIX socket, and lives in a process group of its own, so
+ * that signals from the terminal do not reach it.
+ * returns pointer, or NULL on failure
+ */
+launcher_t *start_launcher();
+/*
+ * stops the launcher, closing its socket and waiting for it to exit
+ * Note: this function will free the launcher pointer. DO NOT use it after
+ * this function is called
+ */
+void stop_launcher(launcher_t *launcher);
+
+/*
+ * asks the launcher to start the executable at file_path with the null
+ * terminated argv array. redirect holds the redirections, indexed as in
+ * parser.h. The child joins process group pgid, or a new group of its own if
+ * pgid is 0, in which case it takes the terminal if foreground is set. The
+ * shell's standard input, output and error, and input_fd and output_fd for
+ * its standard input and output unless they are -1, are passed to the
+ * launcher with SCM_RIGHTS. The launcher creates the child with CLONE_PARENT,
+ * so that it is a child of the shell, which waits for it as usual. The
+ * launcher replies once the child has executed, or has failed to, in which
+ * case exec_error is set to the errno of the exec, and to 0 otherwise. A
+ * child that fails to execute still exits, and is waited for.
+ * returns the pid of the child, or -1 with errno set on failure
+ */
+pid_t launcher_spawn(launcher_t *launcher, const char *file_path,
+                     char *argv[], char *redirect[], int foreground,
+                     pid_t pgid, int input_fd, int output_fd,
+                     int *exec_error);
+
+/*
+ * the main loop of the launcher, run by the helper process on the socket
+ * descriptor it was given, returns the exit status of the helper once the
+ * shell has closed its end
+ */
+int run_launcher(int socket_fd);
+
+/*
+ * applies the input and output redirections in the redirect array to the
+ * standard input and output of the calling process. Each file is opened and
+ * moved onto its descriptor with dup2, so that the descriptor is left as it
+ * was if the file cannot be opened, in which case an error is printed,
+ * prefixed with name.
+ * returns 0 on success, -1 on failure
+ */
+int apply_redirects(char *redirect[], const char *name);
+
+#endif  // LAUNCHER_H_
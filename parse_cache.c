@@ -0,0 +1,254 @@
+#include "./parse_cache.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lines longer than this are parsed without being remembered
+#define MAX_CACHED_LINE 4096
+// Each entry parses into an arena of its own, which only ever holds one line
+#define ENTRY_BLOCK_SIZE 1024
+
+struct cache_entry {
+    uint64_t hash;
+    char *line;
+    size_t length;
+    command_t command;
+    parse_arena_t *arena;
+    struct cache_entry *next_in_bucket;
+    struct cache_entry *newer;
+    struct cache_entry *older;
+};
+typedef struct cache_entry cache_entry_t;
+
+// buckets holds the chains of entries, indexed by the hash of their lines,
+// and has a power of two entries, at least as many as the capacity
+// newest and oldest are the ends of the list of entries in the order they
+// were last used, and the oldest is forgotten first
+// spare is the entry that the next new line is parsed into. Once the line has
+// parsed it takes its place in the cache, and the oldest entry, if the cache
+// was full, becomes the spare in turn, so that a line with a syntax error
+// never pushes a remembered one out, and the arenas are reused
+// last is the entry that holds the command handed out by the last call, which
+// is kept when the cache is cleared, since it may be running
+struct parse_cache {
+    cache_entry_t **buckets;
+    size_t bucket_mask;
+    cache_entry_t *newest;
+    cache_entry_t *oldest;
+    cache_entry_t *spare;
+    cache_entry_t *last;
+    int capacity;
+    int count;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/*
+ * hash of a line, taken eight bytes at a time, since hashing a byte at a time
+ * costs about as much as lexing the line. Each word is mixed in with a
+ * multiply, and the bits are folded down at the end so that the low bits
+ * used for the bucket depend on every byte
+ */
+static uint64_t hash_line(const char *line, size_t length) {
+    uint64_t hash = 14695981039346656037u ^ length;
+    uint64_t word;
+    size_t i = 0;
+
+    for (; i + 8 <= length; i += 8) {
+        memcpy(&word, line + i, 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15u;
+        hash ^= hash >> 29;
+    }
+    if (i < length) {
+        word = 0;
+        memcpy(&word, line + i, length - i);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15u;
+    }
+
+    hash ^= hash >> 32;
+    hash *= 0xd6e8feb86659fd93u;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/* allocates an entry with an empty arena */
+static cache_entry_t *new_entry() {
+    cache_entry_t *entry = (cache_entry_t *)calloc(1, sizeof(cache_entry_t));
+    entry->arena = init_parse_arena_sized(ENTRY_BLOCK_SIZE);
+    return entry;
+}
+
+/* frees an entry and its arena */
+static void free_entry(cache_entry_t *entry) {
+    cleanup_parse_arena(entry->arena);
+    free(entry);
+}
+
+/* takes an entry out of the list of entries in the order they were used */
+static void unlink_entry(parse_cache_t *cache, cache_entry_t *entry) {
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        cache->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        cache->oldest = entry->newer;
+    }
+    entry->newer = NULL;
+    entry->older = NULL;
+}
+
+/* puts an entry at the newest end of the list */
+static void push_newest(parse_cache_t *cache, cache_entry_t *entry) {
+    entry->older = cache->newest;
+    entry->newer = NULL;
+    if (cache->newest != NULL) {
+        cache->newest->newer = entry;
+    } else {
+        cache->oldest = entry;
+    }
+    cache->newest = entry;
+}
+
+/* takes an entry out of its bucket */
+static void remove_from_bucket(parse_cache_t *cache, cache_entry_t *entry) {
+    cache_entry_t **link = &cache->buckets[entry->hash & cache->bucket_mask];
+    while (*link != entry) {
+        link = &(*link)->next_in_bucket;
+    }
+    *link = entry->next_in_bucket;
+    entry->next_in_bucket = NULL;
+}
+
+/* initializes the cache, returns pointer */
+parse_cache_t *init_parse_cache(int capacity) {
+    parse_cache_t *cache = (parse_cache_t *)calloc(1, sizeof(parse_cache_t));
+    size_t bucket_count = 1;
+    while (bucket_count < (size_t)capacity) {
+        bucket_count <<= 1;
+    }
+
+    cache->buckets =
+        (cache_entry_t **)calloc(bucket_count, sizeof(cache_entry_t *));
+    cache->bucket_mask = bucket_count - 1;
+    cache->capacity = capacity > 0 ? capacity : 1;
+    cache->spare = new_entry();
+    cache->last = cache->spare;
+    return cache;
+}
+
+/*
+ * cleans up the cache
+ * Note: this function will free the cache pointer
+ */
+void cleanup_parse_cache(parse_cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    clear_parse_cache(cache);
+    free_entry(cache->last);
+    free(cache->buckets);
+    free(cache);
+}
+
+/* parses one line of input into command through the cache */
+int parse_cached(parse_cache_t *cache, const char *line, size_t length,
+                 command_t *command) {
+    // A line too long to be remembered is parsed straight away
+    if (length > MAX_CACHED_LINE) {
+        cache->misses++;
+        cache->last = cache->spare;
+        reset_parse_arena(cache->spare->arena);
+        return parse_command(cache->spare->arena, line, length, command);
+    }
+    uint64_t hash = hash_line(line, length);
+
+    // A hit is moved to the newest end of the list, and its command copied
+    // out, without looking at the line again beyond comparing it
+    cache_entry_t *entry = cache->buckets[hash & cache->bucket_mask];
+    for (; entry != NULL; entry = entry->next_in_bucket) {
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(entry->line, line, length) == 0) {
+            cache->hits++;
+            unlink_entry(cache, entry);
+            push_newest(cache, entry);
+            cache->last = entry;
+            *command = entry->command;
+            return 1;
+        }
+    }
+
+    // Otherwise the line is parsed into the spare entry, and only a line
+    // that holds a command, and is short enough, is remembered
+    cache->misses++;
+    entry = cache->spare;
+    cache->last = entry;
+    reset_parse_arena(entry->arena);
+    int parse_result = parse_command(entry->arena, line, length, command);
+    if (parse_result != 1) {
+        return parse_result;
+    }
+
+    entry->hash = hash;
+    entry->length = length;
+    entry->line = (char *)arena_alloc(entry->arena, length + 1);
+    memcpy(entry->line, line, length);
+    entry->line[length] = '\0';
+    entry->command = *command;
+
+    size_t bucket = hash & cache->bucket_mask;
+    entry->next_in_bucket = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    push_newest(cache, entry);
+
+    if (cache->count < cache->capacity) {
+        cache->count++;
+        cache->spare = new_entry();
+    } else {
+        cache->spare = cache->oldest;
+        unlink_entry(cache, cache->spare);
+        remove_from_bucket(cache, cache->spare);
+    }
+    return 1;
+}
+
+/* forgets every remembered line, and resets the counters */
+void clear_parse_cache(parse_cache_t *cache) {
+    // The entry of the last command becomes the spare, and every other entry
+    // is freed
+    if (cache->last != cache->spare) {
+        free_entry(cache->spare);
+    }
+    cache_entry_t *entry = cache->newest;
+    while (entry != NULL) {
+        cache_entry_t *older = entry->older;
+        if (entry != cache->last) {
+            free_entry(entry);
+        }
+        entry = older;
+    }
+    cache->spare = cache->last;
+    cache->spare->newer = NULL;
+    cache->spare->older = NULL;
+    cache->spare->next_in_bucket = NULL;
+
+    memset(cache->buckets, 0,
+           sizeof(cache_entry_t *) * (cache->bucket_mask + 1));
+    cache->newest = NULL;
+    cache->oldest = NULL;
+    cache->count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+/* cache command, prints out the size of the cache and its counters */
+void print_parse_cache(parse_cache_t *cache) {
+    unsigned long lookups = cache->hits + cache->misses;
+    printf("%d/%d lines, %lu hits, %lu misses (%.1f%% hit rate)\n",
+           cache->count, cache->capacity, cache->hits, cache->misses,
+           lookups > 0 ? 100.0 * (double)cache->hits / (double)lookups : 0.0);
+}
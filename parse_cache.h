@@ -0,0 +1,43 @@
+#ifndef PARSE_CACHE_H_
+#define PARSE_CACHE_H_
+
+#include <stddef.h>
+#include "./parser.h"
+
+typedef struct parse_cache parse_cache_t;
+
+/*
+ * initializes a cache that remembers the parsed form of up to capacity lines,
+ * returns pointer
+ */
+parse_cache_t *init_parse_cache(int capacity);
+/*
+ * cleans up the cache
+ * Note: this function will free the cache pointer, and with it every command
+ * it handed out. DO NOT use either after this function is called
+ */
+void cleanup_parse_cache(parse_cache_t *cache);
+
+/*
+ * parses one line of input into command, as parse_command does, through the
+ * cache. A line that has been parsed before, byte for byte, is found by the
+ * hash of its bytes and is not lexed again. The least recently used line is
+ * forgotten once the cache is full. Lines with a syntax error, and very long
+ * lines, are never remembered.
+ * returns 1 if a command was parsed, 0 if the line was empty, -1 on a syntax
+ * error. The command and everything it points to belong to the cache, must
+ * not be changed, and are valid until the next call
+ */
+int parse_cached(parse_cache_t *cache, const char *line, size_t length,
+                 command_t *command);
+
+/* forgets every remembered line, and resets the counters */
+void clear_parse_cache(parse_cache_t *cache);
+
+/*
+ * cache command, prints out the number of lines remembered and the number of
+ * lines found in the cache and parsed anew, with the hit rate
+ */
+void print_parse_cache(parse_cache_t *cache);
+
+#endif  // PARSE_CACHE_H_
@@ -0,0 +1,626 @@
+#include "./parser.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+#define INITIAL_ARGV_CAPACITY 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+typedef struct arena_block arena_block_t;
+
+// head is the first block of the arena
+// current is the block that allocations are being made from
+// block_size is the smallest size of a new block
+// Resetting the arena rewinds every block, so blocks are only ever allocated
+// while the arena is growing to the size of the largest command seen
+struct parse_arena {
+    arena_block_t *head;
+    arena_block_t *current;
+    size_t block_size;
+};
+
+// Every byte of input is classified once through this table. Bytes that are
+// not listed are ordinary word characters
+typedef enum {
+    CLASS_WORD = 0,
+    CLASS_BLANK,
+    CLASS_OPERATOR,
+    CLASS_SINGLE_QUOTE,
+    CLASS_DOUBLE_QUOTE,
+    CLASS_BACKSLASH,
+    CLASS_DOLLAR
+} byte_class_t;
+
+static const unsigned char byte_classes[256] = {
+    [' '] = CLASS_BLANK,         ['\t'] = CLASS_BLANK,
+    ['\r'] = CLASS_BLANK,        ['<'] = CLASS_OPERATOR,
+    ['>'] = CLASS_OPERATOR,      ['&'] = CLASS_OPERATOR,
+    ['|'] = CLASS_OPERATOR,      [';'] = CLASS_OPERATOR,
+    ['\''] = CLASS_SINGLE_QUOTE, ['"'] = CLASS_DOUBLE_QUOTE,
+    ['\\'] = CLASS_BACKSLASH,    ['$'] = CLASS_DOLLAR,
+};
+
+typedef enum {
+    TOKEN_WORD,
+    TOKEN_INPUT,
+    TOKEN_OUTPUT,
+    TOKEN_APPEND,
+    TOKEN_BACKGROUND,
+    TOKEN_PIPE,
+    TOKEN_AND,
+    TOKEN_OR,
+    TOKEN_SEMICOLON,
+    TOKEN_END,
+    TOKEN_ERROR
+} token_type_t;
+
+// cursor and end delimit the bytes of the line that have not been lexed yet.
+// Words are unquoted into output, a buffer the length of the line allocated
+// from the arena, which is never overrun since a word never grows when its
+// quotes and escapes are removed, and its terminator takes the place of the
+// byte that ended it. expand is set once a word holds a variable reference
+typedef struct lexer {
+    const char *cursor;
+    const char *end;
+    char *output;
+    int expand;
+} lexer_t;
+
+/* allocates a block able to hold at least size bytes, and at least
+        block_size */
+static arena_block_t *new_block(size_t size, size_t block_size) {
+    if (size < block_size) {
+        size = block_size;
+    }
+    arena_block_t *block =
+        (arena_block_t *)malloc(sizeof(arena_block_t) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/* allocates size bytes from the arena, reusing rewound blocks first */
+void *arena_alloc(parse_arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+
+    while (arena->current->size - arena->current->used < size) {
+        if (arena->current->next == NULL) {
+            arena->current->next = new_block(size, arena->block_size);
+        }
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+    }
+
+    void *memory = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return memory;
+}
+
+/* initializes an arena for parsed commands, returns pointer */
+parse_arena_t *init_parse_arena() {
+    return init_parse_arena_sized(ARENA_BLOCK_SIZE);
+}
+
+/* initializes an arena that grows in blocks of block_size, returns pointer */
+parse_arena_t *init_parse_arena_sized(size_t block_size) {
+    parse_arena_t *arena = (parse_arena_t *)malloc(sizeof(parse_arena_t));
+    arena->block_size = block_size;
+    arena->head = new_block(block_size, block_size);
+    arena->current = arena->head;
+    return arena;
+}
+
+/*
+ * cleans up the arena
+ * Note: this function will free the arena pointer, and with it every command
+ * parsed into it. DO NOT use either after this function is called
+ */
+void cleanup_parse_arena(parse_arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena_block_t *cur = arena->head;
+    while (cur != NULL) {
+        arena_block_t *next_block = cur->next;
+        free(cur);
+        cur = next_block;
+    }
+
+    free(arena);
+}
+
+/*
+ * releases every command parsed into the arena, keeping its memory for the
+ * next command
+ */
+void reset_parse_arena(parse_arena_t *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    arena->head->used = 0;
+    arena->current = arena->head;
+}
+
+/* returns whether a $ followed by c starts a variable reference */
+static int starts_variable(char c) {
+    return c == '_' || c == '{' || c == '?' || (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+/*
+ * lexes the next token of the line. Words are unquoted into the lexer's
+ * output buffer and *word is set to point at them
+ */
+static token_type_t next_token(lexer_t *lexer, char **word) {
+    const char *cursor = lexer->cursor;
+    const char *end = lexer->end;
+
+    while (cursor < end &&
+           byte_classes[(unsigned char)*cursor] == CLASS_BLANK) {
+        cursor++;
+    }
+
+    if (cursor == end) {
+        lexer->cursor = cursor;
+        return TOKEN_END;
+    }
+
+    // Operators are recognized from their first byte, and the byte after it
+    // for the two byte operators
+    if (byte_classes[(unsigned char)*cursor] == CLASS_OPERATOR) {
+        char operator = *cursor++;
+        token_type_t type = TOKEN_BACKGROUND;
+        if (operator == '<') {
+            type = TOKEN_INPUT;
+        } else if (operator == ';') {
+            type = TOKEN_SEMICOLON;
+        } else if (operator == '&') {
+            if (cursor < end && *cursor == '&') {
+                cursor++;
+                type = TOKEN_AND;
+            }
+        } else if (operator == '|') {
+            type = TOKEN_PIPE;
+            if (cursor < end && *cursor == '|') {
+                cursor++;
+                type = TOKEN_OR;
+            }
+        } else if (operator == '>') {
+            type = TOKEN_OUTPUT;
+            if (cursor < end && *cursor == '>') {
+                cursor++;
+                type = TOKEN_APPEND;
+            }
+        }
+        lexer->cursor = cursor;
+        return type;
+    }
+
+    // Anything else starts a word, which runs until an unquoted blank or
+    // operator
+    char *output = lexer->output;
+    *word = output;
+
+    while (cursor < end) {
+        switch (byte_classes[(unsigned char)*cursor]) {
+            case CLASS_WORD:
+                *output++ = *cursor++;
+                continue;
+
+            case CLASS_DOLLAR:
+                // A variable reference is marked, so that it can be told
+                // apart from a $ that was quoted or escaped
+                if (cursor + 1 < end && starts_variable(cursor[1])) {
+                    *output++ = VARIABLE_MARK;
+                    lexer->expand = 1;
+                } else {
+                    *output++ = '$';
+                }
+                cursor++;
+                continue;
+
+            case CLASS_BACKSLASH:
+                // A backslash makes the next byte part of the word, whatever
+                // it is. A trailing backslash stands for itself
+                cursor++;
+                *output++ = cursor < end ? *cursor++ : '\\';
+                continue;
+
+            case CLASS_SINGLE_QUOTE: {
+                // Everything up to the closing quote is taken as it is
+                const char *close = memchr(cursor + 1, '\'',
+                                           (size_t)(end - cursor - 1));
+                if (close == NULL) {
+                    fprintf(stderr, "%s",
+                            "syntax error: unterminated single quote\n");
+                    return TOKEN_ERROR;
+                }
+                size_t quoted = (size_t)(close - cursor - 1);
+                memcpy(output, cursor + 1, quoted);
+                output += quoted;
+                cursor = close + 1;
+                continue;
+            }
+
+            case CLASS_DOUBLE_QUOTE:
+                // Inside double quotes a backslash only escapes the
+                // characters that would otherwise be special there
+                cursor++;
+                while (cursor < end && *cursor != '"') {
+                    if (*cursor == '\\' && cursor + 1 < end &&
+                        (cursor[1] == '"' || cursor[1] == '\\' ||
+                         cursor[1] == '$' || cursor[1] == '`')) {
+                        cursor++;
+                    } else if (*cursor == '$' && cursor + 1 < end &&
+                               starts_variable(cursor[1])) {
+                        *output++ = VARIABLE_MARK;
+                        lexer->expand = 1;
+                        cursor++;
+                        continue;
+                    }
+                    *output++ = *cursor++;
+                }
+                if (cursor == end) {
+                    fprintf(stderr, "%s",
+                            "syntax error: unterminated double quote\n");
+                    return TOKEN_ERROR;
+                }
+                cursor++;
+                continue;
+
+            default:
+                break;
+        }
+        break;
+    }
+
+    *output++ = '\0';
+    lexer->output = output;
+    lexer->cursor = cursor;
+    return TOKEN_WORD;
+}
+
+/* appends a word to argv, doubling argv when it is full */
+static void append_word(parse_arena_t *arena, command_t *command, char *word) {
+    if (command->argc + 1 >= command->argv_capacity) {
+        int capacity = command->argv_capacity * 2;
+        char **argv =
+            (char **)arena_alloc(arena, sizeof(char *) * (size_t)capacity);
+        memcpy(argv, command->argv, sizeof(char *) * (size_t)command->argc);
+        command->argv = argv;
+        command->argv_capacity = capacity;
+    }
+
+    command->argv[command->argc++] = word;
+}
+
+/* sets up an empty command, with an argv array allocated from the arena */
+static void init_command(parse_arena_t *arena, command_t *command) {
+    command->argv_capacity = INITIAL_ARGV_CAPACITY;
+    command->argv = (char **)arena_alloc(
+        arena, sizeof(char *) * (size_t)command->argv_capacity);
+    command->argc = 0;
+    command->background = 0;
+    command->expand = 0;
+    command->next_stage = NULL;
+    command->connector = CONNECT_SEQUENCE;
+    command->next_command = NULL;
+    memset(command->redirect, 0, sizeof(command->redirect));
+}
+
+/* returns whether a token can follow the file of a redirect, or a | */
+static int ends_command(token_type_t type) {
+    return type == TOKEN_END || type == TOKEN_BACKGROUND ||
+           type == TOKEN_PIPE || type == TOKEN_AND || type == TOKEN_OR ||
+           type == TOKEN_SEMICOLON;
+}
+
+/* returns the operator that a token stands for, for error messages */
+static const char *operator_name(token_type_t type) {
+    switch (type) {
+        case TOKEN_BACKGROUND:
+            return "&";
+        case TOKEN_AND:
+            return "&&";
+        case TOKEN_OR:
+            return "||";
+        case TOKEN_SEMICOLON:
+            return ";";
+        default:
+            return "|";
+    }
+}
+
+/*
+ * parses one line of input into command, in a single pass over its bytes.
+ * The commands of a pipeline after the first are allocated from the arena
+ * and chained through next_stage, and so are the pipelines of a list after
+ * the first, through next_command. returns 1 if a command was parsed, 0 if
+ * the line was empty, -1 on a syntax error
+ */
+int parse_command(parse_arena_t *arena, const char *line, size_t length,
+                  command_t *command) {
+    lexer_t lexer;
+    lexer.cursor = line;
+    lexer.end = line + length;
+    lexer.output = (char *)arena_alloc(arena, length + 1);
+    lexer.expand = 0;
+    init_command(arena, command);
+
+    // Words and redirects go to the stage being parsed, of the pipeline in
+    // the list being parsed. previous is the pipeline before it, if any
+    command_t *pipeline = command;
+    command_t *previous = NULL;
+    command_t *stage = command;
+    char *word = NULL;
+    token_type_t type;
+
+    while ((type = next_token(&lexer, &word)) != TOKEN_END) {
+        if (type == TOKEN_ERROR) {
+            return -1;
+        }
+
+        switch (type) {
+            case TOKEN_WORD:
+                append_word(arena, stage, word);
+                break;
+
+            case TOKEN_BACKGROUND:
+            case TOKEN_AND:
+            case TOKEN_OR:
+            case TOKEN_SEMICOLON:
+                // Each of these ends the current pipeline, and starts the
+                // next pipeline of the list, which runs once the current one
+                // has been started in the background for &, or has finished
+                // otherwise
+                if (stage->argc == 0 &&
+                    (stage != pipeline ||
+                     (stage->redirect[INPUT_REDIRECTION] == NULL &&
+                      stage->redirect[OUTPUT_REDIRECTION] == NULL))) {
+                    fprintf(stderr, "syntax error: no command before %s\n",
+                            operator_name(type));
+                    return -1;
+                }
+                stage->argv[stage->argc] = NULL;
+                pipeline->background = type == TOKEN_BACKGROUND;
+                pipeline->expand = lexer.expand;
+                lexer.expand = 0;
+
+                previous = pipeline;
+                pipeline->next_command =
+                    (command_t *)arena_alloc(arena, sizeof(command_t));
+                pipeline = pipeline->next_command;
+                init_command(arena, pipeline);
+                pipeline->connector = type == TOKEN_AND  ? CONNECT_AND
+                                      : type == TOKEN_OR ? CONNECT_OR
+                                                         : CONNECT_SEQUENCE;
+                stage = pipeline;
+                break;
+
+            case TOKEN_PIPE:
+                // Each | ends the current stage and starts the next one
+                if (stage->argc == 0) {
+                    fprintf(stderr, "%s",
+                            "syntax error: no command before |\n");
+                    return -1;
+                }
+                stage->argv[stage->argc] = NULL;
+                stage->next_stage =
+                    (command_t *)arena_alloc(arena, sizeof(command_t));
+                stage = stage->next_stage;
+                init_command(arena, stage);
+                break;
+
+            case TOKEN_INPUT:
+                // If there is more than one redirect of the same type, or the
+                // redirection symbol is not followed by a file, an error is
+                // printed and the line is rejected
+                if (stage->redirect[INPUT_REDIRECTION] != NULL) {
+                    fprintf(stderr, "%s",
+                            "syntax error: multiple input files\n");
+                    return -1;
+                }
+                stage->redirect[INPUT_REDIRECTION] = "<";
+
+                type = next_token(&lexer, &word);
+                if (type == TOKEN_ERROR) {
+                    return -1;
+                }
+                if (ends_command(type)) {
+                    fprintf(stderr, "%s", "syntax error: no input file\n");
+                    return -1;
+                }
+                if (type != TOKEN_WORD) {
+                    fprintf(stderr, "%s",
+                            "syntax error: input file is a redirection "
+                            "symbol\n");
+                    return -1;
+                }
+                stage->redirect[INPUT_REDIRECTION_FILE] = word;
+                break;
+
+            case TOKEN_OUTPUT:
+            case TOKEN_APPEND:
+                if (stage->redirect[OUTPUT_REDIRECTION] != NULL) {
+                    fprintf(stderr, "%s",
+                            "syntax error: multiple output files\n");
+                    return -1;
+                }
+                stage->redirect[OUTPUT_REDIRECTION] =
+                    type == TOKEN_APPEND ? ">>" : ">";
+
+                type = next_token(&lexer, &word);
+                if (type == TOKEN_ERROR) {
+                    return -1;
+                }
+                if (ends_command(type)) {
+                    fprintf(stderr, "%s", "syntax error: no output file\n");
+                    return -1;
+                }
+                if (type != TOKEN_WORD) {
+                    fprintf(stderr, "%s",
+                            "syntax error: output file is a redirection "
+                            "symbol\n");
+                    return -1;
+                }
+                stage->redirect[OUTPUT_REDIRECTION_FILE] = word;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    stage->argv[stage->argc] = NULL;
+    pipeline->expand = lexer.expand;
+
+    if (stage != pipeline && stage->argc == 0) {
+        fprintf(stderr, "%s", "syntax error: no command after |\n");
+        return -1;
+    }
+
+    // A list may end with ; or &, but not with && or ||, and the empty
+    // pipeline after a final ; or & is dropped
+    if (pipeline->argc == 0 &&
+        pipeline->redirect[INPUT_REDIRECTION] == NULL &&
+        pipeline->redirect[OUTPUT_REDIRECTION] == NULL) {
+        if (pipeline->connector != CONNECT_SEQUENCE) {
+            fprintf(stderr, "syntax error: no command after %s\n",
+                    pipeline->connector == CONNECT_AND ? "&&" : "||");
+            return -1;
+        }
+        if (previous == NULL) {
+            return 0;
+        }
+        previous->next_command = NULL;
+    }
+
+    return 1;
+}
+
+/*
+ * finds the name of the variable referenced after a variable mark, setting
+ * *name and *name_length. returns the number of bytes the reference takes up
+ * after the mark
+ */
+static size_t variable_name(const char *reference, const char **name,
+                            size_t *name_length) {
+    // ${name} runs to the closing brace, while $? and $0 to $9 are a single
+    // character
+    if (*reference == '{') {
+        const char *close = strchr(reference, '}');
+        size_t length = close == NULL ? strlen(reference + 1)
+                                      : (size_t)(close - reference - 1);
+        *name = reference + 1;
+        *name_length = length;
+        return length + (close == NULL ? 1 : 2);
+    }
+
+    *name = reference;
+    if (*reference == '?' || (*reference >= '0' && *reference <= '9')) {
+        *name_length = 1;
+        return 1;
+    }
+
+    size_t length = 0;
+    while (reference[length] == '_' ||
+           (reference[length] >= 'a' && reference[length] <= 'z') ||
+           (reference[length] >= 'A' && reference[length] <= 'Z') ||
+           (reference[length] >= '0' && reference[length] <= '9')) {
+        length++;
+    }
+    *name_length = length;
+    return length;
+}
+
+/*
+ * replaces the variable references in a word with their values, in memory
+ * from the arena. A word without references is returned as it is
+ */
+static char *expand_word(parse_arena_t *arena, char *word,
+                         variable_lookup_t lookup) {
+    if (word == NULL || strchr(word, VARIABLE_MARK) == NULL) {
+        return word;
+    }
+
+    // The first pass measures the expanded word and the second fills it in
+    size_t length = 0;
+    char *expanded = NULL;
+    for (int pass = 0; pass < 2; pass++) {
+        size_t offset = 0;
+        for (const char *cursor = word; *cursor != '\0';) {
+            if (*cursor != VARIABLE_MARK) {
+                if (expanded != NULL) {
+                    expanded[offset] = *cursor;
+                }
+                offset++;
+                cursor++;
+                continue;
+            }
+
+            const char *name;
+            size_t name_length;
+            cursor += 1 + variable_name(cursor + 1, &name, &name_length);
+            const char *value = lookup(name, name_length);
+            if (value != NULL) {
+                size_t value_length = strlen(value);
+                if (expanded != NULL) {
+                    memcpy(expanded + offset, value, value_length);
+                }
+                offset += value_length;
+            }
+        }
+
+        if (expanded != NULL) {
+            expanded[offset] = '\0';
+        } else {
+            length = offset;
+            expanded = (char *)arena_alloc(arena, length + 1);
+        }
+    }
+
+    return expanded;
+}
+
+/*
+ * copies the pipeline of command into expanded, allocating the copy from the
+ * arena. Words holding variable references are replaced by their values,
+ * looked up with lookup, and the other words are shared with command
+ */
+void expand_command(parse_arena_t *arena, const command_t *command,
+                    command_t *expanded, variable_lookup_t lookup) {
+    const command_t *source = command;
+    command_t *target = expanded;
+
+    while (1) {
+        *target = *source;
+        target->argv_capacity = source->argc + 1;
+        target->argv = (char **)arena_alloc(
+            arena, sizeof(char *) * (size_t)target->argv_capacity);
+        for (int i = 0; i <= source->argc; i++) {
+            target->argv[i] = expand_word(arena, source->argv[i], lookup);
+        }
+        target->redirect[INPUT_REDIRECTION_FILE] = expand_word(
+            arena, source->redirect[INPUT_REDIRECTION_FILE], lookup);
+        target->redirect[OUTPUT_REDIRECTION_FILE] = expand_word(
+            arena, source->redirect[OUTPUT_REDIRECTION_FILE], lookup);
+
+        if (source->next_stage == NULL) {
+            break;
+        }
+        target->next_stage = (command_t *)arena_alloc(arena, sizeof(command_t));
+        source = source->next_stage;
+        target = target->next_stage;
+    }
+}
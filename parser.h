@@ -0,0 +1,104 @@
+#ifndef PARSER_H_
+#define PARSER_H_
+
+#include <stddef.h>
+
+#define INPUT_REDIRECTION 0
+#define INPUT_REDIRECTION_FILE 1
+#define OUTPUT_REDIRECTION 2
+#define OUTPUT_REDIRECTION_FILE 3
+
+// The $ of a variable reference is replaced by this byte in a parsed word,
+// until expand_command replaces the reference with the variable's value
+#define VARIABLE_MARK '\001'
+
+// How a pipeline of a list is joined to the one before it: it runs after
+// that one whatever its exit status was, only if it succeeded, or only if it
+// failed
+#define CONNECT_SEQUENCE 0
+#define CONNECT_AND 1
+#define CONNECT_OR 2
+
+typedef struct parse_arena parse_arena_t;
+
+/*
+ * a single parsed command. argv is null terminated and holds argc words, and
+ * redirect holds the redirection symbols and their files at the indices
+ * above. next_stage is the command that the output of this one is piped
+ * into, or NULL. A line may hold a list of pipelines, and next_command is the
+ * first command of the next pipeline in the list, which is joined to this
+ * one by its connector. background, expand, which is set if any word of the
+ * pipeline refers to a variable, connector and next_command are only set on
+ * the first command of a pipeline. Everything a command points to lives in
+ * the arena it was parsed into
+ */
+typedef struct command {
+    char **argv;
+    int argc;
+    int argv_capacity;
+    char *redirect[4];
+    int background;
+    int expand;
+    struct command *next_stage;
+    int connector;
+    struct command *next_command;
+} command_t;
+
+/*
+ * looks up the value of the variable whose name is the length bytes at name,
+ * returns NULL if it is not set
+ */
+typedef const char *(*variable_lookup_t)(const char *name, size_t length);
+
+/* initializes an arena for parsed commands, returns pointer */
+parse_arena_t *init_parse_arena();
+/*
+ * initializes an arena that starts with, and grows by, blocks of block_size
+ * bytes, or larger ones for larger allocations, for arenas that only ever
+ * hold a small command, returns pointer
+ */
+parse_arena_t *init_parse_arena_sized(size_t block_size);
+/*
+ * cleans up the arena
+ * Note: this function will free the arena pointer, and with it every command
+ * parsed into it. DO NOT use either after this function is called
+ */
+void cleanup_parse_arena(parse_arena_t *arena);
+/*
+ * releases every command parsed into the arena, keeping its memory for the
+ * next command, so that parsing allocates nothing once the arena has grown
+ */
+void reset_parse_arena(parse_arena_t *arena);
+/*
+ * allocates size bytes from the arena, which stay valid until the arena is
+ * reset or cleaned up, returns pointer
+ */
+void *arena_alloc(parse_arena_t *arena, size_t size);
+
+/*
+ * parses one line of input into command, in a single pass over its bytes.
+ * Words are separated by spaces and tabs, and by the operators <, > , >>,
+ * |, &, ;, && and ||. Each | starts the next command of a pipeline, and each
+ * &, ;, && or || the next pipeline of a list. Single quotes,
+ * double quotes and backslashes make the characters they cover part of a
+ * word. A $ followed by a name, by {name}, by ? or by a digit, outside single
+ * quotes, is a variable reference, which is left marked in the word for
+ * expand_command. Syntax errors are printed to standard error.
+ * returns 1 if a command was parsed, 0 if the line was empty,
+ * -1 on a syntax error
+ */
+int parse_command(parse_arena_t *arena, const char *line, size_t length,
+                  command_t *command);
+
+/*
+ * copies command, with every stage of its pipeline, into expanded, which is
+ * allocated from the arena, so that the copy can be changed and run without
+ * touching command. The pipelines that follow it in its list are not copied.
+ * Each variable reference in a word or redirect file is replaced by the
+ * variable's value from lookup, or removed if it is not set. Values are
+ * never split into several words
+ */
+void expand_command(parse_arena_t *arena, const command_t *command,
+                    command_t *expanded, variable_lookup_t lookup);
+
+#endif  // PARSER_H_
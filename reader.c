@@ -0,0 +1,151 @@
+#include "./reader.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INITIAL_READER_SIZE 65536
+
+// buffer holds the bytes read from fd, of which those from start to end have
+// not been handed out yet. scanned is how far past start has already been
+// searched for a newline, so that a partial line is never searched twice.
+// wait_readable, if set, is called with wait_context before each read
+struct line_reader {
+    int fd;
+    int (*wait_readable)(int fd, void *context);
+    void *wait_context;
+    char *buffer;
+    size_t size;
+    size_t start;
+    size_t end;
+    size_t scanned;
+    int at_eof;
+};
+
+/* initializes a line reader over a file descriptor, returns pointer */
+line_reader_t *init_line_reader(int fd) {
+    line_reader_t *reader = (line_reader_t *)malloc(sizeof(line_reader_t));
+    reader->fd = fd;
+    reader->wait_readable = NULL;
+    reader->wait_context = NULL;
+    reader->buffer = (char *)malloc(INITIAL_READER_SIZE);
+    reader->size = INITIAL_READER_SIZE;
+    reader->start = 0;
+    reader->end = 0;
+    reader->scanned = 0;
+    reader->at_eof = 0;
+    return reader;
+}
+
+/*
+ * cleans up the line reader
+ * Note: this function will free the line_reader pointer, but does not close
+ * the file descriptor. DO NOT use the pointer after this function is called
+ */
+void cleanup_line_reader(line_reader_t *reader) {
+    if (reader == NULL) {
+        return;
+    }
+
+    free(reader->buffer);
+    free(reader);
+}
+
+/*
+ * sets a function that read_line calls, with the given context, before every
+ * read call it makes on the reader's file descriptor
+ */
+void set_line_reader_wait(line_reader_t *reader,
+                          int (*wait_readable)(int fd, void *context),
+                          void *context) {
+    if (reader == NULL) {
+        return;
+    }
+
+    reader->wait_readable = wait_readable;
+    reader->wait_context = context;
+}
+
+/*
+ * makes room for a large read after the unconsumed bytes, first by moving
+ * them to the front of the buffer and then, if a partial line still fills
+ * half of it, by doubling the buffer
+ */
+static void make_room(line_reader_t *reader) {
+    size_t pending = reader->end - reader->start;
+
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, pending);
+        reader->end = pending;
+        reader->start = 0;
+    }
+
+    if (pending >= reader->size / 2) {
+        reader->size *= 2;
+        reader->buffer = (char *)realloc(reader->buffer, reader->size);
+    }
+}
+
+/*
+ * reads the next line, without its newline, into the reader's buffer.
+ * returns 1 if a line was read, 0 at end of input, -1 on failure
+ */
+int read_line(line_reader_t *reader, char **line, size_t *length) {
+    while (1) {
+        // Searching only the bytes that have not been searched before
+        char *newline = memchr(reader->buffer + reader->start + reader->scanned,
+                               '\n', reader->end - reader->start -
+                                         reader->scanned);
+
+        if (newline != NULL) {
+            *newline = '\0';
+            *line = reader->buffer + reader->start;
+            *length = (size_t)(newline - *line);
+            reader->start += *length + 1;
+            reader->scanned = 0;
+            return 1;
+        }
+        reader->scanned = reader->end - reader->start;
+
+        // A final line without a newline is handed out once input has ended
+        if (reader->at_eof) {
+            if (reader->start == reader->end) {
+                return 0;
+            }
+            *line = reader->buffer + reader->start;
+            *length = reader->end - reader->start;
+            (*line)[*length] = '\0';
+            reader->start = reader->end;
+            reader->scanned = 0;
+            return 1;
+        }
+
+        // Otherwise as much as fits is read in with a single read call. One
+        // byte is always kept free for the null terminator of a last line
+        if (reader->start == reader->end) {
+            reader->start = 0;
+            reader->end = 0;
+        } else if (reader->size - reader->end < reader->size / 2) {
+            make_room(reader);
+        }
+
+        if (reader->wait_readable != NULL &&
+            reader->wait_readable(reader->fd, reader->wait_context) == -1) {
+            return -1;
+        }
+
+        ssize_t bytes_read = read(reader->fd, reader->buffer + reader->end,
+                                  reader->size - reader->end - 1);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        if (bytes_read == 0) {
+            reader->at_eof = 1;
+        }
+        reader->end += (size_t)bytes_read;
+    }
+}
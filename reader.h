@@ -0,0 +1,34 @@
+#ifndef READER_H_
+#define READER_H_
+
+#include <stddef.h>
+
+typedef struct line_reader line_reader_t;
+
+/* initializes a line reader over a file descriptor, returns pointer */
+line_reader_t *init_line_reader(int fd);
+/*
+ * cleans up the line reader
+ * Note: this function will free the line_reader pointer, but does not close
+ * the file descriptor. DO NOT use the pointer after this function is called
+ */
+void cleanup_line_reader(line_reader_t *reader);
+
+/*
+ * sets a function that read_line calls, with the given context, before every
+ * read call it makes on the reader's file descriptor. It should return once
+ * the descriptor is readable, and return -1 on failure
+ */
+void set_line_reader_wait(line_reader_t *reader,
+                          int (*wait_readable)(int fd, void *context),
+                          void *context);
+
+/*
+ * reads the next line, without its newline, into the reader's buffer.
+ * *line is set to the null terminated line and *length to its length.
+ * The line stays valid until the next call on the same reader.
+ * returns 1 if a line was read, 0 at end of input, -1 on failure
+ */
+int read_line(line_reader_t *reader, char **line, size_t *length);
+
+#endif  // READER_H_
@@ -0,0 +1,327 @@
+#include "./remove.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAX_THREADS 16
+#define DENTS_BUFFER_SIZE 65536
+#define BATCH_SIZE 32768
+
+// A directory that is being emptied. fd stays open while anything below it
+// is still being removed, since every entry is removed relative to it.
+// pending counts the work still to be done in it: its own scan, each batch of
+// its files and each of its subdirectories. When it drops to 0 the directory
+// is empty, and is removed from its parent, whose pending count drops in turn.
+// failed is set if anything below it could not be removed, in which case the
+// directory itself is left alone rather than reported as not empty. path is
+// the full path, for error messages, and name is its last component
+struct remove_dir {
+    struct remove_dir *parent;
+    int parent_fd;
+    int fd;
+    int pending;
+    int failed;
+    char *path;
+    const char *name;
+};
+typedef struct remove_dir remove_dir_t;
+
+// A unit of work for the pool: either the scan of a directory, or, if names
+// is not NULL, the removal of a batch of the files in it. names holds
+// names_length bytes of null terminated names
+struct remove_task {
+    struct remove_task *next;
+    remove_dir_t *dir;
+    char *names;
+    size_t names_length;
+};
+typedef struct remove_task remove_task_t;
+
+// tasks is a stack, so that the pool works through the tree depth first and
+// keeps few directories open at once
+// outstanding counts the tasks that are queued or running, and the workers
+// leave once it drops to 0
+// failed is set once anything could not be removed
+struct remove_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    remove_task_t *tasks;
+    int outstanding;
+    int failed;
+};
+typedef struct remove_pool remove_pool_t;
+
+/* prints an error for an entry of a directory, with errno's message */
+static void print_error(const remove_dir_t *dir, const char *name) {
+    int error = errno;
+    if (dir == NULL) {
+        fprintf(stderr, "rm: %s: %s\n", name, strerror(error));
+    } else {
+        fprintf(stderr, "rm: %s/%s: %s\n", dir->path, name, strerror(error));
+    }
+}
+
+/* queues a task for the workers */
+static void push_task(remove_pool_t *pool, remove_dir_t *dir, char *names,
+                      size_t names_length) {
+    remove_task_t *task = (remove_task_t *)malloc(sizeof(remove_task_t));
+    task->dir = dir;
+    task->names = names;
+    task->names_length = names_length;
+
+    pthread_mutex_lock(&pool->lock);
+    task->next = pool->tasks;
+    pool->tasks = task;
+    pool->outstanding++;
+    pthread_cond_signal(&pool->ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* creates a directory to be emptied below parent, or at the top of a tree if
+    parent is NULL */
+static remove_dir_t *new_dir(remove_dir_t *parent, const char *name) {
+    remove_dir_t *dir = (remove_dir_t *)malloc(sizeof(remove_dir_t));
+    dir->parent = parent;
+    dir->parent_fd = parent == NULL ? AT_FDCWD : parent->fd;
+    dir->fd = -1;
+    dir->pending = 1;
+    dir->failed = 0;
+
+    if (parent == NULL) {
+        dir->path = strdup(name);
+        dir->name = dir->path;
+    } else {
+        size_t parent_length = strlen(parent->path);
+        dir->path = (char *)malloc(parent_length + strlen(name) + 2);
+        memcpy(dir->path, parent->path, parent_length);
+        dir->path[parent_length] = '/';
+        strcpy(dir->path + parent_length + 1, name);
+        dir->name = dir->path + parent_length + 1;
+    }
+    return dir;
+}
+
+/*
+ * marks one piece of work in a directory as done. Once nothing is left, the
+ * directory is removed and freed, and its parent is released in turn
+ */
+static void release_dir(remove_pool_t *pool, remove_dir_t *dir) {
+    while (dir != NULL && __atomic_sub_fetch(&dir->pending, 1,
+                                             __ATOMIC_ACQ_REL) == 0) {
+        remove_dir_t *parent = dir->parent;
+
+        if (dir->fd != -1) {
+            close(dir->fd);
+        }
+        if (!__atomic_load_n(&dir->failed, __ATOMIC_ACQUIRE) &&
+            unlinkat(dir->parent_fd, dir->name, AT_REMOVEDIR) == -1) {
+            print_error(dir->parent, dir->name);
+            __atomic_store_n(&dir->failed, 1, __ATOMIC_RELEASE);
+        }
+        if (__atomic_load_n(&dir->failed, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&pool->failed, 1, __ATOMIC_RELEASE);
+            if (parent != NULL) {
+                __atomic_store_n(&parent->failed, 1, __ATOMIC_RELEASE);
+            }
+        }
+
+        free(dir->path);
+        free(dir);
+        dir = parent;
+    }
+}
+
+/* removes a batch of files from a directory */
+static void remove_batch(remove_dir_t *dir, const char *names,
+                         size_t names_length) {
+    const char *name = names;
+    while (name < names + names_length) {
+        if (unlinkat(dir->fd, name, 0) == -1 && errno != ENOENT) {
+            print_error(dir, name);
+            __atomic_store_n(&dir->failed, 1, __ATOMIC_RELEASE);
+        }
+        name += strlen(name) + 1;
+    }
+}
+
+/*
+ * reads the entries of a directory with getdents64. Each subdirectory is
+ * queued to be scanned in turn, and the other entries are collected into
+ * batches that are queued to be removed, apart from the last one, which is
+ * removed straight away
+ */
+static void scan_dir(remove_pool_t *pool, remove_dir_t *dir) {
+    char buffer[DENTS_BUFFER_SIZE];
+    char *names = (char *)malloc(BATCH_SIZE);
+    size_t names_length = 0;
+    ssize_t length;
+
+    dir->fd = openat(dir->parent_fd, dir->name,
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dir->fd == -1) {
+        print_error(dir->parent, dir->name);
+        __atomic_store_n(&dir->failed, 1, __ATOMIC_RELEASE);
+        free(names);
+        return;
+    }
+
+    while ((length = getdents64(dir->fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            struct dirent64 *entry =
+                (struct dirent64 *)(void *)(buffer + offset);
+            offset += entry->d_reclen;
+
+            const char *name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+
+            // Some filesystems do not fill in the type of an entry
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat entry_stat;
+                if (fstatat(dir->fd, name, &entry_stat,
+                            AT_SYMLINK_NOFOLLOW) == 0 &&
+                    S_ISDIR(entry_stat.st_mode)) {
+                    type = DT_DIR;
+                }
+            }
+
+            if (type == DT_DIR) {
+                __atomic_add_fetch(&dir->pending, 1, __ATOMIC_ACQ_REL);
+                push_task(pool, new_dir(dir, name), NULL, 0);
+                continue;
+            }
+
+            size_t name_length = strlen(name) + 1;
+            if (names_length + name_length > BATCH_SIZE) {
+                __atomic_add_fetch(&dir->pending, 1, __ATOMIC_ACQ_REL);
+                push_task(pool, dir, names, names_length);
+                names = (char *)malloc(BATCH_SIZE);
+                names_length = 0;
+            }
+            memcpy(names + names_length, name, name_length);
+            names_length += name_length;
+        }
+    }
+    if (length == -1) {
+        print_error(dir->parent, dir->name);
+        __atomic_store_n(&dir->failed, 1, __ATOMIC_RELEASE);
+    }
+
+    remove_batch(dir, names, names_length);
+    free(names);
+}
+
+/* takes tasks off the pool's stack until there is no work left */
+static void *run_worker(void *argument) {
+    remove_pool_t *pool = (remove_pool_t *)argument;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->tasks == NULL && pool->outstanding > 0) {
+            pthread_cond_wait(&pool->ready, &pool->lock);
+        }
+        if (pool->tasks == NULL) {
+            break;
+        }
+
+        remove_task_t *task = pool->tasks;
+        pool->tasks = task->next;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (task->names == NULL) {
+            scan_dir(pool, task->dir);
+        } else {
+            remove_batch(task->dir, task->names, task->names_length);
+            free(task->names);
+        }
+        release_dir(pool, task->dir);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->outstanding == 0) {
+            pthread_cond_broadcast(&pool->ready);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/*
+ * removes a directory and everything in it, with the calling thread and
+ * threads - 1 others working through the tree.
+ * returns 0 on success, -1 on failure
+ */
+static int remove_tree(const char *path, int threads) {
+    remove_pool_t pool;
+    pthread_t workers[MAX_THREADS];
+    int started = 0;
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.ready, NULL);
+    pool.tasks = NULL;
+    pool.outstanding = 0;
+    pool.failed = 0;
+
+    push_task(&pool, new_dir(NULL, path), NULL, 0);
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, run_worker, &pool) == 0) {
+            started++;
+        }
+    }
+    run_worker(&pool);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool.ready);
+    pthread_mutex_destroy(&pool.lock);
+    return pool.failed ? -1 : 0;
+}
+
+/*
+ * rm command, removes each of the files in paths, and with recursive set
+ * each directory along with everything in it.
+ * returns 0 on success, -1 if anything could not be removed
+ */
+int remove_paths(char *paths[], int recursive, int threads) {
+    int result = 0;
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    for (int i = 0; paths[i] != NULL; i++) {
+        // A directory is only entered in recursive mode, and a symbolic link
+        // to one is removed like a file
+        struct stat path_stat;
+        if (recursive && lstat(paths[i], &path_stat) == 0 &&
+            S_ISDIR(path_stat.st_mode)) {
+            if (remove_tree(paths[i], threads) == -1) {
+                result = -1;
+            }
+            continue;
+        }
+
+        if (unlink(paths[i]) == -1) {
+            print_error(NULL, paths[i]);
+            result = -1;
+        }
+    }
+
+    return result;
+}
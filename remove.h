@@ -0,0 +1,16 @@
+#ifndef REMOVE_H_
+#define REMOVE_H_
+
+/*
+ * rm command, removes each of the files in the null terminated paths array.
+ * With recursive set, a directory is removed along with everything in it:
+ * the tree is walked with openat and getdents64 relative to the descriptor
+ * of each directory, and the entries are removed with unlinkat by a pool of
+ * up to threads worker threads, which is sized to the number of CPUs if
+ * threads is 0. Errors are printed to standard error, and a path that cannot
+ * be removed does not stop the others.
+ * returns 0 on success, -1 if anything could not be removed
+ */
+int remove_paths(char *paths[], int recursive, int threads);
+
+#endif  // REMOVE_H_
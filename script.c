@@ -0,0 +1,645 @@
+#include "./script.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef enum { NODE_COMMAND, NODE_IF, NODE_WHILE, NODE_FOR } node_type_t;
+
+// A node of the script's tree. command is the command a NODE_COMMAND runs,
+// the condition of an if or while, or, for a for loop, the variable's name
+// followed by the words it takes. body is the then branch or the body of a
+// loop, and else_body the else branch, which is a single NODE_IF for an elif.
+// next is the node that follows this one in its block
+struct script_node {
+    node_type_t type;
+    command_t command;
+    struct script_node *body;
+    struct script_node *else_body;
+    struct script_node *next;
+};
+typedef struct script_node script_node_t;
+
+// arena holds the tree, which is never changed once it has been parsed
+// scratch holds the expanded words of a for loop while they are copied
+struct script {
+    parse_arena_t *arena;
+    parse_arena_t *scratch;
+    script_node_t *nodes;
+};
+
+// cursor and end delimit the text that has not been parsed yet, and line is
+// the last line that was parsed, with line_number its number. A line is
+// handed out one part at a time, split at each ; or &, so that keywords can
+// share a line, as in "if <command>; then". command is the part handed out
+// last, and pending is the first pipeline of the next part, or NULL
+typedef struct script_parser {
+    parse_arena_t *arena;
+    const char *cursor;
+    const char *end;
+    int line_number;
+    command_t line;
+    command_t command;
+    command_t *pending;
+} script_parser_t;
+
+struct variable {
+    char *name;
+    char *value;
+    struct variable *next;
+};
+typedef struct variable variable_t;
+
+// The shell variables, set by for loops and by the arguments of a script
+static variable_t *variables = NULL;
+static int last_status = 0;
+
+static const char *const keywords[] = {"if", "then", "elif", "else", "fi",
+                                       "while", "for", "do", "done", NULL};
+
+static script_node_t *parse_block(script_parser_t *parser,
+                                  const char *const ends[],
+                                  const char **found);
+static int run_nodes(script_t *script, script_node_t *node, int last,
+                     script_runner_t run, void *context);
+
+/* returns the keyword that command starts with, or NULL if there is none */
+static const char *find_keyword(const command_t *command) {
+    if (command->argc == 0) {
+        return NULL;
+    }
+    for (int i = 0; keywords[i] != NULL; i++) {
+        if (strcmp(command->argv[0], keywords[i]) == 0) {
+            return keywords[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * sets the parser's command to the next part of a line, which runs up to the
+ * next pipeline of the line that is not joined to it by && or ||. A then, do
+ * or else may be followed by a command, as in "then echo yes", in which case
+ * the keyword is handed out on its own, and the command after it is next
+ */
+static void next_part(script_parser_t *parser, command_t *part) {
+    if (part->argc > 1 && (strcmp(part->argv[0], "then") == 0 ||
+                           strcmp(part->argv[0], "do") == 0 ||
+                           strcmp(part->argv[0], "else") == 0)) {
+        command_t *rest =
+            (command_t *)arena_alloc(parser->arena, sizeof(command_t));
+        *rest = *part;
+        rest->argv++;
+        rest->argc--;
+        rest->argv_capacity--;
+
+        char **argv = (char **)arena_alloc(parser->arena, 2 * sizeof(char *));
+        argv[0] = part->argv[0];
+        argv[1] = NULL;
+        parser->command = *part;
+        parser->command.argv = argv;
+        parser->command.argc = 1;
+        parser->command.argv_capacity = 2;
+        parser->command.background = 0;
+        parser->command.next_stage = NULL;
+        parser->command.next_command = NULL;
+        memset(parser->command.redirect, 0, sizeof(parser->command.redirect));
+        parser->pending = rest;
+        return;
+    }
+
+    command_t *last = part;
+    while (last->next_command != NULL &&
+           last->next_command->connector != CONNECT_SEQUENCE) {
+        last = last->next_command;
+    }
+
+    parser->pending = last->next_command;
+    last->next_command = NULL;
+    parser->command = *part;
+}
+
+/*
+ * parses the next part of a line that holds a command into the parser's
+ * command, skipping empty lines and comments.
+ * returns 1 if a line was parsed, 0 at end of input, -1 on a syntax error
+ */
+static int next_line(script_parser_t *parser) {
+    if (parser->pending != NULL) {
+        next_part(parser, parser->pending);
+        return 1;
+    }
+
+    while (parser->cursor < parser->end) {
+        const char *line = parser->cursor;
+        const char *newline =
+            memchr(line, '\n', (size_t)(parser->end - line));
+        const char *line_end = newline == NULL ? parser->end : newline;
+        parser->cursor = newline == NULL ? parser->end : newline + 1;
+        parser->line_number++;
+
+        const char *first = line;
+        while (first < line_end && (*first == ' ' || *first == '\t')) {
+            first++;
+        }
+        if (first < line_end && *first == '#') {
+            continue;
+        }
+
+        int result = parse_command(parser->arena, line,
+                                   (size_t)(line_end - line), &parser->line);
+        if (result == -1) {
+            fprintf(stderr, "syntax error on line %d\n", parser->line_number);
+            return -1;
+        }
+        if (result == 1) {
+            next_part(parser, &parser->line);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * parses the next line, which must hold nothing but the keyword, returns 0
+ * on success, -1 on a syntax error
+ */
+static int expect_keyword(script_parser_t *parser, const char *keyword) {
+    int result = next_line(parser);
+    if (result == -1) {
+        return -1;
+    }
+    if (result == 0 || parser->command.argc != 1 ||
+        parser->command.next_stage != NULL ||
+        parser->command.next_command != NULL ||
+        strcmp(parser->command.argv[0], keyword) != 0) {
+        fprintf(stderr, "syntax error on line %d: expected %s\n",
+                parser->line_number, keyword);
+        return -1;
+    }
+    return 0;
+}
+
+/* allocates a node from the parser's arena, holding command */
+static script_node_t *new_node(script_parser_t *parser, node_type_t type,
+                               const command_t *command) {
+    script_node_t *node =
+        (script_node_t *)arena_alloc(parser->arena, sizeof(script_node_t));
+    node->type = type;
+    node->command = *command;
+    node->body = NULL;
+    node->else_body = NULL;
+    node->next = NULL;
+    return node;
+}
+
+/*
+ * takes the keyword off the front of the parser's command, and checks that
+ * a command is left, returns 0 on success, -1 on a syntax error
+ */
+static int strip_keyword(script_parser_t *parser, const char *keyword) {
+    command_t *command = &parser->command;
+    command->argv++;
+    command->argc--;
+    command->argv_capacity--;
+    if (command->argc == 0) {
+        fprintf(stderr, "syntax error on line %d: no command after %s\n",
+                parser->line_number, keyword);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * parses an if, or an elif, whose line is the parser's command, along with
+ * its branches up to and including the fi that ends it, returns pointer, or
+ * NULL on a syntax error
+ */
+static script_node_t *parse_if(script_parser_t *parser) {
+    static const char *const then_ends[] = {"elif", "else", "fi", NULL};
+    static const char *const else_ends[] = {"fi", NULL};
+    const char *found = NULL;
+
+    if (strip_keyword(parser, parser->command.argv[0]) == -1) {
+        return NULL;
+    }
+    script_node_t *node = new_node(parser, NODE_IF, &parser->command);
+
+    if (expect_keyword(parser, "then") == -1 ||
+        ((node->body = parse_block(parser, then_ends, &found)) == NULL &&
+         found == NULL)) {
+        return NULL;
+    }
+
+    // An elif is an if of its own in the else branch, and shares the fi
+    if (strcmp(found, "elif") == 0) {
+        if ((node->else_body = parse_if(parser)) == NULL) {
+            return NULL;
+        }
+    } else if (strcmp(found, "else") == 0) {
+        if ((node->else_body = parse_block(parser, else_ends, &found)) ==
+                NULL &&
+            found == NULL) {
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+/*
+ * parses a while or for loop, whose line is the parser's command, along with
+ * its body up to and including the done that ends it, returns pointer, or
+ * NULL on a syntax error
+ */
+static script_node_t *parse_loop(script_parser_t *parser, node_type_t type) {
+    static const char *const body_ends[] = {"done", NULL};
+    command_t *command = &parser->command;
+    const char *found = NULL;
+
+    if (type == NODE_FOR) {
+        // The line must read "for <name> in <word> ...", with no redirects
+        const char *name = command->argc > 1 ? command->argv[1] : "";
+        size_t name_length = strspn(name,
+                                    "abcdefghijklmnopqrstuvwxyz"
+                                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+        if (command->argc < 3 || strcmp(command->argv[2], "in") != 0 ||
+            name_length == 0 || name[name_length] != '\0' ||
+            (name[0] >= '0' && name[0] <= '9') ||
+            command->next_stage != NULL || command->next_command != NULL ||
+            command->background ||
+            command->redirect[INPUT_REDIRECTION] != NULL ||
+            command->redirect[OUTPUT_REDIRECTION] != NULL) {
+            fprintf(stderr, "syntax error on line %d: for <name> in <word> "
+                    "...\n", parser->line_number);
+            return NULL;
+        }
+
+        // The command keeps the name in argv[0], followed by the words
+        command->argv[2] = command->argv[1];
+        command->argv += 2;
+        command->argc -= 2;
+        command->argv_capacity -= 2;
+    } else if (strip_keyword(parser, "while") == -1) {
+        return NULL;
+    }
+
+    script_node_t *node = new_node(parser, type, command);
+    if (expect_keyword(parser, "do") == -1 ||
+        ((node->body = parse_block(parser, body_ends, &found)) == NULL &&
+         found == NULL)) {
+        return NULL;
+    }
+    return node;
+}
+
+/*
+ * parses lines into a list of nodes until a line holding one of the keywords
+ * in ends, which is NULL terminated, and sets *found to that keyword. At the
+ * top level ends is empty, and the block runs to the end of input.
+ * returns the list, which is NULL if it is empty, or NULL with *found left
+ * NULL on a syntax error
+ */
+static script_node_t *parse_block(script_parser_t *parser,
+                                  const char *const ends[],
+                                  const char **found) {
+    script_node_t *head = NULL;
+    script_node_t **tail = &head;
+    int result;
+
+    *found = NULL;
+    while ((result = next_line(parser)) == 1) {
+        const char *keyword = find_keyword(&parser->command);
+        script_node_t *node = NULL;
+
+        for (int i = 0; keyword != NULL && ends[i] != NULL; i++) {
+            if (strcmp(keyword, ends[i]) == 0) {
+                // Only elif takes a command after it
+                if ((parser->command.argc != 1 ||
+                     parser->command.next_stage != NULL ||
+                     parser->command.next_command != NULL) &&
+                    strcmp(keyword, "elif") != 0) {
+                    fprintf(stderr, "syntax error on line %d: unexpected "
+                            "command after %s\n", parser->line_number,
+                            keyword);
+                    return NULL;
+                }
+                *found = ends[i];
+                return head;
+            }
+        }
+
+        if (keyword == NULL) {
+            node = new_node(parser, NODE_COMMAND, &parser->command);
+        } else if (strcmp(keyword, "if") == 0) {
+            node = parse_if(parser);
+        } else if (strcmp(keyword, "while") == 0) {
+            node = parse_loop(parser, NODE_WHILE);
+        } else if (strcmp(keyword, "for") == 0) {
+            node = parse_loop(parser, NODE_FOR);
+        } else {
+            fprintf(stderr, "syntax error on line %d: unexpected %s\n",
+                    parser->line_number, keyword);
+        }
+
+        if (node == NULL) {
+            return NULL;
+        }
+        *tail = node;
+        tail = &node->next;
+    }
+
+    if (result == 0 && ends[0] != NULL) {
+        int last = 0;
+        while (ends[last + 1] != NULL) {
+            last++;
+        }
+        fprintf(stderr, "syntax error on line %d: expected %s\n",
+                parser->line_number, ends[last]);
+    }
+    if (result == -1 || ends[0] != NULL) {
+        return NULL;
+    }
+
+    // The end of input closes the top level block
+    *found = "";
+    return head;
+}
+
+/*
+ * parses the length bytes of text as a script, returns pointer, or NULL on a
+ * syntax error
+ */
+script_t *parse_script(const char *text, size_t length) {
+    static const char *const top_ends[] = {NULL};
+    script_parser_t parser;
+    const char *found = NULL;
+
+    script_t *script = (script_t *)malloc(sizeof(script_t));
+    script->arena = init_parse_arena();
+    script->scratch = init_parse_arena();
+
+    parser.arena = script->arena;
+    parser.cursor = text;
+    parser.end = text + length;
+    parser.line_number = 0;
+    parser.pending = NULL;
+
+    script->nodes = parse_block(&parser, top_ends, &found);
+    if (found == NULL) {
+        cleanup_script(script);
+        return NULL;
+    }
+    return script;
+}
+
+/*
+ * parses a script read from fd to its end, for files that cannot be mapped,
+ * returns pointer, or NULL on failure
+ */
+static script_t *read_script(int fd, const char *path) {
+    size_t capacity = 65536;
+    size_t length = 0;
+    char *text = (char *)malloc(capacity);
+    ssize_t count;
+
+    while ((count = read(fd, text + length, capacity - length)) != 0) {
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(path);
+            free(text);
+            return NULL;
+        }
+        length += (size_t)count;
+        if (length == capacity) {
+            capacity *= 2;
+            text = (char *)realloc(text, capacity);
+        }
+    }
+
+    script_t *script = parse_script(text, length);
+    free(text);
+    return script;
+}
+
+/*
+ * parses the script in the file at path, which is mapped into memory,
+ * returns pointer, or NULL on failure
+ */
+script_t *parse_script_file(const char *path) {
+    struct stat file_stat;
+    script_t *script = NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1 || fstat(fd, &file_stat) == -1) {
+        perror(path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    // Every word is copied into the script's arena as it is parsed, so the
+    // mapping is only needed while the file is parsed. An empty file cannot
+    // be mapped, and neither can a pipe, which is read to its end instead
+    if (!S_ISREG(file_stat.st_mode)) {
+        script = read_script(fd, path);
+        close(fd);
+        return script;
+    }
+    if (file_stat.st_size == 0) {
+        close(fd);
+        return parse_script("", 0);
+    }
+
+    size_t length = (size_t)file_stat.st_size;
+    void *text = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    madvise(text, length, MADV_SEQUENTIAL);
+    script = parse_script((const char *)text, length);
+    munmap(text, length);
+    return script;
+}
+
+/*
+ * cleans up the script
+ * Note: this function will free the script pointer
+ */
+void cleanup_script(script_t *script) {
+    if (script == NULL) {
+        return;
+    }
+
+    cleanup_parse_arena(script->arena);
+    cleanup_parse_arena(script->scratch);
+    free(script);
+}
+
+/*
+ * runs one command of the script through run, on a copy of the node's
+ * command, returns its exit status
+ */
+static int run_command(const command_t *command, int last,
+                       script_runner_t run, void *context) {
+    command_t copy = *command;
+    int status = run(&copy, last, context);
+    set_last_status(status);
+    return status;
+}
+
+/*
+ * runs a for loop. Its words are expanded once, before the first iteration,
+ * and copied out of the scratch arena, which each command of the body resets.
+ * returns the exit status of the last command run, or 0 if there was none
+ */
+static int run_for(script_t *script, script_node_t *node, script_runner_t run,
+                   void *context) {
+    command_t expanded;
+    int status = 0;
+
+    reset_parse_arena(script->scratch);
+    expand_command(script->scratch, &node->command, &expanded, get_variable);
+
+    size_t length = 0;
+    for (int i = 0; i < expanded.argc; i++) {
+        length += strlen(expanded.argv[i]) + 1;
+    }
+    char *words = (char *)malloc(length);
+    char *cursor = words;
+    for (int i = 0; i < expanded.argc; i++) {
+        size_t word_length = strlen(expanded.argv[i]) + 1;
+        memcpy(cursor, expanded.argv[i], word_length);
+        cursor += word_length;
+    }
+
+    // The first word is the name of the variable
+    const char *name = words;
+    const char *word = words + strlen(words) + 1;
+    for (int i = 1; i < expanded.argc; i++) {
+        set_variable(name, word);
+        status = run_nodes(script, node->body, 0, run, context);
+        word += strlen(word) + 1;
+    }
+
+    free(words);
+    return status;
+}
+
+/*
+ * runs a list of nodes in turn, returns the exit status of the last command
+ * run, or 0 if there was none. last is set if nothing runs after the list,
+ * in which case the final command of its last node is the last command the
+ * script runs, including one at the end of a branch of a final if
+ */
+static int run_nodes(script_t *script, script_node_t *node, int last,
+                     script_runner_t run, void *context) {
+    int status = 0;
+
+    for (; node != NULL; node = node->next) {
+        int last_node = last && node->next == NULL;
+
+        switch (node->type) {
+            case NODE_COMMAND:
+                status = run_command(&node->command, last_node, run, context);
+                break;
+
+            case NODE_IF:
+                status = 0;
+                if (run_command(&node->command, 0, run, context) == 0) {
+                    status =
+                        run_nodes(script, node->body, last_node, run, context);
+                } else if (node->else_body != NULL) {
+                    status = run_nodes(script, node->else_body, last_node, run,
+                                       context);
+                }
+                break;
+
+            case NODE_WHILE:
+                status = 0;
+                while (run_command(&node->command, 0, run, context) == 0) {
+                    status = run_nodes(script, node->body, 0, run, context);
+                }
+                break;
+
+            case NODE_FOR:
+                status = run_for(script, node, run, context);
+                break;
+        }
+    }
+
+    return status;
+}
+
+/*
+ * runs the script, returns the exit status of the last command run, or 0 if
+ * there was none
+ */
+int run_script(script_t *script, script_runner_t run, void *context) {
+    return run_nodes(script, script->nodes, 1, run, context);
+}
+
+/* sets a shell variable, which takes precedence over the environment */
+void set_variable(const char *name, const char *value) {
+    variable_t *variable = variables;
+    while (variable != NULL && strcmp(variable->name, name) != 0) {
+        variable = variable->next;
+    }
+
+    if (variable == NULL) {
+        variable = (variable_t *)malloc(sizeof(variable_t));
+        variable->name = strdup(name);
+        variable->value = NULL;
+        variable->next = variables;
+        variables = variable;
+    }
+
+    free(variable->value);
+    variable->value = strdup(value);
+}
+
+/*
+ * looks up a variable among the shell variables and then the environment,
+ * returns NULL if it is not set
+ */
+const char *get_variable(const char *name, size_t length) {
+    static char status_string[16];
+    char env_name[256];
+
+    if (length == 1 && name[0] == '?') {
+        snprintf(status_string, sizeof(status_string), "%d", last_status);
+        return status_string;
+    }
+
+    for (variable_t *variable = variables; variable != NULL;
+         variable = variable->next) {
+        if (strncmp(variable->name, name, length) == 0 &&
+            variable->name[length] == '\0') {
+            return variable->value;
+        }
+    }
+
+    if (length == 0 || length >= sizeof(env_name)) {
+        return NULL;
+    }
+    memcpy(env_name, name, length);
+    env_name[length] = '\0';
+    return getenv(env_name);
+}
+
+/* records the exit status of the last command */
+void set_last_status(int status) { last_status = status; }
+
+/* returns the exit status of the last command */
+int get_last_status() { return last_status; }
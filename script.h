@@ -0,0 +1,72 @@
+#ifndef SCRIPT_H_
+#define SCRIPT_H_
+
+#include <stddef.h>
+#include "./parser.h"
+
+typedef struct script script_t;
+
+/*
+ * runs one command of a script, which may be a list of pipelines joined by
+ * && and ||, with the given context, and returns its exit status. The
+ * command is a copy that the function may change, but the words and the
+ * pipelines it points to belong to the script, and its variables have not
+ * been expanded. last is set if the command is the last that the script
+ * will run, so that nothing needs to be done once it has finished
+ */
+typedef int (*script_runner_t)(command_t *command, int last, void *context);
+
+/*
+ * parses the length bytes of text as a script, once, into a tree that can be
+ * run any number of times. Each line holds a command, as parse_command reads
+ * it, or one of the following, where each part shown on its own line must be
+ * on a line of its own, or be separated from the next part by a ;:
+ *   if <command>         while <command>       for <name> in <word> ...
+ *   then                 do                    do
+ *   <commands>           <commands>            <commands>
+ *   elif <command>       done                  done
+ *   then
+ *   <commands>
+ *   else
+ *   <commands>
+ *   fi
+ * Lines that start with # are comments. Syntax errors are printed to
+ * standard error, with their line number.
+ * returns pointer, or NULL on a syntax error
+ */
+script_t *parse_script(const char *text, size_t length);
+/*
+ * parses the script in the file at path, which is mapped into memory rather
+ * than read, returns pointer, or NULL if the file cannot be read or holds a
+ * syntax error
+ */
+script_t *parse_script_file(const char *path);
+/*
+ * cleans up the script
+ * Note: this function will free the script pointer. DO NOT use it after this
+ * function is called
+ */
+void cleanup_script(script_t *script);
+
+/*
+ * runs the script, passing each command to run. The condition of an if or
+ * while is true when its exit status is 0, and a for loop sets its variable
+ * to each of its words in turn, which are expanded once, before the loop.
+ * returns the exit status of the last command run, or 0 if there was none
+ */
+int run_script(script_t *script, script_runner_t run, void *context);
+
+/* sets a shell variable, which takes precedence over the environment */
+void set_variable(const char *name, const char *value);
+/*
+ * looks up the variable whose name is the length bytes at name, among the
+ * shell variables and then the environment. The name ? is the exit status
+ * of the last command. returns NULL if it is not set
+ */
+const char *get_variable(const char *name, size_t length);
+/* records the exit status of the last command */
+void set_last_status(int status);
+/* returns the exit status of the last command */
+int get_last_status();
+
+#endif  // SCRIPT_H_
@@ -0,0 +1,489 @@
+#include "./server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// The most bytes of output sent in one frame, which keeps each message well
+// under the socket's buffer size
+#define OUTPUT_CHUNK 32768
+// The most bytes of output kept for a connection that has not been sent yet,
+// which is checked for every connection at least every OUTPUT_CHECK_MS
+#define OUTPUT_LIMIT (1024 * 1024)
+#define OUTPUT_CHECK_MS 1000
+#define MAX_EVENTS 64
+#define LISTEN_BACKLOG 128
+
+// The kinds of descriptor in the server's epoll set
+#define SOURCE_LISTEN 0
+#define SOURCE_CONNECTION 1
+#define SOURCE_WATCH 2
+
+typedef struct connection connection_t;
+
+// An entry of the epoll set, which names the connection a descriptor
+// belongs to
+typedef struct source {
+    int kind;
+    connection_t *connection;
+} source_t;
+
+// A client's connection. output_fd is the memfd that its output is captured
+// in, of which the bytes before sent_offset have been sent, or dropped, as
+// dropped counts, since there were too many waiting. watch_fd is the
+// descriptor its session asked to be watched, and session the value that
+// the open handler returned for it
+struct connection {
+    int socket_fd;
+    int output_fd;
+    off_t sent_offset;
+    unsigned long dropped;
+    int watch_fd;
+    void *session;
+    source_t socket_source;
+    source_t watch_source;
+    struct connection *next;
+};
+
+// The state of the running server: its epoll set, the handlers and their
+// context, /dev/null for the input of requests, and copies of the server's
+// own standard descriptors, which are put back after every request.
+// connections lists every open connection
+typedef struct server {
+    int epoll_fd;
+    connection_t *connections;
+    const server_handlers_t *handlers;
+    void *context;
+    int null_fd;
+    int saved_fds[3];
+    char *line;
+    char *frame;
+} server_t;
+
+typedef union server_control {
+    char buffer[CMSG_SPACE(sizeof(int) * 3)];
+    struct cmsghdr align;
+} server_control_t;
+
+/*
+ * opens the listening socket at path, returns its descriptor, or -1 on
+ * failure
+ */
+static int open_socket(const char *path) {
+    struct sockaddr_un address;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "server: %s: path too long\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    // A socket left behind by an earlier server is replaced
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(fd, LISTEN_BACKLOG) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * moves the given descriptors onto standard input, output and error, after
+ * flushing anything the server has buffered for the old ones
+ */
+static void swap_stdio(int input_fd, int output_fd, int error_fd) {
+    fflush(stdout);
+    fflush(stderr);
+    dup2(input_fd, 0);
+    dup2(output_fd, 1);
+    dup2(error_fd, 2);
+}
+
+/*
+ * closes a connection, once its client has gone or its session asked to be
+ * closed
+ */
+static void close_connection(server_t *server, connection_t *connection) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->socket_fd, NULL);
+    if (connection->watch_fd != -1) {
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->watch_fd,
+                  NULL);
+    }
+
+    // The session's output goes nowhere once its client has gone
+    swap_stdio(server->null_fd, server->null_fd, server->null_fd);
+    server->handlers->close(connection->session, server->context);
+    swap_stdio(server->saved_fds[0], server->saved_fds[1],
+               server->saved_fds[2]);
+
+    connection_t **link = &server->connections;
+    while (*link != connection) {
+        link = &(*link)->next;
+    }
+    *link = connection->next;
+
+    close(connection->socket_fd);
+    close(connection->output_fd);
+    free(connection);
+}
+
+/*
+ * accepts a client, and opens a session for it, returns 0 on success, -1 on
+ * failure
+ */
+static int accept_connection(server_t *server, int listen_fd) {
+    struct epoll_event event;
+
+    int socket_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (socket_fd == -1) {
+        return errno == EINTR || errno == ECONNABORTED ? 0 : -1;
+    }
+
+    int output_fd = memfd_create("33sh-output", MFD_CLOEXEC);
+    if (output_fd == -1) {
+        perror("memfd_create");
+        close(socket_fd);
+        return 0;
+    }
+
+    void *session = server->handlers->open(server->context);
+    if (session == NULL) {
+        close(output_fd);
+        close(socket_fd);
+        return 0;
+    }
+
+    connection_t *connection = (connection_t *)malloc(sizeof(connection_t));
+    connection->socket_fd = socket_fd;
+    connection->output_fd = output_fd;
+    connection->sent_offset = 0;
+    connection->dropped = 0;
+    connection->session = session;
+    connection->socket_source.kind = SOURCE_CONNECTION;
+    connection->socket_source.connection = connection;
+    connection->watch_source.kind = SOURCE_WATCH;
+    connection->watch_source.connection = connection;
+    connection->watch_fd =
+        server->handlers->watch_fd(session, server->context);
+    connection->next = server->connections;
+    server->connections = connection;
+
+    event.events = EPOLLIN;
+    event.data.ptr = &connection->socket_source;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, socket_fd, &event);
+    if (connection->watch_fd != -1) {
+        event.data.ptr = &connection->watch_source;
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, connection->watch_fd,
+                  &event);
+    }
+    return 0;
+}
+
+/*
+ * sends a frame, followed by length bytes of data, returns 0 on success, -1
+ * on failure
+ */
+static int send_frame(server_t *server, connection_t *connection,
+                      const server_frame_t *frame, size_t length) {
+    memcpy(server->frame, frame, sizeof(*frame));
+    ssize_t sent;
+    while ((sent = send(connection->socket_fd, server->frame,
+                        sizeof(*frame) + length, MSG_NOSIGNAL)) == -1 &&
+           errno == EINTR) {
+    }
+    return sent == -1 ? -1 : 0;
+}
+
+/*
+ * marks the output of a connection up to offset as sent, and frees the
+ * memory that held it
+ */
+static void release_output(connection_t *connection, off_t offset) {
+    // The memfd is shared with background jobs that may be writing to it at
+    // any moment, so it is never truncated, which could lose what they write
+    // in the meantime. The bytes that are done with are punched out instead,
+    // which leaves its size and its shared offset alone
+    if (offset > connection->sent_offset) {
+        fallocate(connection->output_fd,
+                  FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  connection->sent_offset, offset - connection->sent_offset);
+        connection->sent_offset = offset;
+    }
+}
+
+/*
+ * drops the oldest output of an idle connection that has not been sent
+ * beyond the last OUTPUT_LIMIT bytes. The output of a request is always sent
+ * whole, since it is sent before the server does anything else
+ */
+static void limit_output(connection_t *connection) {
+    struct stat output_stat;
+    if (fstat(connection->output_fd, &output_stat) == -1) {
+        return;
+    }
+
+    if (output_stat.st_size - connection->sent_offset > OUTPUT_LIMIT) {
+        off_t offset = output_stat.st_size - OUTPUT_LIMIT;
+        connection->dropped +=
+            (unsigned long)(offset - connection->sent_offset);
+        release_output(connection, offset);
+    }
+}
+
+/*
+ * sends everything captured in the connection's memfd since the last reply
+ * in output frames, after a note of any output that was dropped, returns 0
+ * on success, -1 on failure
+ */
+static int send_output(server_t *server, connection_t *connection) {
+    server_frame_t frame;
+    struct stat output_stat;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.type = SERVER_OUTPUT;
+    if (fstat(connection->output_fd, &output_stat) == -1) {
+        return -1;
+    }
+    off_t size = output_stat.st_size;
+
+    if (connection->dropped > 0) {
+        int length = snprintf(server->frame + sizeof(frame), OUTPUT_CHUNK,
+                              "server: %lu bytes of output dropped\n",
+                              connection->dropped);
+        if (send_frame(server, connection, &frame, (size_t)length) == -1) {
+            return -1;
+        }
+        connection->dropped = 0;
+    }
+
+    // Only the bytes written by the time of the fstat are sent, and anything
+    // written after them waits for the next reply
+    off_t offset = connection->sent_offset;
+    while (offset < size) {
+        size_t chunk = size - offset < OUTPUT_CHUNK ? (size_t)(size - offset)
+                                                    : OUTPUT_CHUNK;
+        ssize_t length = pread(connection->output_fd,
+                               server->frame + sizeof(frame), chunk, offset);
+        if (length <= 0) {
+            break;
+        }
+        if (send_frame(server, connection, &frame, (size_t)length) == -1) {
+            return -1;
+        }
+        offset += length;
+    }
+    release_output(connection, offset);
+    return 0;
+}
+
+/*
+ * receives and runs one request on a connection, and sends its reply,
+ * returns 0 on success, -1 if the connection should be closed
+ */
+static int serve_request(server_t *server, connection_t *connection) {
+    server_control_t control;
+    server_result_t result;
+    server_frame_t frame;
+    int fds[3] = {-1, -1, -1};
+    int fd_count = 0;
+
+    struct iovec iov = {server->line, SERVER_LINE_SIZE};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+
+    ssize_t length = recvmsg(connection->socket_fd, &message, MSG_CMSG_CLOEXEC);
+    if (length == -1 && errno == EINTR) {
+        return 0;
+    }
+    if (length <= 0) {
+        return -1;
+    }
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+        fd_count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (size_t)fd_count);
+    }
+
+    // The line runs with the client's descriptors if it sent all three, and
+    // otherwise with its output captured
+    int input_fd = server->null_fd;
+    int output_fd = connection->output_fd;
+    int error_fd = connection->output_fd;
+    if (fd_count == 3) {
+        input_fd = fds[0];
+        output_fd = fds[1];
+        error_fd = fds[2];
+    }
+
+    memset(&result, 0, sizeof(result));
+    int run_result = 0;
+    swap_stdio(input_fd, output_fd, error_fd);
+    if ((message.msg_flags & MSG_TRUNC) || length == SERVER_LINE_SIZE) {
+        fprintf(stderr, "server: line longer than %d bytes\n",
+                SERVER_LINE_SIZE - 1);
+        result.status = 2;
+    } else {
+        server->line[length] = '\0';
+        run_result = server->handlers->run(connection->session, server->line,
+                                           &result, server->context);
+    }
+    swap_stdio(server->saved_fds[0], server->saved_fds[1],
+               server->saved_fds[2]);
+    for (int i = 0; i < fd_count; i++) {
+        close(fds[i]);
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.type = SERVER_STATUS;
+    frame.status = result.status;
+    if (result.has_usage) {
+        frame.real_usec = result.real_usec;
+        frame.user_usec = result.usage.ru_utime.tv_sec * 1000000L +
+                          result.usage.ru_utime.tv_usec;
+        frame.system_usec = result.usage.ru_stime.tv_sec * 1000000L +
+                            result.usage.ru_stime.tv_usec;
+        frame.maxrss_kb = result.usage.ru_maxrss;
+    }
+    if (send_output(server, connection) == -1 ||
+        send_frame(server, connection, &frame, 0) == -1) {
+        return -1;
+    }
+    return run_result;
+}
+
+/*
+ * calls the attend handler of a connection's session, with its output
+ * captured for the next reply, which is held to OUTPUT_LIMIT bytes while the
+ * client is idle
+ */
+static void attend_connection(server_t *server, connection_t *connection) {
+    swap_stdio(server->null_fd, connection->output_fd, connection->output_fd);
+    server->handlers->attend(connection->session, server->context);
+    swap_stdio(server->saved_fds[0], server->saved_fds[1],
+               server->saved_fds[2]);
+    limit_output(connection);
+}
+
+/*
+ * runs a command server on a UNIX domain socket at path, returns -1 on
+ * failure
+ */
+int run_server(const char *path, const server_handlers_t *handlers,
+               void *context) {
+    server_t server;
+    struct epoll_event event;
+    struct epoll_event events[MAX_EVENTS];
+    source_t listen_source = {SOURCE_LISTEN, NULL};
+    struct timespec now;
+    struct timespec last_check;
+
+    int listen_fd = open_socket(path);
+    if (listen_fd == -1) {
+        return -1;
+    }
+
+    server.handlers = handlers;
+    server.context = context;
+    server.connections = NULL;
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    for (int i = 0; i < 3; i++) {
+        server.saved_fds[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+    }
+    if (server.epoll_fd == -1 || server.null_fd == -1 ||
+        server.saved_fds[0] == -1 || server.saved_fds[1] == -1 ||
+        server.saved_fds[2] == -1) {
+        perror("server");
+        close(listen_fd);
+        return -1;
+    }
+    server.line = (char *)malloc(SERVER_LINE_SIZE);
+    server.frame = (char *)malloc(sizeof(server_frame_t) + OUTPUT_CHUNK);
+
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_source;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    clock_gettime(CLOCK_MONOTONIC, &last_check);
+
+    // Each event is handled in turn. A connection closed while handling one
+    // event may still be named by a later one of the same batch, so the
+    // batch is ended early whenever a connection is closed
+    int result = 0;
+    while (result == 0) {
+        int count =
+            epoll_wait(server.epoll_fd, events, MAX_EVENTS, OUTPUT_CHECK_MS);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            result = -1;
+            break;
+        }
+
+        // The output that background jobs write for idle clients is held
+        // to its limit, however busy the other clients keep the server
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - last_check.tv_sec) * 1000 +
+                (now.tv_nsec - last_check.tv_nsec) / 1000000 >=
+            OUTPUT_CHECK_MS) {
+            for (connection_t *connection = server.connections;
+                 connection != NULL; connection = connection->next) {
+                limit_output(connection);
+            }
+            last_check = now;
+        }
+
+        for (int i = 0; i < count; i++) {
+            source_t *source = (source_t *)events[i].data.ptr;
+            if (source->kind == SOURCE_LISTEN) {
+                if (accept_connection(&server, listen_fd) == -1) {
+                    perror("accept");
+                    result = -1;
+                    break;
+                }
+            } else if (source->kind == SOURCE_WATCH) {
+                attend_connection(&server, source->connection);
+            } else if (serve_request(&server, source->connection) == -1) {
+                close_connection(&server, source->connection);
+                break;
+            }
+        }
+    }
+
+    close(listen_fd);
+    unlink(path);
+    close(server.epoll_fd);
+    close(server.null_fd);
+    for (int i = 0; i < 3; i++) {
+        close(server.saved_fds[i]);
+    }
+    free(server.line);
+    free(server.frame);
+    return result;
+}
@@ -0,0 +1,81 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <sys/resource.h>
+#include <sys/types.h>
+
+// The largest command line a client can send in one request
+#define SERVER_LINE_SIZE 65536
+
+// The types of the frames the server sends back for each request: any
+// number of output frames, then a single status frame
+#define SERVER_OUTPUT 1
+#define SERVER_STATUS 2
+
+/*
+ * the header of every frame the server sends. Each frame is one message on
+ * the connection's SOCK_SEQPACKET socket, and an output frame is followed,
+ * in the same message, by the bytes of output it carries. In a status frame,
+ * status is the exit status of the line, as $? reports it, and the times are
+ * those of its last foreground job, or 0 if it ran none
+ */
+typedef struct server_frame {
+    int type;
+    int status;
+    long real_usec;
+    long user_usec;
+    long system_usec;
+    long maxrss_kb;
+} server_frame_t;
+
+/*
+ * the result of a line, filled in by the server's run function. has_usage is
+ * set if the line ran a foreground job, in which case usage holds the
+ * resources it used and real_usec the time it took
+ */
+typedef struct server_result {
+    int status;
+    int has_usage;
+    long real_usec;
+    struct rusage usage;
+} server_result_t;
+
+/*
+ * the functions the server calls for each connection, each passed the
+ * context given to run_server. open is called once a client connects, and
+ * returns the session of the connection, or NULL to refuse it. run runs one
+ * command line in a session and fills in its result, and returns -1 if the
+ * connection should be closed once the result is sent. watch_fd returns a
+ * descriptor that becomes readable when the session needs attention, or -1,
+ * and attend is called whenever it does. close is called once the client
+ * has gone, or run asked for the connection to be closed
+ */
+typedef struct server_handlers {
+    void *(*open)(void *context);
+    int (*run)(void *session, char *line, server_result_t *result,
+               void *context);
+    int (*watch_fd)(void *session, void *context);
+    void (*attend)(void *session, void *context);
+    void (*close)(void *session, void *context);
+} server_handlers_t;
+
+/*
+ * runs a command server on a UNIX domain socket at path, which is replaced
+ * if it already exists, until the server fails. Each request is one message
+ * holding a command line, and its reply is a sequence of frames, as
+ * server_frame_t describes. A client may send its standard input, output
+ * and error with a request, as three descriptors in an SCM_RIGHTS message,
+ * and the line runs with them. Otherwise it runs with /dev/null as its input,
+ * and its output and errors are captured in a memfd that belongs to the
+ * connection and are sent back in output frames. Anything that the
+ * connection's background jobs write to the memfd later is sent with the
+ * reply to the next request, as is anything printed by attend. While the
+ * client is idle, only the last megabyte of that output is kept, and the
+ * reply starts with a note of how much was dropped. Requests are run one at
+ * a time, in the order they arrive.
+ * returns -1 on failure
+ */
+int run_server(const char *path, const server_handlers_t *handlers,
+               void *context);
+
+#endif  // SERVER_H_
@@ -1,79 +1,301 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <poll.h>
 #include <signal.h>
+#include <spawn.h>
+#include <sys/signalfd.h>
+#include "./capture.h"
+#include "./command_hash.h"
+#include "./fileops.h"
 #include "./jobs.h"
-
-#define INPUT_REDIRECTION 0
-#define INPUT_REDIRECTION_FILE 1
-#define OUTPUT_REDIRECTION 2
-#define OUTPUT_REDIRECTION_FILE 3
+#include "./launcher.h"
+#include "./parse_cache.h"
+#include "./parser.h"
+#include "./reader.h"
+#include "./remove.h"
+#include "./script.h"
+#include "./server.h"
+#include "./stats.h"
+#include "./trace.h"
+
+#define LAUNCH_FORK 0
+#define LAUNCH_SPAWN 1
+#define LAUNCH_ZYGOTE 2
+#define PARSE_CACHE_SIZE 256
+#define CAPTURE_SIZE 65536
+#define PARALLEL_MAX_LIMIT 4096
+
+extern char **environ;
 
 // Function Declarations
 
-int parse_input(char *argv[], char *redirect[], int *argc,
-                job_list_t *job_list);
-int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list);
-int run_executable(char *argv[], char *redirect[], int *argc,
-                   job_list_t *job_list);
+int parse_input(command_t *command, job_list_t *job_list);
+int execute_built_in_commmands(char *argv[], int *argc, char *redirect[],
+                               job_list_t *job_list);
+int run_file_builtin(char *argv[], char *redirect[]);
+int run_executable(command_t *command, job_list_t *job_list, int jid,
+                   int priority);
+void free_queued_pipeline(void *data);
+int run_queued_job(job_list_t *job_list, int jid, int background);
+void start_queued_jobs(job_list_t *job_list, int foreground);
+void handle_job_control_signal(int sig);
+void get_blocked_signals(sigset_t *set);
 void ignore_signals();
 void restore_signals();
-void reap_children(job_list_t *job_list);
+int reap_children(job_list_t *job_list);
+int children_changed(job_list_t *job_list);
+void wait_for_foreground_change(job_list_t *job_list, pid_t pgid);
+int reap_background_children(job_list_t *job_list, pid_t pgid);
+int swap_output(int fd, int saved_fds[2]);
+int report_child_status(job_list_t *job_list, pid_t child_pid, int status,
+                        const struct rusage *usage);
+int execute_command(command_t *command, job_list_t *job_list, int last);
+int execute_command_list(command_t *command, job_list_t *job_list, int last);
+int wait_for_input(int fd, void *context);
+int wait_for_children(job_list_t *job_list);
+int run_parallel(char *argv[], job_list_t *job_list);
+int finish_parallel_command(job_list_t *job_list, pid_t child_pid, int status);
+pid_t launch_fork(char *file_path, char *argv[], char *redirect[],
+                  int background, pid_t pgid, int input_fd, int output_fd);
+pid_t launch_spawn(char *file_path, char *argv[], char *redirect[],
+                   int background, pid_t pgid, int input_fd, int output_fd);
+pid_t launch_zygote(char *file_path, char *argv[], char *redirect[],
+                    int background, pid_t pgid, int input_fd, int output_fd);
+int resolve_executable(command_t *stage, char *file_path, size_t size);
+pid_t launch_stage(command_t *stage, char *file_path, size_t size, int hashed,
+                   int background, pid_t pgid, int input_fd, int output_fd);
+int wait_foreground_job(job_list_t *job_list, int jid, int *status,
+                        struct rusage *usage);
+int exit_status(int status);
+int exec_failure_status(int error);
+int run_script_command(command_t *command, int last, void *context);
+int exec_in_place(command_t *command);
+int prepare_exec_in_place(job_list_t *job_list);
+int run_script_mode(int argc, char *argv[], job_list_t *job_list);
+void cleanup_shell(job_list_t *job_list);
+void handle_sigpipe(int sig);
+int run_server_mode(const char *path);
+void *open_server_session(void *context);
+int run_server_line(void *session, char *line, server_result_t *result,
+                    void *context);
+int watch_server_session(void *session, void *context);
+void attend_server_session(void *session, void *context);
+void close_server_session(void *session, void *context);
 int job_id = 1;
 
-// Declaring the buffer to hold the contents of the file that is read in as a
-// global variable, as well as arrays with the arguments and redirection tokens,
-// and an integer representing the number of total
-char buffer[1024] = {0};
-
-int main() {
+// The launch mode selects whether children are started with fork, with
+// posix_spawn, or by the launcher, and can be switched at runtime with the
+// launch builtin. The launcher is only started once it is selected. The
+// interactive flag records whether standard input is a terminal, since the
+// terminal is only handed to foreground jobs when there is one to hand over
+int launch_mode = LAUNCH_FORK;
+launcher_t *launcher = NULL;
+int interactive = 0;
+
+// SIGCHLD is kept blocked in the shell and read from this signalfd instead, so
+// that the shell can wait for input and for children at the same time. A
+// SIGCHLD read from it while waiting for a foreground job, that may have been
+// meant for another job, is recorded in sigchld_consumed, so that the other
+// jobs are still reaped
+int sigchld_fd = -1;
+int sigchld_consumed = 0;
+
+// While capture_output is set, the output of each background job goes to a
+// ring buffer in capture_set instead of the terminal, which is read with the
+// joblog builtin and relayed by fg. The set is created the first time
+// capturing is turned on
+int capture_output = 0;
+capture_set_t *capture_set = NULL;
+
+// With a sched_limit above 0, no more than that many background jobs run at
+// once, and the jobs started beyond it wait in the job list as queued jobs,
+// which are started as running jobs finish. Background jobs started from the
+// shell are given the nice value sched_priority, and queued jobs with lower
+// values start first
+int sched_limit = 0;
+int sched_priority = 0;
+
+// A pipeline waiting in the queue, copied into an arena of its own, since
+// the command it was parsed from only lasts until the next line is parsed
+typedef struct queued_pipeline {
+    parse_arena_t *arena;
+    command_t command;
+} queued_pipeline_t;
+
+// The resources used by the last foreground child, and the time it was
+// launched, are kept for the time builtin
+struct rusage foreground_usage;
+struct timespec foreground_start;
+int foreground_usage_valid = 0;
+
+// While the parallel builtin runs, active_batch describes the commands it has
+// started. Each running command holds one slot, with its PID, JID and command
+// line, and run_executable and report_child_status fill and empty the slots
+typedef struct parallel_batch {
+    int limit;
+    int running;
+    int started;
+    int failed;
+    char *pending_line;
+    pid_t *pids;
+    int *jids;
+    char **lines;
+} parallel_batch_t;
+
+parallel_batch_t *active_batch = NULL;
+
+// The command hash remembers where in PATH each command name was found, so
+// that PATH is only walked the first time a command is run
+command_hash_t *command_hash = NULL;
+
+// Declaring the reader that hands out the lines read from standard input as a
+// global variable, along with the cache that each line is parsed through. A
+// line that was seen recently is found by its hash and is not parsed again,
+// and the cache keeps the parsed forms of the most recent lines, so that
+// batch input that repeats its lines costs little more than a lookup each
+line_reader_t *input_reader = NULL;
+parse_cache_t *parse_cache = NULL;
+
+// Each pipeline of a list is copied into this arena, with its variables
+// expanded, just before it runs, so that $? is that of the pipeline before
+// it and the parsed command is never changed
+parse_arena_t *expand_arena = NULL;
+
+// When the shell runs a script, its tree is kept here so that exit can free it
+script_t *active_script = NULL;
+
+// In server mode, each connection runs in a session of its own, with its own
+// job list, job numbers and $?, which are swapped in while it runs a line.
+// active_session is the session running a line, so that exit can end the
+// connection rather than the server
+typedef struct server_session {
+    job_list_t *job_list;
+    int job_id;
+    int last_status;
+    int closing;
+} server_session_t;
+
+server_session_t *active_session = NULL;
+void swap_server_session(server_session_t *session);
+
+int main(int argc, char *argv[]) {
     int parse_result;
-    int built_in_command_result = 0;
-    int run_executable_result = 0;
+
+    // The launcher is this same executable, started with --launcher and the
+    // descriptor of its socket, and runs nothing else
+    if (argc == 3 && strcmp(argv[1], "--launcher") == 0) {
+        return run_launcher(atoi(argv[2]));
+    }
+
+    // Tracing is started when the environment names a file for the trace
+    init_trace();
+
+    // The counters that shstat prints are kept from the start
+    init_stats();
 
     // Initializing the job list
     job_list_t *job_list = init_job_list();
+    command_hash = init_command_hash();
+    input_reader = init_line_reader(0);
+    parse_cache = init_parse_cache(PARSE_CACHE_SIZE);
+    expand_arena = init_parse_arena();
+
+    // Checking once whether the shell is reading from a terminal. An
+    // interactive shell buffers its output in full, so that the status lines
+    // printed before a prompt go out with the prompt in a single write. The
+    // buffer is also flushed before a job is launched or waited for
+    interactive = isatty(0);
+    if (interactive) {
+        setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+    }
 
-    // This continues the program indefinitely
-    while (1) {
-        // argc is reset to 0 upon every iteration of the program
-        int argc = 0;
+    // Blocking SIGCHLD and opening a signalfd for it, which the input reader
+    // polls alongside standard input so that children are reaped as soon as
+    // they change state, even while the shell is waiting for a command
+    sigset_t sigchld_set;
+    sigemptyset(&sigchld_set);
+    sigaddset(&sigchld_set, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &sigchld_set, NULL) == -1) {
+        perror("sigprocmask");
+    }
+    if ((sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC)) ==
+        -1) {
+        perror("signalfd");
+    }
+    set_line_reader_wait(input_reader, wait_for_input, job_list);
+
+    // With --server, the shell serves command lines on a UNIX socket instead
+    // of reading them from standard input
+    if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+        int status = run_server_mode(argv[2]);
+        cleanup_shell(job_list);
+        return status;
+    }
 
-        // These are two buffers which holds the parsed tokens from the input in
-        // standard input, and the redirect commands as well as the file to
-        // redirect to.
-        char *argv[512] = {0};
-        char *redirect[4] = {0};
+    // Given a script file, or a script with -c, the shell runs the script
+    // instead of reading commands from standard input
+    if (argc > 1) {
+        int status = run_script_mode(argc, argv, job_list);
+        cleanup_shell(job_list);
+        return status;
+    }
 
-        // This sets up signal handlers to ignore signals sent to the shell
-        // ignore_signals ();
-        ignore_signals();
+    // This sets up the shell's signal dispositions and blocked signals, which
+    // last for as long as it runs
+    ignore_signals();
 
-        // This reaps child processes prior to the printing of the prompt
-        reap_children(job_list);
+    // This continues the program indefinitely
+    while (1) {
+        // This holds the words parsed from the input in standard input, and
+        // the redirect commands as well as the file to redirect to.
+        command_t command;
+
+        // When tracing, the events of the last line are written out before
+        // the next phase begins, so that the write is never inside a phase
+        TRACE_FLUSH();
+
+        // This reaps child processes prior to the printing of the prompt, if
+        // any of them has changed state
+        if (children_changed(job_list)) {
+            TRACE_BEGIN("reap_children");
+            reap_children(job_list);
+            TRACE_END("reap_children");
+        }
 
         // This prints out the prompt if the macro is defined properly, and
-        // error checks the syscall
+        // error checks the syscall. The prompt is written along with any
+        // status lines still in the buffer. Without a prompt, an interactive
+        // shell still writes out the status lines before it reads
 #ifdef PROMPT
+        TRACE_BEGIN("prompt");
         if (printf("33sh> ") < 0) {
             fprintf(stderr, "Error printing prompt\n");
         }
         if (fflush(stdout) != 0) {
             fprintf(stderr, "Error printing prompt\n");
         }
+        TRACE_END("prompt");
+#else
+        if (interactive && fflush(stdout) != 0) {
+            fprintf(stderr, "Error printing status\n");
+        }
 #endif
 
         // This function call parses the input, and inserts all tokens into the
-        // argv and redirect arrays. It error checks for incorrect usage of
-        // redirection, and returns a 1 if there are no redirection syntax
-        // errors and the input file was successfully parsed
-        parse_result = parse_input(argv, redirect, &argc, job_list);
+        // argv and redirect arrays of the command. It error checks for
+        // incorrect usage of redirection, and returns a 1 if there are no
+        // redirection syntax errors and the input file was successfully parsed
+        parse_result = parse_input(&command, job_list);
 
         // If the parsing detected incorrect input or no input, the shell goes
         // to a new line and rewaits for user input. It also resets the redirect
@@ -82,145 +304,1151 @@ int main() {
             continue;
         }
 
-        // If the redirection symbols were correctly inputted, the program then
-        // checks for the built in commands. If these commands are found, it
-        // executes these commands, provided there was correct input. The
-        // function returns a 1 if a builtin command was executed, a 0 if no
-        // built-in commands were found (indicating that the inputted argument
-        // is a path to an executable), or a -1 if there was a syntax error
-        built_in_command_result =
-            execute_built_in_commmands(argv, &argc, job_list);
+        // If the redirection symbols were correctly inputted, each pipeline
+        // of the line is executed in turn, either as a built-in command or as
+        // an executable
+        TRACE_BEGIN("execute");
+        execute_command_list(&command, job_list, 0);
+        TRACE_END("execute");
+    }
 
-        // If the above function executed a built in command or returned a
-        // syntax error, the shell goes to a new line and rewaits for user
-        // input.
+    return 0;
+}
 
-        if (built_in_command_result != 0) {
+// This function is used to run the shell on a script, given the arguments
+// the shell was started with: either the path to a script file, or -c
+// followed by the text of a script. Any further arguments are made available
+// to the script as $1, $2 and so on, with $0 the name of the script. The
+// script is parsed once, and each of its commands is run by
+// run_script_command. It returns the exit status of the last command, or 2
+// if the script could not be read or parsed
+
+int run_script_mode(int argc, char *argv[], job_list_t *job_list) {
+    int first_argument = 1;
+    char name[16];
+
+    if (strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "%s", "-c: option requires an argument\n");
+            return 2;
+        }
+        active_script = parse_script(argv[2], strlen(argv[2]));
+        first_argument = 3;
+    } else {
+        active_script = parse_script_file(argv[1]);
+        first_argument = 1;
+    }
+    if (active_script == NULL) {
+        return 2;
+    }
+
+    // With -c, the first argument after the script is $0, as in sh
+    for (int i = first_argument; i < argc && i - first_argument < 10; i++) {
+        snprintf(name, sizeof(name), "%d", i - first_argument);
+        set_variable(name, argv[i]);
+    }
+
+    ignore_signals();
+    int status = run_script(active_script, run_script_command, job_list);
+
+    cleanup_script(active_script);
+    active_script = NULL;
+    return status;
+}
+
+// This function is used to run one command of a script, which is passed the
+// job list as its context. Children that have finished in the background are
+// reaped first, as the shell does before each prompt. last is set if nothing
+// runs after the command, so that it can take the place of the shell. It
+// returns the exit status of the command
+
+int run_script_command(command_t *command, int last, void *context) {
+    job_list_t *job_list = (job_list_t *)context;
+
+    if (children_changed(job_list)) {
+        reap_children(job_list);
+    }
+    execute_command_list(command, job_list, last);
+    return get_last_status();
+}
+
+// This function is used to do nothing when the shell is sent SIGPIPE, so
+// that a write to a client that has gone fails with EPIPE instead of ending
+// the server. Unlike an ignored signal, a handled one is set back to its
+// default in the executables the shell starts
+
+void handle_sigpipe(int sig) { (void)sig; }
+
+// This function is used to run the shell as a command server on a UNIX socket
+// at path, for as long as the server runs. Each connection is a session,
+// opened, run and closed by the server session functions below. Nothing is
+// run on a terminal. It returns 1 if the server could not be started or
+// failed
+
+int run_server_mode(const char *path) {
+    server_handlers_t handlers = {open_server_session, run_server_line,
+                                  watch_server_session, attend_server_session,
+                                  close_server_session};
+
+    interactive = 0;
+    ignore_signals();
+    signal(SIGPIPE, handle_sigpipe);
+    return run_server(path, &handlers, NULL) == -1 ? 1 : 0;
+}
+
+// This function is used to open the session of a new connection to the
+// server, with an empty job list. It returns the session
+
+void *open_server_session(void *context) {
+    (void)context;
+    server_session_t *session =
+        (server_session_t *)malloc(sizeof(server_session_t));
+    session->job_list = init_job_list();
+    session->job_id = 1;
+    session->last_status = 0;
+    session->closing = 0;
+    return session;
+}
+
+// This function is used to swap the job numbers and $? of a session with
+// those of the shell, before and after the session runs anything
+
+void swap_server_session(server_session_t *session) {
+    int saved_job_id = job_id;
+    int saved_status = get_last_status();
+    job_id = session->job_id;
+    set_last_status(session->last_status);
+    session->job_id = saved_job_id;
+    session->last_status = saved_status;
+}
+
+// This function is used to run one command line sent to the server, in the
+// session of its connection, as the interactive loop runs a line read from
+// standard input. The exit status of the line is stored in result, with the
+// resources used by its last foreground job if it ran one. It returns -1 if
+// the line ran exit, so that the connection is closed, and 0 otherwise
+
+int run_server_line(void *session, char *line, server_result_t *result,
+                    void *context) {
+    server_session_t *server_session = (server_session_t *)session;
+    command_t command;
+    struct timespec end;
+    (void)context;
+
+    active_session = server_session;
+    swap_server_session(server_session);
+
+    // Background jobs that have finished since the last line are reported
+    // first, in this line's output
+    reap_children(server_session->job_list);
+
+    foreground_usage_valid = 0;
+    size_t line_length = strlen(line);
+    shell_stats.bytes_read += line_length + 1;
+    TRACE_BEGIN("parse");
+    int parse_result = parse_cached(parse_cache, line, line_length, &command);
+    TRACE_END("parse");
+    if (parse_result == 1) {
+        shell_stats.lines_parsed++;
+        TRACE_BEGIN("execute");
+        execute_command_list(&command, server_session->job_list, 0);
+        TRACE_END("execute");
+    } else if (parse_result == -1) {
+        set_last_status(2);
+    }
+
+    result->status = get_last_status();
+    if (foreground_usage_valid) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        result->has_usage = 1;
+        result->usage = foreground_usage;
+        result->real_usec =
+            (end.tv_sec - foreground_start.tv_sec) * 1000000L +
+            (end.tv_nsec - foreground_start.tv_nsec) / 1000L;
+    }
+
+    swap_server_session(server_session);
+    active_session = NULL;
+    TRACE_FLUSH();
+    return server_session->closing ? -1 : 0;
+}
+
+// This function is used to return the descriptor that becomes readable when a
+// job of a session exits, so that the server can reap it without waiting for
+// the session's next line. It returns -1 if there is none
+
+int watch_server_session(void *session, void *context) {
+    (void)context;
+    return get_job_epoll_fd(((server_session_t *)session)->job_list);
+}
+
+// This function is used to reap the jobs of a session that have exited,
+// whose messages are captured by the server for the session's next reply
+
+void attend_server_session(void *session, void *context) {
+    server_session_t *server_session = (server_session_t *)session;
+    (void)context;
+
+    swap_server_session(server_session);
+    reap_children(server_session->job_list);
+    swap_server_session(server_session);
+}
+
+// This function is used to close the session of a connection that has ended.
+// Its jobs are killed and collected, since nothing is left to report them
+// to, and its job list is freed
+
+void close_server_session(void *session, void *context) {
+    server_session_t *server_session = (server_session_t *)session;
+    pid_t pgid;
+    (void)context;
+
+    // A queued job has no process group yet, and is listed with a PID of 0
+    while ((pgid = get_next_pid(server_session->job_list)) != -1) {
+        if (pgid == 0) {
             continue;
         }
+        kill(-pgid, SIGKILL);
+        while (waitpid(-pgid, NULL, 0) > 0) {
+        }
+    }
+
+    cleanup_job_list(server_session->job_list);
+    free(server_session);
+}
 
-        // If this code is being reached, this means that there is an argument
-        // passed into the stdin which is not one of the supported built-in
-        // commands. Thus, we must attempt to execute the executable which argv
-        // points to, passing in all subsequent arguments as well.
+// This function is used to free everything the shell holds before it exits
+
+void cleanup_shell(job_list_t *job_list) {
+    cleanup_job_list(job_list);
+    cleanup_command_hash(command_hash);
+    cleanup_line_reader(input_reader);
+    cleanup_parse_cache(parse_cache);
+    cleanup_parse_arena(expand_arena);
+    cleanup_script(active_script);
+    stop_launcher(launcher);
+    cleanup_stats();
+    cleanup_capture_set(capture_set);
+}
 
-        run_executable_result = run_executable(argv, redirect, &argc, job_list);
+// This function is used to convert a status returned by wait into an exit
+// status, as $? reports it: the exit code of a process that exited, or 128
+// plus the number of the signal that terminated or stopped it
 
-        // If the agove function returned an error, the loop is re-entered
-        if (run_executable_result == -1) {
+int exit_status(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status)) {
+        return 128 + WSTOPSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// This function is used to get the exit status of a command that could not
+// be executed, given the error of the exec, whichever way it was launched:
+// 127 if there is no such file, as in other shells, and 126 otherwise
+
+int exec_failure_status(int error) { return error == ENOENT ? 127 : 126; }
+
+// This function is used to execute each pipeline of a parsed list of
+// commands in turn. A pipeline joined to the one before it by && only runs if
+// the exit status of the last pipeline run was 0, and one joined by || only
+// if it was not, so that a failure skips the rest of a chain of && without
+// starting anything. Each pipeline runs on a copy in which its variables have
+// been expanded. last is set if nothing runs after the list, in which case
+// its final pipeline may take the place of the shell. It returns 1 if the
+// last pipeline run was executed, and -1 if there was an error
+
+int execute_command_list(command_t *command, job_list_t *job_list, int last) {
+    int result = 1;
+
+    for (command_t *pipeline = command; pipeline != NULL;
+         pipeline = pipeline->next_command) {
+        if ((pipeline->connector == CONNECT_AND && get_last_status() != 0) ||
+            (pipeline->connector == CONNECT_OR && get_last_status() == 0)) {
             continue;
         }
+
+        command_t expanded;
+        reset_parse_arena(expand_arena);
+        expand_command(expand_arena, pipeline, &expanded, get_variable);
+        TRACE_BEGIN_DETAIL("command",
+                           expanded.argc > 0 ? expanded.argv[0] : NULL);
+        result = execute_command(&expanded, job_list,
+                                 last && pipeline->next_command == NULL);
+        TRACE_END("command");
+    }
+
+    return result;
+}
+
+// This function is used to execute a parsed command. It first checks for the
+// built in commands, and if one is found it executes it, provided there was
+// correct input. Otherwise the command is presumed to be an executable and is
+// run. A command prefixed with "time" is executed the same way, after which
+// the resources it used are printed to standard error. If last is set,
+// nothing is left for the shell to do after the command, so a single
+// executable in the foreground replaces the shell with execv instead of
+// being forked and waited for, once prepare_exec_in_place has finished the
+// shell's own work. It returns 1 if the command was executed, and
+// -1 if there was an error
+
+int execute_command(command_t *command, job_list_t *job_list, int last) {
+    int built_in_command_result = 0;
+    int run_executable_result = 0;
+    int timed = 0;
+    struct timespec start;
+    struct rusage self_before;
+
+    // The time prefix is removed from the argv array, and the resources the
+    // shell itself has used so far are recorded, since a built in command
+    // runs inside the shell
+    if (command->argc > 0 && strcmp(command->argv[0], "time") == 0) {
+        timed = 1;
+        command->argv++;
+        command->argc--;
+        foreground_usage_valid = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        getrusage(RUSAGE_SELF, &self_before);
+
+        if (command->argc == 0) {
+            fprintf(stderr, "%s", "time: syntax error\n");
+            set_last_status(1);
+            return -1;
+        }
+    }
+
+    // A built in command succeeds unless it reports an error, and one that
+    // waits for a job, such as fg, records the job's exit status itself
+    set_last_status(0);
+
+    // The function returns a 1 if a builtin command was executed, a 0 if no
+    // built-in commands were found (indicating that the inputted argument is
+    // a path to an executable), or a -1 if there was a syntax error
+    // Built in commands run inside the shell, so the stages of a pipeline are
+    // always run as executables
+    if (command->next_stage == NULL) {
+        TRACE_BEGIN("builtin");
+        built_in_command_result =
+            execute_built_in_commmands(command->argv, &command->argc,
+                                       command->redirect, job_list);
+        TRACE_END("builtin");
+        if (built_in_command_result != 0) {
+            shell_stats.builtins++;
+        }
+        if (built_in_command_result == -1) {
+            set_last_status(1);
+        }
     }
 
+    // If this code is being reached with a 0, this means that there is an
+    // argument passed into the stdin which is not one of the supported
+    // built-in commands. Thus, we must attempt to execute the executable which
+    // argv points to, passing in all subsequent arguments as well.
+    if (built_in_command_result == 0 && last && !timed &&
+        command->next_stage == NULL && !command->background &&
+        prepare_exec_in_place(job_list)) {
+        run_executable_result = exec_in_place(command);
+    } else if (built_in_command_result == 0) {
+        run_executable_result =
+            run_executable(command, job_list, 0, sched_priority);
+    }
+
+    if (timed) {
+        char usage_string[256];
+        struct rusage usage;
+
+        // A foreground child records the resources it used when it is waited
+        // for. Otherwise the difference in the shell's own usage is printed
+        if (foreground_usage_valid) {
+            format_usage(usage_string, sizeof(usage_string), &foreground_start,
+                         NULL, &foreground_usage);
+            fprintf(stderr, "%s\n", usage_string);
+        } else if (built_in_command_result != 0) {
+            getrusage(RUSAGE_SELF, &usage);
+            timersub(&usage.ru_utime, &self_before.ru_utime, &usage.ru_utime);
+            timersub(&usage.ru_stime, &self_before.ru_stime, &usage.ru_stime);
+            usage.ru_nvcsw -= self_before.ru_nvcsw;
+            usage.ru_nivcsw -= self_before.ru_nivcsw;
+            format_usage(usage_string, sizeof(usage_string), &start, NULL,
+                         &usage);
+            fprintf(stderr, "%s\n", usage_string);
+        }
+    }
+
+    if (built_in_command_result == -1 || run_executable_result == -1) {
+        return -1;
+    }
+    return 1;
+}
+
+// This function is used to report a change in the state of a background
+// child, and update its entry in the jobs list accordingly. If the child has
+// terminated and usage is not NULL, the resources it used are reported too.
+// It returns 1 if a line was printed about the child, and 0 if the change
+// was not worth reporting, such as the end of one stage of a pipeline
+
+int report_child_status(job_list_t *job_list, pid_t child_pid, int status,
+                        const struct rusage *usage) {
+    char usage_string[256] = {0};
+
+    // Commands started by the parallel builtin are reported by it instead
+    if (finish_parallel_command(job_list, child_pid, status)) {
+        return 1;
+    }
+
+    // A job is reported by its JID and the PID of its first process, which is
+    // also the ID of its process group
+    int jid = get_job_jid(job_list, child_pid);
+    pid_t job_pid = jid == -1 ? child_pid : get_job_pid(job_list, jid);
+
+    // A job is only reported once the last of its processes has terminated,
+    // with the status of the last stage of its pipeline and the resources
+    // used by every stage. These are formatted while the job still holds the
+    // time it was launched and the time its last process was reaped, so that
+    // its real time does not include any wait before the line is printed
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+        struct timespec start;
+        struct timespec end;
+        struct rusage job_usage;
+        if (get_job_start_pid(job_list, child_pid, &start) == -1) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+        if (usage != NULL) {
+            job_usage = *usage;
+        }
+        if (finish_job_process(job_list, child_pid, &status,
+                               usage != NULL ? &job_usage : NULL) > 0) {
+            return 0;
+        }
+
+        if (usage != NULL) {
+            int ended = get_job_end_jid(job_list, jid, &end) == 0;
+            usage_string[0] = ' ';
+            usage_string[1] = '(';
+            int length =
+                format_usage(usage_string + 2, sizeof(usage_string) - 3,
+                             &start, ended ? &end : NULL, &job_usage);
+            if (length > 0 && (size_t)length < sizeof(usage_string) - 3) {
+                strcat(usage_string, ")");
+            }
+        }
+    }
+
+    // Checking for normal process termination
+    if (WIFEXITED(status)) {
+        printf("[%d] (%d) terminated with exit status %d%s\n", jid, job_pid,
+               WEXITSTATUS(status), usage_string);
+
+        // Removing the process from the jobs list
+        remove_job_jid(job_list, jid);
+        return 1;
+    }
+
+    // Checking for process termination via a signal
+    if (WIFSIGNALED(status)) {
+        printf("[%d] (%d) terminated by signal %d%s\n", jid, job_pid,
+               WTERMSIG(status), usage_string);
+
+        // Removing the process from the jobs list
+        remove_job_jid(job_list, jid);
+        return 1;
+    }
+
+    // Checking for process suspension via signal. Every process of a
+    // pipeline is stopped, but the job is only reported once
+    if (WIFSTOPPED(status) &&
+        get_job_state_pid(job_list, child_pid) != STOPPED) {
+        printf("[%d] (%d) suspended by signal %d\n", jid, job_pid,
+               WSTOPSIG(status));
+
+        // Updating the enum to STOPPED
+        update_job_pid(job_list, child_pid, STOPPED);
+        return 1;
+    }
+
+    // Checking if a process was resumed via signal, which is likewise only
+    // reported for the first process of a stopped job to resume
+    if (WIFCONTINUED(status) &&
+        get_job_state_pid(job_list, child_pid) == STOPPED) {
+        printf("[%d] (%d) resumed\n", jid, job_pid);
+
+        // Updating the enum to RUNNING
+        update_job_pid(job_list, child_pid, RUNNING);
+        return 1;
+    }
     return 0;
 }
 
-// This function is used to reap all children and update statuses accordingly,
-// prior to the printing of the prompt
+// This function is used to reap all children of the jobs in job_list and
+// update statuses accordingly, prior to the printing of the prompt. Only the
+// process groups of the list's own jobs are waited for, since each session of
+// the server has a job list of its own. It returns the number of changes of
+// state that were reported with a line of their own, which is fewer than the
+// children collected when a pipeline ends one stage at a time, or a job that
+// bg has already reported as resumed continues
 
-void reap_children(job_list_t *job_list) {
+int reap_children(job_list_t *job_list) {
     int status = 0;
     pid_t child_pid = 0;
+    int reaped = 0;
+    int reported = 0;
+    struct rusage usage;
+
+    shell_stats.reap_calls++;
+
+    // The groups are listed before any child is collected, since a job that
+    // finishes is taken out of the list
+    int job_count = get_job_count(job_list);
+    size_t slots = job_count > 0 ? (size_t)job_count : 1;
+    pid_t *pgids = (pid_t *)malloc(sizeof(pid_t) * slots);
+    int group_count = get_job_pgids(job_list, pgids, job_count);
+
+    // Without pidfds, every child of each group that has changed state is
+    // collected with waitpid
+    if (get_job_epoll_fd(job_list) == -1) {
+        for (int group = 0; group < group_count; group++) {
+            while ((child_pid = wait4(-pgids[group], &status,
+                                      WNOHANG | WUNTRACED | WCONTINUED,
+                                      &usage)) > 0) {
+                reported += report_child_status(job_list, child_pid, status,
+                                                &usage);
+                reaped++;
+            }
 
-    while ((child_pid =
-                waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        // Checking for normal process termination
-        if (WIFEXITED(status)) {
-            printf("[%d] (%d) terminated with exit status %d\n",
-                   get_job_jid(job_list, child_pid), child_pid,
-                   WEXITSTATUS(status));
+            // Checking if the error was due to no processes being left in
+            // the group, in which case the error is ignored. If the error was
+            // more serious, the error is printed out
+            if (child_pid == -1 && errno != ECHILD) {
+                perror("wait");
+            }
+        }
+        free(pgids);
+        shell_stats.reaped += (unsigned long)reaped;
+        if (reported > 0) {
+            start_queued_jobs(job_list, 0);
+        }
+        return reported;
+    }
 
-            // Removing the process from the jobs list
+    // Otherwise the epoll set of job pidfds names exactly the jobs that have
+    // exited, and each is waited for through its own pidfd. A process that
+    // cannot be collected yet is left in its job, and waited for once the
+    // shell is next told a child has changed state, while a job whose
+    // process cannot be waited for at all is dropped
+    while ((child_pid = get_exited_pid(job_list)) > 0) {
+        pid_t wait_result =
+            wait_job_pid(job_list, child_pid, &status, WNOHANG, &usage);
+        if (wait_result > 0) {
+            reported += report_child_status(job_list, child_pid, status,
+                                            &usage);
+            reaped++;
+        } else if (wait_result == 0) {
+            break;
+        } else {
+            perror("wait");
             remove_job_pid(job_list, child_pid);
         }
+    }
 
-        // Checking for process termination via a signal
-        if (WIFSIGNALED(status)) {
-            printf("[%d] (%d) terminated by signal %d\n",
-                   get_job_jid(job_list, child_pid), child_pid,
-                   WTERMSIG(status));
+    // Stops and resumptions do not make a pidfd readable, so they are
+    // collected with a waitid on each group that leaves exited children alone
+    for (int group = 0; group < group_count; group++) {
+        while (1) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_PGID, (id_t)pgids[group], &info,
+                       WSTOPPED | WCONTINUED | WNOHANG) == -1) {
+                if (errno != ECHILD) {
+                    perror("wait");
+                }
+                break;
+            }
+            if (info.si_pid == 0) {
+                break;
+            }
 
-            // Removing the process from the jobs list
-            remove_job_pid(job_list, child_pid);
+            status = siginfo_to_status(&info);
+            reported +=
+                report_child_status(job_list, info.si_pid, status, NULL);
+            reaped++;
         }
+    }
+    free(pgids);
 
-        // Checking for process suspension via signal
-        if (WIFSTOPPED(status)) {
-            printf("[%d] (%d) suspended by signal %d\n",
-                   get_job_jid(job_list, child_pid), child_pid,
-                   WSTOPSIG(status));
+    shell_stats.reaped += (unsigned long)reaped;
+
+    // Every job that has finished or stopped frees a slot for a queued job
+    if (reported > 0) {
+        start_queued_jobs(job_list, 0);
+    }
+    return reported;
+}
 
-            // Updating the enum to STOPPED
-            update_job_pid(job_list, child_pid, STOPPED);
+// This function is used to tell whether any child may have changed state
+// since the children were last reaped, so that the shell only looks for them
+// when one has. Every change of state queues a SIGCHLD on the signalfd, which
+// is drained here, before the children are reaped, so that no change is
+// missed. A shell with no jobs has nothing to reap, and makes no system call
+// at all. It returns 1 if the children should be reaped, and 0 if not
+
+int children_changed(job_list_t *job_list) {
+    struct signalfd_siginfo info[4];
+
+    if (get_job_count(job_list) == 0) {
+        return 0;
+    }
+    if (sigchld_fd == -1 || sigchld_consumed) {
+        sigchld_consumed = 0;
+        return 1;
+    }
+    return read(sigchld_fd, info, sizeof(info)) > 0;
+}
+
+// This function is used to wait until a process of the process group pgid
+// may have changed state, while reading the output of captured jobs, so that
+// no captured job is held up by a full pipe while the shell waits for a
+// foreground job. Whether a process has changed state is checked without
+// collecting it, which is left to the caller. A SIGCHLD read along the way is
+// recorded, since it may belong to another job, and the time any background
+// process exits is noted, so that its job's real time ends there rather than
+// once the foreground job is done. While jobs are queued, the background
+// processes that exit are reaped straight away instead, so that the slots
+// they free are taken while the foreground job runs. It returns once there
+// is a change to collect, or once there is neither a capture left open nor
+// another job
+
+void wait_for_foreground_change(job_list_t *job_list, pid_t pgid) {
+    struct pollfd fds[2];
+    struct signalfd_siginfo info[4];
+
+    while (sigchld_fd != -1 &&
+           ((capture_set != NULL && get_open_capture_count(capture_set) > 0) ||
+            (get_job_epoll_fd(job_list) != -1 &&
+             get_job_count(job_list) - get_queued_job_count(job_list) > 1))) {
+        siginfo_t child_info;
+        child_info.si_pid = 0;
+        if (waitid(P_PGID, (id_t)pgid, &child_info,
+                   WEXITED | WSTOPPED | WNOHANG | WNOWAIT) == -1 ||
+            child_info.si_pid != 0) {
+            return;
         }
 
-        // Checking if a process was resumed via signal
-        if (WIFCONTINUED(status)) {
-            printf("[%d] (%d) resumed\n", get_job_jid(job_list, child_pid),
-                   child_pid);
+        fds[0].fd = sigchld_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd =
+            capture_set != NULL ? get_capture_epoll_fd(capture_set) : -1;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return;
+        }
 
-            // Updating the enum to RUNNING
-            update_job_pid(job_list, child_pid, RUNNING);
+        if (fds[1].revents & POLLIN) {
+            drain_captures(capture_set);
+        }
+        if ((fds[0].revents & POLLIN) &&
+            read(sigchld_fd, info, sizeof(info)) > 0) {
+            sigchld_consumed = 1;
+            if (get_queued_job_count(job_list) > 0) {
+                reap_background_children(job_list, pgid);
+            }
+            note_exited_processes(job_list);
         }
     }
+}
 
-    // Error checking the system call
-    if (child_pid == -1) {
-        // Checking if the error was due to no processes currently being run, in
-        // which case the error is ignored
-        if (errno == ECHILD) {
-            return;
+// This function is used to reap the background processes that have exited
+// while the job of process group pgid runs in the foreground, leaving the
+// foreground job's own processes to be collected by its caller. The jobs they
+// finish are reported, and the slots they free are given to queued jobs. It
+// returns the number of changes of state that were reported
+
+int reap_background_children(job_list_t *job_list, pid_t pgid) {
+    pid_t pids[64];
+    int status = 0;
+    int reported = 0;
+    struct rusage usage;
+    int foreground_jid = get_job_jid(job_list, pgid);
+    int count = get_exited_pids(job_list, pids, 64);
+
+    for (int i = 0; i < count; i++) {
+        if (get_job_jid(job_list, pids[i]) == foreground_jid) {
+            continue;
+        }
+        if (wait_job_pid(job_list, pids[i], &status, WNOHANG, &usage) > 0) {
+            reported += report_child_status(job_list, pids[i], status, &usage);
+            shell_stats.reaped++;
         }
+    }
 
-        // If the error was more serious, the error is printed out
-        perror("wait");
+    if (reported > 0) {
+        start_queued_jobs(job_list, 1);
+        fflush(stdout);
     }
+    return reported;
 }
-// This function is used to restore the signal handlers to their default
-// values when the child process is forked off
 
-void restore_signals() {
-    if (signal(SIGQUIT, SIG_DFL) == SIG_ERR) {
-        perror("SIGQUIT");
+// This function is used to point the shell's standard output and error at
+// fd, saving the descriptors they pointed at before in saved_fds, so that
+// every process of a captured job inherits them. Called with fd -1, it puts
+// the saved descriptors back and closes them. It returns 0 on success, and
+// -1 on failure
+
+int swap_output(int fd, int saved_fds[2]) {
+    // Anything the shell has buffered is written where it was meant to go
+    fflush(stdout);
+    fflush(stderr);
+
+    if (fd == -1) {
+        dup2(saved_fds[0], 1);
+        dup2(saved_fds[1], 2);
+        close(saved_fds[0]);
+        close(saved_fds[1]);
+        return 0;
     }
-    if (signal(SIGINT, SIG_DFL) == SIG_ERR) {
-        perror("SIGINT");
+
+    saved_fds[0] = fcntl(1, F_DUPFD_CLOEXEC, 10);
+    saved_fds[1] = fcntl(2, F_DUPFD_CLOEXEC, 10);
+    if (saved_fds[0] == -1 || saved_fds[1] == -1 || dup2(fd, 1) == -1 ||
+        dup2(fd, 2) == -1) {
+        perror("dup2");
+        if (saved_fds[0] != -1) {
+            dup2(saved_fds[0], 1);
+            close(saved_fds[0]);
+        }
+        if (saved_fds[1] != -1) {
+            dup2(saved_fds[1], 2);
+            close(saved_fds[1]);
+        }
+        return -1;
     }
-    if (signal(SIGTSTP, SIG_DFL) == SIG_ERR) {
-        perror("SIGTSTP");
+    return 0;
+}
+
+// This function is used to wait until at least one child has changed state,
+// and has been reaped and reported. It returns 0 on success, and -1 on failure
+
+int wait_for_children(job_list_t *job_list) {
+    return wait_for_input(-1, job_list);
+}
+
+// This function is used by the input reader to wait until standard input is
+// readable, or, when it is passed -1 for the file descriptor, to wait until a
+// child has been reaped. While it waits, any SIGCHLD that arrives is read from
+// the signalfd, and any job that exits makes the epoll set of job pidfds
+// readable. Either way the children are reaped straight away, so that the
+// status of a background job is printed as soon as it changes rather than at
+// the next prompt. It returns 0 once the input is readable, and -1 on failure
+
+int wait_for_input(int fd, void *context) {
+    job_list_t *job_list = (job_list_t *)context;
+    struct pollfd fds[4];
+    nfds_t nfds = 2;
+
+    // Without a signalfd the reader simply blocks in read, and children are
+    // waited for with a blocking wait
+    if (sigchld_fd == -1) {
+        if (fd == -1) {
+            int status = 0;
+            pid_t child_pid = waitpid(-1, &status, WUNTRACED);
+            if (child_pid == -1) {
+                return -1;
+            }
+            report_child_status(job_list, child_pid, status, NULL);
+        }
+        return 0;
+    }
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = sigchld_fd;
+    fds[1].events = POLLIN;
+    fds[2].fd = get_job_epoll_fd(job_list);
+    fds[2].events = POLLIN;
+    fds[2].revents = 0;
+    if (fds[2].fd != -1) {
+        nfds = 3;
+    }
+
+    // The pipes of captured jobs are read while the shell waits, so that the
+    // jobs never wait on a full pipe. poll skips the pidfd entry if it is -1
+    fds[3].fd = capture_set != NULL ? get_capture_epoll_fd(capture_set) : -1;
+    fds[3].events = POLLIN;
+    fds[3].revents = 0;
+    if (fds[3].fd != -1) {
+        nfds = 4;
+    }
+
+    while (1) {
+        if (poll(fds, nfds, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            return -1;
+        }
+
+        if (fds[3].revents & POLLIN) {
+            drain_captures(capture_set);
+        }
+
+        if ((fds[1].revents | fds[2].revents) & POLLIN) {
+            // Draining every queued SIGCHLD, since a single reap collects
+            // all of the children that have changed state
+            struct signalfd_siginfo info;
+            while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info)) {
+            }
+
+            // The prompt is printed again below any status lines, unless
+            // the input is being read by the parallel builtin
+            int reported = reap_children(job_list);
+            if (reported > 0 && fd != -1 && active_batch == NULL) {
+#ifdef PROMPT
+                if (printf("33sh> ") < 0) {
+                    fprintf(stderr, "Error printing prompt\n");
+                }
+#endif
+            }
+            if (fflush(stdout) != 0) {
+                fprintf(stderr, "Error printing status\n");
+            }
+
+            if (reported > 0 && fd == -1) {
+                return 0;
+            }
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            return 0;
+        }
     }
-    if (signal(SIGTTOU, SIG_DFL) == SIG_ERR) {
-        perror("SIGTTOU");
+}
+
+// This function is used to do nothing when the shell is sent SIGINT, SIGQUIT
+// or SIGTSTP. The shell handles these signals rather than ignoring them
+// because execv sets a handled signal back to its default, and an ignored one
+// stays ignored, so the executables the shell starts need no calls to undo
+// the shell's dispositions. Handlers are installed with SA_RESTART, so that
+// the signals do not interrupt the shell's reads and waits
+
+void handle_job_control_signal(int sig) { (void)sig; }
+
+// This function is used to fill set with the signals that the shell keeps
+// blocked: SIGCHLD, which it reads from its signalfd, and SIGTTOU, which is
+// blocked rather than ignored, since the terminal lets a process with SIGTTOU
+// blocked change its foreground process group just as if it were ignored
+
+void get_blocked_signals(sigset_t *set) {
+    sigemptyset(set);
+    sigaddset(set, SIGCHLD);
+    sigaddset(set, SIGTTOU);
+}
+
+// This function is used to restore the signals of a child process once it
+// has been forked off, by unblocking the signals the shell keeps blocked. The
+// signals the shell handles are set back to their defaults by execv, so this
+// takes a single system call
+
+void restore_signals() {
+    sigset_t blocked_set;
+    get_blocked_signals(&blocked_set);
+    if (sigprocmask(SIG_UNBLOCK, &blocked_set, NULL) == -1) {
+        perror("sigprocmask");
     }
 }
 
-// This function is used to set the shell to ignore the SIGQUIT, SIGINT , and
-// SIGTSTP, and SIGTTOU commands
+// This function is used to set the shell to do nothing on SIGQUIT, SIGINT and
+// SIGTSTP, and to block SIGTTOU and SIGCHLD. The dispositions last for as
+// long as the shell runs, so this is called once, before the shell starts
+// reading commands, and again only if restore_signals has been called in the
+// shell itself
 
 void ignore_signals() {
-    if (signal(SIGQUIT, SIG_IGN) == SIG_ERR) {
+    struct sigaction action;
+    sigset_t blocked_set;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_job_control_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGQUIT, &action, NULL) == -1) {
         perror("SIGQUIT");
     }
-    if (signal(SIGINT, SIG_IGN) == SIG_ERR) {
+    if (sigaction(SIGINT, &action, NULL) == -1) {
         perror("SIGINT");
     }
-    if (signal(SIGTSTP, SIG_IGN) == SIG_ERR) {
+    if (sigaction(SIGTSTP, &action, NULL) == -1) {
         perror("SIGTSTP");
     }
-    if (signal(SIGTTOU, SIG_IGN) == SIG_ERR) {
-        perror("SIGTTOU");
+
+    get_blocked_signals(&blocked_set);
+    if (sigprocmask(SIG_BLOCK, &blocked_set, NULL) == -1) {
+        perror("sigprocmask");
     }
 }
 
-// This function is used to run the executable, assuming that no built-in
-// function was called. It returns 1 if the program was correctly executed, and
-// -1 if the program was unable to be executed
+// This function launches the child process with a full fork. The child sets
+// up its process group, takes the terminal if it is a foreground job,
+// restores the default signal dispositions, connects the pipes of its
+// pipeline stage and opens the redirect files before calling execv. A pgid of
+// 0 starts a new process group, and input_fd and output_fd are the pipes to
+// the previous and next stages, or -1. It returns the pid of the child, or -1
+// if the fork failed. The child leaves with _exit on failure, so that it does
+// not flush a second copy of the shell's buffered output
+
+pid_t launch_fork(char *file_path, char *argv[], char *redirect[],
+                  int background, pid_t pgid, int input_fd, int output_fd) {
+    pid_t child_pid;
+
+    TRACE_BEGIN("fork");
+    if ((child_pid = fork()) == 0) {
+        // The child traces its own phases, up to the execv, under its own PID
+        if (trace_enabled) {
+            trace_child();
+        }
+
+        // Setting the process group ID of the child process to its process
+        // ID, or joining the group of the first stage of its pipeline
+        if (setpgid(0, pgid) == -1) {
+            perror("setpgid");
+            _exit(1);
+        }
+
+        // Setting the child process to be the foreground process by changing
+        // the process group ID of standard input to that of the child, if the
+        // & specifier was not included. Only the first stage of a pipeline
+        // does this, for the whole group
+        if (!background && interactive && pgid == 0) {
+            TRACE_BEGIN("tcsetpgrp");
+            if (tcsetpgrp(0, getpgrp()) == -1) {
+                perror("tcsetpgrp");
+                _exit(1);
+            }
+            TRACE_END("tcsetpgrp");
+        }
+
+        // Restoring signal functionality in the child process
+        TRACE_BEGIN("restore_signals");
+        restore_signals();
+        TRACE_END("restore_signals");
+
+        // Connecting the pipes to the neighbouring stages of the pipeline.
+        // This is done before the redirects, so that a redirect wins over a
+        // pipe, as it does in other shells
+        if ((input_fd != -1 && dup2(input_fd, 0) == -1) ||
+            (output_fd != -1 && dup2(output_fd, 1) == -1)) {
+            perror("dup2");
+            _exit(1);
+        }
+
+        // This applies the input and output redirections, exiting if a file
+        // cannot be opened
+        if (apply_redirects(redirect, argv[0]) == -1) {
+            _exit(1);
+        }
+        TRACE_INSTANT("execv");
+        TRACE_FLUSH();
+        record_exec();
+        execv(file_path, argv);
+
+        // This handles the case in which the execv command fails to execute.
+        // The failure is recorded in the memory the child shares with the
+        // shell, which tells the shell whether a remembered path has gone
+        // stale. The child exits with the status of a failed exec
+        int exec_error = errno;
+        record_exec_failure(exec_error);
+        perror("execv");
+        _exit(exec_failure_status(exec_error));
+    }
 
-int run_executable(char *argv[], char *redirect[], int *argc,
-                   job_list_t *job_list) {
-    // To perform the execv command, we need to parse out an arg array, and
-    // create a pointer to the full path of the executable.
+    // Error checking the fork system call in the parent. The parent also puts
+    // the child in its own process group, so that the group exists as soon as
+    // fork returns, however soon the shell goes on to signal it
+    TRACE_END("fork");
+    if (child_pid == -1) {
+        perror("fork");
+    } else {
+        setpgid(child_pid, pgid == 0 ? child_pid : pgid);
+    }
+
+    return child_pid;
+}
+
+// This function is used to get the shell ready to be replaced by the last
+// command of a script. Jobs still waiting in the scheduler's queue are only
+// ever started by the shell, so it waits for the jobs ahead of them to finish
+// and starts them first. The shell cannot be replaced at all while it reads
+// the output of captured jobs, since the exec would close their pipes. It
+// returns 1 if the shell can be replaced, 0 if it has to stay and run the
+// command as a child
+
+int prepare_exec_in_place(job_list_t *job_list) {
+    if (capture_set != NULL && get_open_capture_count(capture_set) > 0) {
+        return 0;
+    }
+    start_queued_jobs(job_list, 0);
+    while (get_queued_job_count(job_list) > 0) {
+        if (wait_for_children(job_list) == -1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// This function is used to replace the shell with an executable, in the
+// same process, without forking. The executable keeps the shell's PID,
+// process group and terminal, and its exit status becomes the shell's. The
+// redirections are applied to the shell's own standard input and output, and
+// the signals the shell blocks are unblocked first, as they are in a forked
+// child. It only returns if the executable could not be started, in
+// which case the signals are set back up for the shell, and it returns -1
+
+int exec_in_place(command_t *command) {
     char file_path[1024];
+
+    int hashed = resolve_executable(command, file_path, sizeof(file_path));
+    if (hashed == -1) {
+        set_last_status(127);
+        return -1;
+    }
+    if (apply_redirects(command->redirect, command->argv[0]) == -1) {
+        set_last_status(1);
+        return -1;
+    }
+
+    // Anything the shell has printed must be written before the shell's
+    // buffers are lost
+    fflush(stdout);
+    fflush(stderr);
+    restore_signals();
+    TRACE_INSTANT("execv");
+    TRACE_FLUSH();
+    execv(file_path, command->argv);
+
+    int exec_error = errno;
+    shell_stats.exec_failures++;
+    perror(command->argv[0]);
+    if (exec_error == ENOENT && hashed) {
+        forget_command(command_hash, command->argv[0]);
+    }
+    set_last_status(exec_failure_status(exec_error));
+    ignore_signals();
+    return -1;
+}
+
+// This function launches the child process with posix_spawn, which glibc
+// implements with clone(CLONE_VM | CLONE_VFORK) so that the shell's page
+// tables are never copied. Everything the forked child does by hand is
+// expressed as spawn attributes and file actions instead, and the arguments
+// are those of launch_fork. It returns the pid of the child, or -1 with errno
+// set if the child could not be started
+
+pid_t launch_spawn(char *file_path, char *argv[], char *redirect[],
+                   int background, pid_t pgid, int input_fd, int output_fd) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t child_mask;
+    pid_t child_pid = -1;
+    int spawn_result = 0;
+
+    // The child is placed in its own process group, or in that of the first
+    // stage of its pipeline. posix_spawn sets the signals that the shell
+    // handles back to their defaults by itself, and the child starts with
+    // nothing blocked, since the shell keeps SIGCHLD and SIGTTOU blocked
+    sigemptyset(&child_mask);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigmask(&attr, &child_mask);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+
+    // Foreground jobs are handed the terminal from inside the child, once it
+    // is in its new process group, exactly as the forked child does it
+    posix_spawn_file_actions_init(&actions);
+    if (!background && interactive && pgid == 0) {
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, 0);
+    }
+
+    // The pipes to the neighbouring stages are duplicated onto stdin and
+    // stdout before the redirects, so that a redirect wins over a pipe
+    if (input_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, input_fd, 0);
+    }
+    if (output_fd != -1) {
+        posix_spawn_file_actions_adddup2(&actions, output_fd, 1);
+    }
+
+    // The redirect files are opened onto stdin and stdout by the file actions
+    if (redirect[INPUT_REDIRECTION] != NULL) {
+        posix_spawn_file_actions_addopen(
+            &actions, 0, redirect[INPUT_REDIRECTION_FILE], O_RDONLY, 0);
+    }
+    if (redirect[OUTPUT_REDIRECTION] != NULL) {
+        int flags = O_RDWR | O_CREAT;
+        flags |= strcmp(redirect[OUTPUT_REDIRECTION], ">>") == 0 ? O_APPEND
+                                                                 : O_TRUNC;
+        posix_spawn_file_actions_addopen(
+            &actions, 1, redirect[OUTPUT_REDIRECTION_FILE], flags, 0777);
+    }
+
+    // posix_spawn reports failures of the file actions and of the exec itself
+    // as its return value, which is passed on to the caller through errno
+    TRACE_BEGIN("posix_spawn");
+    spawn_result =
+        posix_spawn(&child_pid, file_path, &actions, &attr, argv, environ);
+    TRACE_END("posix_spawn");
+    if (spawn_result != 0) {
+        errno = spawn_result;
+        child_pid = -1;
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    return child_pid;
+}
+
+// This function launches the child process through the launcher, which
+// forks it from its own small address space rather than from the shell's.
+// The child is created as a child of the shell, with the arguments of
+// launch_fork, and the shell puts it in its process group as well, as it does
+// for a forked child. A child that could not execute its file is recorded as
+// a failed exec. It returns the pid of the child, or -1 with errno set if the
+// child could not be started
+
+pid_t launch_zygote(char *file_path, char *argv[], char *redirect[],
+                    int background, pid_t pgid, int input_fd, int output_fd) {
+    int exec_error = 0;
+    TRACE_BEGIN("launcher_spawn");
+    pid_t child_pid = launcher_spawn(launcher, file_path, argv, redirect,
+                                     !background && interactive, pgid,
+                                     input_fd, output_fd, &exec_error);
+    TRACE_END("launcher_spawn");
+
+    if (child_pid != -1) {
+        setpgid(child_pid, pgid == 0 ? child_pid : pgid);
+        if (exec_error != 0) {
+            record_exec_failure(exec_error);
+        }
+    }
+    return child_pid;
+}
+
+// This function is used to find the executable a stage of a command runs. It
+// copies the path of the executable into file_path, and replaces argv[0] with
+// the final component of that path. It returns 1 if the path was found in
+// PATH through the command hash, 0 if argv[0] was used as the path directly,
+// and -1 if there is no such command
+
+int resolve_executable(command_t *stage, char *file_path, size_t size) {
+    char **argv = stage->argv;
     char tokenized_final_path[1024];
 
     // The buffer pointer is used to point to the final path component of the
@@ -231,10 +1459,26 @@ int run_executable(char *argv[], char *redirect[], int *argc,
     char *temporary_pointer = NULL;
     char *delimiter = "/";
 
+    // A command name without a slash is looked up in PATH through the command
+    // hash, while anything containing a slash is used as the path directly
+    const char *hashed_path = NULL;
+    if (strchr(argv[0], '/') == NULL) {
+        if ((hashed_path = lookup_command(command_hash, argv[0])) == NULL) {
+            fprintf(stderr, "%s: command not found\n", argv[0]);
+            return -1;
+        }
+    }
+
+    if (strlen(hashed_path != NULL ? hashed_path : argv[0]) >= size ||
+        strlen(argv[0]) >= sizeof(tokenized_final_path)) {
+        fprintf(stderr, "%s: file name too long\n", argv[0]);
+        return -1;
+    }
+
     // This copies the file path into two different character arrays. One is
     // used to hold the filepath, while the other is used to tokenize the first
     // argument to retrieve the final path component of the path to the program
-    strcpy(file_path, argv[0]);
+    strcpy(file_path, hashed_path != NULL ? hashed_path : argv[0]);
     strcpy(tokenized_final_path, argv[0]);
 
     // This tokenizes the first argument of the argv array, and places the
@@ -246,145 +1490,680 @@ int run_executable(char *argv[], char *redirect[], int *argc,
         temporary_pointer = strtok(NULL, delimiter);
     }
 
-    // This sets the first element of the argv array to be the final path name
-    argv[0] = buffer_pointer;
+    // This sets the first element of the argv array to be the final path
+    // name. The tokenized copy is local, so argv[0] is pointed at the same
+    // name within the original word, which is left as it is, since a script
+    // runs the same words again
+    if (buffer_pointer != NULL) {
+        argv[0] += buffer_pointer - tokenized_final_path;
+    }
+
+    return hashed_path != NULL;
+}
+
+// This function is used to start one stage of a command with whichever launch
+// path is selected. hashed says whether file_path was found through the
+// command hash, and the other arguments are those of launch_fork. It returns
+// the pid of the child, or -1 after printing an error message
+
+pid_t launch_stage(command_t *stage, char *file_path, size_t size, int hashed,
+                   int background, pid_t pgid, int input_fd, int output_fd) {
+    char **argv = stage->argv;
+    char **redirect = stage->redirect;
+    pid_t child_pid;
+
+    // Anything an interactive shell has printed is written before the child
+    // can print anything of its own
+    if (interactive) {
+        fflush(stdout);
+    }
+
+    // The launch is timed up to the exec, which a forked child records
+    // itself, just before its execv
+    start_launch();
+    if (launch_mode == LAUNCH_FORK) {
+        child_pid = launch_fork(file_path, argv, redirect, background, pgid,
+                                input_fd, output_fd);
+        if (child_pid == -1) {
+            shell_stats.launch_failures++;
+        }
+        return child_pid;
+    }
+
+    pid_t (*launch)(char *, char **, char **, int, pid_t, int, int) =
+        launch_mode == LAUNCH_ZYGOTE ? launch_zygote : launch_spawn;
+    child_pid = launch(file_path, argv, redirect, background, pgid, input_fd,
+                       output_fd);
+
+    // If a remembered path no longer exists, it is forgotten and PATH is
+    // searched again. The spawn is only retried if the command has moved
+    if (child_pid == -1 && errno == ENOENT && hashed) {
+        forget_command(command_hash, argv[0]);
+        const char *hashed_path = lookup_command(command_hash, argv[0]);
+        if (hashed_path != NULL && strcmp(hashed_path, file_path) != 0 &&
+            strlen(hashed_path) < size) {
+            strcpy(file_path, hashed_path);
+            child_pid = launch(file_path, argv, redirect, background, pgid,
+                               input_fd, output_fd);
+        } else {
+            errno = ENOENT;
+        }
+    }
+
+    // posix_spawn only returns once the child has executed, and reports a
+    // failed exec as its own error. The launcher replies once it has started
+    // the child, which is as close to the exec as the shell can see
+    if (child_pid == -1) {
+        if (errno == ENOENT || errno == EACCES || errno == ENOEXEC) {
+            shell_stats.exec_failures++;
+        } else {
+            shell_stats.launch_failures++;
+        }
+        perror(argv[0]);
+    } else {
+        record_exec();
+    }
+    return child_pid;
+}
+
+// This function is used to wait for a job that runs in the foreground, given
+// its JID. It returns once every process of the job has terminated, in which
+// case the job is removed from the job list and status and usage are those of
+// the whole job, or once one of its processes has been stopped, in which case
+// the job is marked as stopped. The processes are collected through the
+// job's process group, which cannot be reused while any of them is unreaped.
+// It returns 0 on success, and -1 on failure
+
+int wait_foreground_job(job_list_t *job_list, int jid, int *status,
+                        struct rusage *usage) {
+    pid_t pgid = get_job_pid(job_list, jid);
+
+    if (interactive) {
+        fflush(stdout);
+    }
+
+    while (1) {
+        wait_for_foreground_change(job_list, pgid);
+        pid_t child_pid = wait4(-pgid, status, WUNTRACED, usage);
+        if (child_pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("wait");
+            remove_job_jid(job_list, jid);
+            return -1;
+        }
+
+        if (WIFSTOPPED(*status)) {
+            update_job_jid(job_list, jid, STOPPED);
+            return 0;
+        }
+
+        if (finish_job_process(job_list, child_pid, status, usage) <= 0) {
+            remove_job_jid(job_list, jid);
+            return 0;
+        }
+    }
+}
+
+// This function is used to run the executable, assuming that no built-in
+// function was called. A pipeline runs one executable per stage, all started
+// at once in the process group of the first stage, with each stage's output
+// piped into the next one, and is tracked as a single job. A new job is given
+// the next job ID, and a queued job that is being started passes its own as
+// jid. A new background job beyond the limit of the scheduler is queued
+// instead of started. A background job is given priority as its nice value.
+// It returns 1 if the program was correctly executed, and -1 if the program
+// was unable to be executed
+
+int run_executable(command_t *command, job_list_t *job_list, int jid,
+                   int priority) {
+    int new_job = jid == 0;
+    int stage_count = 0;
+    command_t *stage = NULL;
+    for (stage = command; stage != NULL; stage = stage->next_stage) {
+        stage_count++;
+    }
+
+    // Every stage is looked up before any of them is started, so that a
+    // pipeline with a missing command is never started in part
+    char(*file_paths)[1024] =
+        (char(*)[1024])malloc(sizeof(*file_paths) * (size_t)stage_count);
+    int *hashed = (int *)malloc(sizeof(int) * (size_t)stage_count);
+    size_t command_length = 0;
+    int index = 0;
+    for (stage = command; stage != NULL; stage = stage->next_stage) {
+        TRACE_BEGIN("resolve");
+        hashed[index] = resolve_executable(stage, file_paths[index],
+                                           sizeof(file_paths[index]));
+        TRACE_END("resolve");
+        if (hashed[index] == -1) {
+            free(file_paths);
+            free(hashed);
+            set_last_status(127);
+            return -1;
+        }
+        command_length += strlen(file_paths[index]) + 3;
+        index++;
+    }
+
+    // The job is listed with the path of each of its executables
+    char *job_command = (char *)malloc(command_length + 1);
+    job_command[0] = '\0';
+    for (index = 0; index < stage_count; index++) {
+        if (index > 0) {
+            strcat(job_command, " | ");
+        }
+        strcat(job_command, file_paths[index]);
+    }
+
+    // If the & specifier was included when executing the program, the program
+    // is run in the background
+    int background = command->background;
+    if (new_job) {
+        jid = job_id;
+    }
+
+    // A new background job waits in the queue if as many background jobs as
+    // the scheduler allows are running already. The commands of the parallel
+    // builtin are limited by the builtin itself
+    if (new_job && background && sched_limit > 0 && active_batch == NULL &&
+        get_running_job_count(job_list) >= sched_limit) {
+        queued_pipeline_t *queued =
+            (queued_pipeline_t *)malloc(sizeof(queued_pipeline_t));
+        queued->arena = init_parse_arena_sized(1024);
+        expand_command(queued->arena, command, &queued->command, get_variable);
+
+        // Resolving a stage leaves only the last part of its path in argv[0],
+        // so each stage is given the whole path it was resolved to
+        index = 0;
+        for (stage = &queued->command; stage != NULL;
+             stage = stage->next_stage) {
+            size_t length = strlen(file_paths[index]) + 1;
+            stage->argv[0] = (char *)arena_alloc(queued->arena, length);
+            memcpy(stage->argv[0], file_paths[index], length);
+            index++;
+        }
+        queue_job(job_list, jid, priority, job_command, queued,
+                  free_queued_pipeline);
+        printf("[%d] Queued\n", jid);
+        job_id++;
+        set_last_status(0);
+        free(file_paths);
+        free(hashed);
+        free(job_command);
+        return 1;
+    }
+
+    // This starts each stage in turn without waiting for any of them, reading
+    // from the pipe the previous stage writes to. If a stage fails to start,
+    // an error message has already been printed, and the stages around it
+    // see the end of their pipes. The launch time is recorded for the
+    // resource accounting
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = 1;
+    int launch_error = 0;
+    pid_t pgid = 0;
+    int input_fd = -1;
+    index = 0;
+
+    // While output is being captured, a background job is started with the
+    // shell's standard output and error pointing at the pipe of its capture,
+    // so that every stage of the job writes there, apart from the pipes
+    // between its stages and its redirects. The shell's own are put back
+    // once the job has been started
+    int saved_fds[2];
+    int capture_fd = -1;
+    if (background && capture_output && active_batch == NULL &&
+        (capture_fd = start_capture(capture_set, jid)) != -1 &&
+        swap_output(capture_fd, saved_fds) == -1) {
+        close(capture_fd);
+        capture_fd = -1;
+    }
+    for (stage = command; stage != NULL; stage = stage->next_stage) {
+        int pipe_fds[2] = {-1, -1};
+        if (stage->next_stage != NULL && pipe2(pipe_fds, O_CLOEXEC) == -1) {
+            perror("pipe");
+            result = -1;
+            break;
+        }
+
+        pid_t child_pid =
+            launch_stage(stage, file_paths[index], sizeof(file_paths[index]),
+                         hashed[index], background, pgid, input_fd,
+                         pipe_fds[1]);
+        index++;
+
+        // The shell's copies of the pipe ends are closed as soon as the
+        // stages that use them have been started
+        if (input_fd != -1) {
+            close(input_fd);
+        }
+        if (pipe_fds[1] != -1) {
+            close(pipe_fds[1]);
+        }
+        input_fd = pipe_fds[0];
+
+        if (child_pid == -1) {
+            launch_error = errno;
+            result = -1;
+            continue;
+        }
+
+        // The first stage to start becomes the job, and leads its group
+        if (pgid == 0) {
+            pgid = child_pid;
+            add_job(job_list, jid, child_pid, RUNNING, job_command);
+            set_job_start_pid(job_list, child_pid, &start);
+            if (get_job_count(job_list) > shell_stats.peak_jobs) {
+                shell_stats.peak_jobs = get_job_count(job_list);
+            }
+        } else {
+            add_job_process(job_list, jid, child_pid);
+        }
+    }
+    if (input_fd != -1) {
+        close(input_fd);
+    }
+    if (capture_fd != -1) {
+        swap_output(-1, saved_fds);
+        close(capture_fd);
+    }
+
+    if (pgid == 0) {
+        free(file_paths);
+        free(hashed);
+        free(job_command);
+        set_last_status(exec_failure_status(launch_error));
+        return -1;
+    }
+
+    // This prints out the job id and the process id of any job that was started
+    // in the background
+    if (background) {
+        // A command started by the parallel builtin takes a free slot in the
+        // batch instead of being announced
+        if (active_batch != NULL) {
+            int slot = 0;
+            while (active_batch->pids[slot] != 0) {
+                slot++;
+            }
+            active_batch->pids[slot] = pgid;
+            active_batch->jids[slot] = jid;
+            active_batch->lines[slot] = active_batch->pending_line;
+            active_batch->pending_line = NULL;
+            active_batch->running++;
+        } else {
+            printf("[%d] (%d)\n", jid, pgid);
+        }
+        if (priority != 0 &&
+            setpriority(PRIO_PGRP, (id_t)pgid, priority) == -1) {
+            perror("setpriority");
+        }
+        if (new_job) {
+            job_id++;
+        }
+        set_last_status(0);
+
+        // If the process was launched in the foreground, the shell waits for it
+        // to finish execution before continuing the REPL
+    } else {
+        int status = 0;
+        struct rusage usage;
+
+        // The wait collects the resources the job used along with its status
+        TRACE_BEGIN("wait");
+        wait_foreground_job(job_list, jid, &status, &usage);
+        TRACE_END("wait");
+        set_last_status(exit_status(status));
+
+        if (!WIFSTOPPED(status)) {
+            foreground_usage = usage;
+            foreground_start = start;
+            foreground_usage_valid = 1;
+        }
+
+        // Setting the shell  to be the foreground process by changing
+        // the process group ID of standard input to that of the shell
+        TRACE_BEGIN("tcsetpgrp");
+        if (interactive && tcsetpgrp(0, getpgrp()) == -1) {
+            perror("tcsetpgrp");
+            result = -1;
+        }
+        TRACE_END("tcsetpgrp");
+
+        // A remembered path is forgotten once the child has reported that
+        // its exec could not find the file. The failure is only known for
+        // the last launch, which is the only stage of a single command, and
+        // is counted when the launch is collected
+        if (stage_count == 1 && hashed[0] && get_exec_failure() == ENOENT) {
+            forget_command(command_hash, command->argv[0]);
+        }
+
+        // If the process was terminated by a signal, the job ID and the process
+        // ID of the process are printed to the terminal
+        if (WIFSIGNALED(status)) {
+            char usage_string[256];
+            format_usage(usage_string, sizeof(usage_string), &start, NULL,
+                         &usage);
+            printf("[%d] (%d) terminated by signal %d (%s)\n", jid, pgid,
+                   WTERMSIG(status), usage_string);
+            job_id += new_job;
+        }
+
+        // If the process was stopped by a signal, the job ID and the process ID
+        // of the process are printed to the terminal. The job stays in the
+        // job list
+
+        if (WIFSTOPPED(status)) {
+            printf("[%d] (%d) suspended by signal %d\n", jid, pgid,
+                   WSTOPSIG(status));
+            job_id += new_job;
+        }
+    }
+
+    free(file_paths);
+    free(hashed);
+    free(job_command);
+    return result;
+}
+
+// This function is used to free a queued pipeline, along with its arena
+
+void free_queued_pipeline(void *data) {
+    queued_pipeline_t *queued = (queued_pipeline_t *)data;
+    cleanup_parse_arena(queued->arena);
+    free(queued);
+}
+
+// This function is used to start a queued job, given its JID, or the queued
+// job that comes next if jid is -1, in the background or in the foreground,
+// under its own job ID and with its own priority. It returns the result of
+// run_executable, and -1 if there is no such queued job
+
+int run_queued_job(job_list_t *job_list, int jid, int background) {
+    int priority = 0;
+    queued_pipeline_t *queued = (queued_pipeline_t *)take_queued_job(
+        job_list, jid, &jid, &priority);
+    if (queued == NULL) {
+        return -1;
+    }
+
+    queued->command.background = background;
+    int result = run_executable(&queued->command, job_list, jid, priority);
+    free_queued_pipeline(queued);
+    return result;
+}
+
+// This function is used to start queued jobs, in order of priority, for as
+// long as fewer background jobs are running than the scheduler allows. It is
+// called once running jobs have been reaped, and when the limit changes, but
+// never while the parallel builtin runs, which takes every background job
+// that is started. foreground is the number of running jobs that are in the
+// foreground, which take no slot
+
+void start_queued_jobs(job_list_t *job_list, int foreground) {
+    if (active_batch != NULL) {
+        return;
+    }
+
+    while (get_queued_job_count(job_list) > 0 &&
+           (sched_limit == 0 ||
+            get_running_job_count(job_list) - foreground < sched_limit)) {
+        run_queued_job(job_list, -1, 1);
+    }
+}
+
+// This function is used to report the end of a command started by the
+// parallel builtin, and to free its slot in the batch so that the next command
+// can be started. It returns 1 if the child was such a command and has
+// terminated, and 0 otherwise
+
+int finish_parallel_command(job_list_t *job_list, pid_t child_pid,
+                            int status) {
+    if (active_batch == NULL || !(WIFEXITED(status) || WIFSIGNALED(status))) {
+        return 0;
+    }
+
+    // The slot is found by JID, since any process of a pipeline may be the
+    // one that has terminated
+    int jid = get_job_jid(job_list, child_pid);
+    int slot = 0;
+    while (slot < active_batch->limit &&
+           (active_batch->pids[slot] == 0 || active_batch->jids[slot] != jid)) {
+        slot++;
+    }
+    if (jid == -1 || slot == active_batch->limit) {
+        return 0;
+    }
 
-    // This calls the fork command, creating a new child process with the file
-    // path and the argument vector. If it fails, an error message is printed
-    // and the child process exits If it succeeds, the parent resumes execution
-    // upon completion.
-    pid_t child_pid;
+    // A pipeline has only finished once its last process has terminated
+    if (finish_job_process(job_list, child_pid, &status, NULL) > 0) {
+        return 1;
+    }
+    child_pid = active_batch->pids[slot];
 
-    if ((child_pid = fork()) == 0) {
-        // Setting the process group ID of the child process to its process ID
-        if (setpgid(0, 0) == -1) {
-            perror("setpgid");
-            exit(1);
+    if (WIFEXITED(status)) {
+        printf("[%d] (%d) exit status %d: %s\n", active_batch->jids[slot],
+               child_pid, WEXITSTATUS(status), active_batch->lines[slot]);
+        if (WEXITSTATUS(status) != 0) {
+            active_batch->failed++;
         }
+    } else {
+        printf("[%d] (%d) terminated by signal %d: %s\n",
+               active_batch->jids[slot], child_pid, WTERMSIG(status),
+               active_batch->lines[slot]);
+        active_batch->failed++;
+    }
 
-        // If the & specifier was included when executing the program, the
-        // program is run in the background.
-        if (strcmp(argv[*argc - 1], "&") == 0) {
-            // Removing the & symbol from the argv array
-            argv[*argc - 1] = NULL;
-            (*argc)--;
-
-            // Setting the child process to be the foreground process by
-            // changing the process group ID of standard input to that of the
-            // child, if the & specifier was not included
+    remove_job_jid(job_list, jid);
+    free(active_batch->lines[slot]);
+    active_batch->lines[slot] = NULL;
+    active_batch->pids[slot] = 0;
+    active_batch->running--;
+    return 1;
+}
 
-        } else {
-            if (tcsetpgrp(0, getpgrp()) == -1) {
-                perror("tcsetpgrp");
-                exit(1);
-            }
+// This function is used to run the parallel builtin, "parallel [-j N] [file]".
+// It reads commands one per line from the file, or from standard input, and
+// runs each as a background job, keeping N of them running at once and
+// starting the next as soon as one finishes. The exit status of every command
+// is printed as it finishes, followed by a summary of the whole batch. It
+// returns 1 if every command succeeded, and -1 otherwise
+
+int run_parallel(char *argv[], job_list_t *job_list) {
+    long limit = sysconf(_SC_NPROCESSORS_ONLN);
+    char *file = NULL;
+    char *limit_end = NULL;
+    int arg = 1;
+
+    // Checking the arguments, which are an optional limit and an optional file
+    if (argv[arg] != NULL && strcmp(argv[arg], "-j") == 0) {
+        if (argv[arg + 1] == NULL ||
+            (limit = strtol(argv[arg + 1], &limit_end, 10)) <= 0 ||
+            *limit_end != '\0' || limit > INT_MAX) {
+            fprintf(stderr, "%s", "parallel: -j needs a positive number\n");
+            return -1;
         }
+        arg += 2;
+    }
+    if (argv[arg] != NULL) {
+        file = argv[arg++];
+    }
+    if (argv[arg] != NULL || limit <= 0) {
+        fprintf(stderr, "%s", "parallel: syntax error\n");
+        return -1;
+    }
 
-        // Restoring signal functionality in the child process
-        restore_signals();
+    // A slot is allocated for every command that may run at once, so the
+    // limit is capped at far more than the shell could run in practice
+    if (limit > PARALLEL_MAX_LIMIT) {
+        limit = PARALLEL_MAX_LIMIT;
+    }
+
+    // Commands are read from the file through a reader of their own, or from
+    // the shell's own reader, so that no buffered input is lost
+    line_reader_t *reader = input_reader;
+    int fd = -1;
+    if (file != NULL) {
+        if ((fd = open(file, O_RDONLY | O_CLOEXEC)) == -1) {
+            perror("parallel");
+            return -1;
+        }
+        reader = init_line_reader(fd);
+    }
 
-        // This handles the input  redirection. If the input redirection index
-        // in the redirect array is not NULL, the input is redirected to the
-        // specified file. If this fails, an error is printed and the function
-        // exits
-        if (redirect[INPUT_REDIRECTION] != NULL) {
-            // Closing the current open file descriptor of stdin
-            close(0);
-
-            // Opening the specified INPUT_REDIRECTION_FILE, and printing an
-            // error message if it does not exist while also exiting from the
-            // program,
-            if (open(redirect[INPUT_REDIRECTION_FILE], O_RDONLY) == -1) {
-                perror(buffer_pointer);
-                exit(1);
+    // Each line is parsed into an arena of its own, since the parallel
+    // command itself still lives in the shell's arena
+    parse_arena_t *arena = init_parse_arena();
+    parallel_batch_t batch;
+    batch.limit = (int)limit;
+    batch.running = 0;
+    batch.started = 0;
+    batch.failed = 0;
+    batch.pending_line = NULL;
+    batch.pids = (pid_t *)calloc((size_t)limit, sizeof(pid_t));
+    batch.jids = (int *)calloc((size_t)limit, sizeof(int));
+    batch.lines = (char **)calloc((size_t)limit, sizeof(char *));
+    active_batch = &batch;
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char *line = NULL;
+    size_t line_length = 0;
+    while (1) {
+        // Waiting for a slot before reading the next line
+        while (batch.running >= batch.limit) {
+            if (wait_for_children(job_list) == -1) {
+                break;
             }
         }
 
-        // This handles input redirection for >. If the output in the redirect
-        // array is this token, the output is redirected to the specified file.
-        // If this fails, an error is printed and the function exits
+        if (read_line(reader, &line, &line_length) != 1) {
+            break;
+        }
 
-        if (redirect[OUTPUT_REDIRECTION] != NULL) {
-            if (strcmp(redirect[OUTPUT_REDIRECTION], ">") == 0) {
-                // Closing the current open file descriptor of stdout
-                close(1);
+        command_t command;
+        reset_parse_arena(arena);
+        int parse_result = parse_command(arena, line, line_length, &command);
+        if (parse_result == -1 || command.argc == 0) {
+            batch.failed += parse_result == -1;
+            continue;
+        }
+        if (command.next_command != NULL) {
+            fprintf(stderr, "%s", "parallel: one command per line\n");
+            batch.failed++;
+            continue;
+        }
+        if (command.expand) {
+            command_t parsed = command;
+            expand_command(arena, &parsed, &command, get_variable);
+        }
 
-                // Opening the specified OUTPUT_REDIRECTION_FILE, and printing
-                // an error message if there is an error in this function. An
-                // error also causes program termination
-                if (open(redirect[OUTPUT_REDIRECTION_FILE],
-                         O_RDWR | O_TRUNC | O_CREAT, 0777) == -1) {
-                    perror(buffer_pointer);
-                    exit(1);
-                }
-            }
+        // The commands run in the background, and read from /dev/null unless
+        // they redirect their input, so that none of them can take the
+        // commands that are still to be read
+        command.background = 1;
+        if (command.redirect[INPUT_REDIRECTION] == NULL) {
+            command.redirect[INPUT_REDIRECTION] = "<";
+            command.redirect[INPUT_REDIRECTION_FILE] = "/dev/null";
+        }
 
-            if (strcmp(redirect[OUTPUT_REDIRECTION], ">>") == 0) {
-                // Closing the current open file descriptor of stdout
-                close(1);
-
-                // Opening the specified OUTPUT_REDIRECTION_FILE, and printing
-                // an error message if there is an error in this function. An
-                // error also causes program termination
-                if (open(redirect[OUTPUT_REDIRECTION_FILE],
-                         O_RDWR | O_APPEND | O_CREAT, 0777) == -1) {
-                    perror(buffer_pointer);
-                    exit(1);
-                }
-            }
+        batch.pending_line = strdup(line);
+        batch.started++;
+        if (run_executable(&command, job_list, 0, sched_priority) == -1) {
+            batch.failed++;
         }
-        execv(file_path, argv);
+        free(batch.pending_line);
+        batch.pending_line = NULL;
+    }
 
-        // This handles the case in which the execv command fails to execute
-        perror("execv");
-        exit(1);
+    // Waiting for the commands that are still running
+    while (batch.running > 0) {
+        if (wait_for_children(job_list) == -1) {
+            break;
+        }
     }
 
-    // This prints out the job id and the process id of any job that was started
-    // in the background, checking the argv array to determine if the program
-    // was launched in the background
-    if (strcmp(argv[(*argc) - 1], "&") == 0) {
-        add_job(job_list, job_id, child_pid, RUNNING, file_path);
-        printf("[%d] (%d)\n", job_id, child_pid);
-        job_id++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) +
+                     (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("parallel: %d commands, %d failed, %.3fs, %.1f commands/s\n",
+           batch.started, batch.failed, seconds,
+           seconds > 0 ? batch.started / seconds : 0);
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "Error printing status\n");
+    }
 
-        // If the process was launched in the foreground, the shell waits for it
-        // to finish execution before continuing the REPL
-    } else {
-        int status;
+    active_batch = NULL;
+    free(batch.pids);
+    free(batch.jids);
+    free(batch.lines);
+    cleanup_parse_arena(arena);
+    if (file != NULL) {
+        cleanup_line_reader(reader);
+        close(fd);
+    }
 
-        if (waitpid(child_pid, &status, WUNTRACED) == -1) {
-            perror("wait");
-        }
+    return batch.failed == 0 ? 1 : -1;
+}
 
-        // Setting the shell  to be the foreground process by changing
-        // the process group ID of standard input to that of the shell
-        if (tcsetpgrp(0, getpgrp()) == -1) {
-            perror("tcsetpgrp");
+// This function is used to run the cat and tee builtins, "cat [file ...]" and
+// "tee [-a] [file ...]". The input redirect replaces standard input, and the
+// output redirect replaces standard output, exactly as for an executable. The
+// data is copied by fileops without passing through user space wherever the
+// kernel allows it. It returns 1 if the command succeeded, and -1 otherwise
+
+int run_file_builtin(char *argv[], char *redirect[]) {
+    int in_fd = 0;
+    int out_fd = 1;
+    int result = 0;
+
+    // The redirect files are opened the same way launch_fork opens them
+    if (redirect[INPUT_REDIRECTION] != NULL &&
+        (in_fd = open(redirect[INPUT_REDIRECTION_FILE],
+                      O_RDONLY | O_CLOEXEC)) == -1) {
+        perror(argv[0]);
+        return -1;
+    }
+    if (redirect[OUTPUT_REDIRECTION] != NULL) {
+        int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+        flags |= strcmp(redirect[OUTPUT_REDIRECTION], ">>") == 0 ? O_APPEND
+                                                                 : O_TRUNC;
+        if ((out_fd = open(redirect[OUTPUT_REDIRECTION_FILE], flags, 0777)) ==
+            -1) {
+            perror(argv[0]);
+            if (in_fd != 0) {
+                close(in_fd);
+            }
             return -1;
         }
+    }
 
-        // If the process was terminated by a signal, the job ID and the process
-        // ID of the process are printed to the terminal
-        if (WIFSIGNALED(status)) {
-            printf("[%d] (%d) terminated by signal %d\n", job_id, child_pid,
-                   WTERMSIG(status));
-            job_id++;
-        }
-
-        // If the process was stopped by a signal, the job ID and the process ID
-        // of the process are printed to the terminal. The job is then added
-        // to the job list
+    // Anything the shell has buffered for standard output is written first,
+    // since the builtins write to the descriptor directly
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "Error printing output\n");
+    }
 
-        if (WIFSTOPPED(status)) {
-            printf("[%d] (%d) suspended by signal %d\n", job_id, child_pid,
-                   WSTOPSIG(status));
-            add_job(job_list, job_id, child_pid, STOPPED, file_path);
-            job_id++;
-        }
+    if (strcmp(argv[0], "cat") == 0) {
+        result = cat_files(argv + 1, in_fd, out_fd);
+    } else if (argv[1] != NULL && strcmp(argv[1], "-a") == 0) {
+        result = tee_files(argv + 2, 1, in_fd, out_fd);
+    } else {
+        result = tee_files(argv + 1, 0, in_fd, out_fd);
     }
 
-    return 1;
+    if (in_fd != 0) {
+        close(in_fd);
+    }
+    if (out_fd != 1) {
+        close(out_fd);
+    }
+    return result == -1 ? -1 : 1;
 }
 
 // This function is used to check the argument array for built in commands. If
@@ -393,18 +2172,60 @@ int run_executable(char *argv[], char *redirect[], int *argc,
 // number of arguments passed in, the function returns with code -1 and prints
 // an error message. If the given argument is not a built-in command, the
 // function assumes that it is a path to an executable and returns with code 0.
+// The redirects only apply to the built in commands that read or write files
 
-int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
+int execute_built_in_commmands(char *argv[], int *argc, char *redirect[],
+                               job_list_t *job_list) {
     if (*argc == 0) {
         fprintf(stderr, "%s", "redirects with no command\n");
         return -1;
     }
 
     // This exits the shell if the exit command was passed in as the first
-    // argument to the argv array
+    // argument to the argv array, with the given exit status, or that of the
+    // last command if there is none
     if (strcmp(argv[0], "exit") == 0) {
-        cleanup_job_list(job_list);
-        exit(0);
+        int status = argv[1] != NULL ? atoi(argv[1]) : get_last_status();
+
+        // In server mode, exit ends the connection, not the server
+        if (active_session != NULL) {
+            active_session->closing = 1;
+            set_last_status(status);
+            return 1;
+        }
+        cleanup_shell(job_list);
+        exit(status);
+    }
+
+    // This checks if the command is "exec". With a command, the shell is
+    // replaced by it, and with nothing but redirects, they are applied to the
+    // shell's own standard input and output, for every command that follows.
+    // If a script's command cannot be started, the script ends, as it would
+    // in other shells
+    if (strcmp(argv[0], "exec") == 0) {
+        if (*argc == 1) {
+            return apply_redirects(redirect, "exec") == -1 ? -1 : 1;
+        }
+
+        if (active_session != NULL) {
+            fprintf(stderr, "%s", "exec: not available in server mode\n");
+            return -1;
+        }
+
+        command_t exec_command;
+        memset(&exec_command, 0, sizeof(exec_command));
+        exec_command.argv = argv + 1;
+        exec_command.argc = *argc - 1;
+        exec_command.argv_capacity = *argc;
+        memcpy(exec_command.redirect, redirect, sizeof(exec_command.redirect));
+        exec_in_place(&exec_command);
+
+        if (active_script != NULL) {
+            int status = get_last_status();
+            cleanup_shell(job_list);
+            exit(status);
+        }
+        return -1;
     }
 
     // This checks if the command is "cd". If it is, it first error checks to
@@ -432,27 +2253,26 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
     }
 
     // This checks if the command is "rm". If it is, it first error checks to
-    // ensure that there is an argument representing the directory inputed by
-    // the user. If there is not, it returns an error and exits with 0. If
-    // there is, it attempts to remove the specified file
+    // ensure that there is at least one argument representing a file to
+    // remove. If there is not, it returns an error. If there is, it attempts
+    // to remove each of the specified files, and with -r each of the
+    // specified directories along with everything in them
     if (strcmp(argv[0], "rm") == 0) {
-        if (argv[1] == NULL) {
+        int recursive = argv[1] != NULL && strcmp(argv[1], "-r") == 0;
+        if (argv[1 + recursive] == NULL) {
             fprintf(stderr, "%s", "rm: syntax error\n");
             return -1;
         }
 
-        // The unlink system call is executed. If a valid path was input by
-        // the user, the specified file will be removed and
-        // execute_built_in_commands returns 1. If a valid directory was not
-        // input by the user, the appropriate error message is printed and a -1
-        // is returned to the user
-
-        if (unlink(argv[1]) == -1) {
-            perror("rm");
+        // The files are removed with unlink, and the directory trees are
+        // walked and removed by a pool of threads, one for each CPU. The
+        // errors are printed as they happen, and a -1 is returned to the user
+        // if any file could not be removed
+        if (remove_paths(argv + 1 + recursive, recursive, 0) == -1) {
             return -1;
         }
 
-        // Returning a 1 if the file was successfully removed
+        // Returning a 1 if the files were successfully removed
         return 1;
     }
 
@@ -478,19 +2298,264 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
         return 1;
     }
 
+    // This checks if the command is "cp". If it is, it first error checks to
+    // ensure that there is at least one source and a destination, after an
+    // optional -j giving the number of files to copy at once. If there are
+    // not, it returns an error. If there are, it attempts to copy each source
+    // to the destination
+    if (strcmp(argv[0], "cp") == 0) {
+        int first = 1;
+        long threads = 1;
+        if (argv[1] != NULL && strcmp(argv[1], "-j") == 0) {
+            if (argv[2] == NULL || (threads = strtol(argv[2], NULL, 10)) <= 0) {
+                fprintf(stderr, "%s", "cp: -j needs a positive number\n");
+                return -1;
+            }
+            first = 3;
+        }
+        if (*argc - first < 2) {
+            fprintf(stderr, "%s", "cp: syntax error\n");
+            return -1;
+        }
+
+        // The copies are made by fileops, which prints any errors
+        if (copy_files(argv + first, *argc - first - 1, argv[*argc - 1],
+                       (int)threads) == -1) {
+            return -1;
+        }
+
+        // Returning a 1 if the files were successfully copied
+        return 1;
+    }
+
+    // This checks if the command is "cat" or "tee". Both copy data inside
+    // the shell process, honouring the < and > redirects
+    if (strcmp(argv[0], "cat") == 0 || strcmp(argv[0], "tee") == 0) {
+        return run_file_builtin(argv, redirect);
+    }
+
+    // This checks if the command is "launch". With no argument it prints the
+    // current launch mode, otherwise it selects whether children are started
+    // with fork, with posix_spawn, or by the launcher
+    if (strcmp(argv[0], "launch") == 0) {
+        if (argv[1] == NULL) {
+            printf("%s\n", launch_mode == LAUNCH_ZYGOTE  ? "zygote"
+                           : launch_mode == LAUNCH_SPAWN ? "spawn"
+                                                         : "fork");
+            return 1;
+        }
+
+        if (argv[2] != NULL) {
+            fprintf(stderr, "%s", "launch: syntax error\n");
+            return -1;
+        }
+
+        if (strcmp(argv[1], "fork") == 0) {
+            launch_mode = LAUNCH_FORK;
+        } else if (strcmp(argv[1], "spawn") == 0) {
+            launch_mode = LAUNCH_SPAWN;
+        } else if (strcmp(argv[1], "zygote") == 0) {
+            if (launcher == NULL && (launcher = start_launcher()) == NULL) {
+                fprintf(stderr, "%s", "launch: cannot start the launcher\n");
+                return -1;
+            }
+            launch_mode = LAUNCH_ZYGOTE;
+        } else {
+            fprintf(stderr, "%s",
+                    "launch: mode must be fork, spawn or zygote\n");
+            return -1;
+        }
+
+        return 1;
+    }
+
+    // This checks if the command is "sched". "sched <n>" lets no more than n
+    // background jobs run at once, queueing the rest, or any number if n is
+    // 0, and "sched -p <nice>" sets the nice value of the background jobs
+    // started from then on, from -20 to 19, which also orders the queue. With
+    // no arguments it prints the limit, the running and queued jobs, and the
+    // nice value
+    if (strcmp(argv[0], "sched") == 0) {
+        char *end = NULL;
+        if (argv[1] == NULL) {
+            if (sched_limit > 0) {
+                printf("limit %d", sched_limit);
+            } else {
+                printf("limit none");
+            }
+            printf(", running %d, queued %d, nice %d\n",
+                   get_running_job_count(job_list),
+                   get_queued_job_count(job_list), sched_priority);
+            return 1;
+        }
+
+        if (strcmp(argv[1], "-p") == 0 && argv[2] != NULL &&
+            argv[3] == NULL) {
+            long priority = strtol(argv[2], &end, 10);
+            if (*end != '\0' || end == argv[2] || priority < -20 ||
+                priority > 19) {
+                fprintf(stderr, "%s", "sched: syntax error\n");
+                return -1;
+            }
+            sched_priority = (int)priority;
+            return 1;
+        }
+
+        long limit = strtol(argv[1], &end, 10);
+        if (argv[2] != NULL || *end != '\0' || end == argv[1] || limit < 0 ||
+            limit > INT_MAX) {
+            fprintf(stderr, "%s", "sched: syntax error\n");
+            return -1;
+        }
+        sched_limit = (int)limit;
+
+        // A higher limit, or none, lets queued jobs start straight away
+        start_queued_jobs(job_list, 0);
+        return 1;
+    }
+
+    // This checks if the command is "capture". "capture on" sends the output
+    // of the background jobs started from then on to a ring buffer for each
+    // job, instead of the terminal, and "capture off" stops doing so. With
+    // no arguments it prints whether output is being captured
+    if (strcmp(argv[0], "capture") == 0) {
+        if (argv[1] == NULL) {
+            printf("%s\n", capture_output ? "on" : "off");
+        } else if (strcmp(argv[1], "on") == 0 && argv[2] == NULL) {
+            // The sessions of the server share job IDs, which name captures
+            if (active_session != NULL) {
+                fprintf(stderr, "%s",
+                        "capture: not available in server mode\n");
+                return -1;
+            }
+            if (capture_set == NULL) {
+                capture_set = init_capture_set(CAPTURE_SIZE);
+            }
+            capture_output = 1;
+        } else if (strcmp(argv[1], "off") == 0 && argv[2] == NULL) {
+            capture_output = 0;
+        } else {
+            fprintf(stderr, "%s", "capture: syntax error\n");
+            return -1;
+        }
+        return 1;
+    }
+
+    // This checks if the command is "joblog". "joblog %<job>" prints the
+    // output captured for the job, as much of it as its ring buffer holds,
+    // and with no arguments it lists the captured jobs
+    if (strcmp(argv[0], "joblog") == 0) {
+        if (argv[1] != NULL && (argv[1][0] != '%' || argv[2] != NULL)) {
+            fprintf(stderr, "%s", "joblog: syntax error\n");
+            return -1;
+        }
+        if (capture_set == NULL) {
+            if (argv[1] != NULL) {
+                fprintf(stderr, "%s", "joblog: no output captured\n");
+                return -1;
+            }
+            return 1;
+        }
+
+        drain_captures(capture_set);
+        if (argv[1] == NULL) {
+            list_captures(capture_set);
+            return 1;
+        }
+        fflush(stdout);
+        if (print_capture(capture_set, atoi(argv[1] + 1), 1) == -1) {
+            fprintf(stderr, "%s", "joblog: no output captured\n");
+            return -1;
+        }
+        return 1;
+    }
+
+    // This checks if the command is "shstat", which prints the counters the
+    // shell keeps as it runs, one per line, or as JSON with "shstat -j"
+    if (strcmp(argv[0], "shstat") == 0) {
+        if (argv[1] == NULL) {
+            print_stats(0);
+        } else if (strcmp(argv[1], "-j") == 0 && argv[2] == NULL) {
+            print_stats(1);
+        } else {
+            fprintf(stderr, "%s", "shstat: syntax error\n");
+            return -1;
+        }
+        return 1;
+    }
+
+    // This checks if the command is "cache". With no arguments it prints the
+    // number of lines in the parse cache and its hit rate, and "cache -c"
+    // empties it
+    if (strcmp(argv[0], "cache") == 0) {
+        if (argv[1] == NULL) {
+            print_parse_cache(parse_cache);
+        } else if (strcmp(argv[1], "-c") == 0 && argv[2] == NULL) {
+            clear_parse_cache(parse_cache);
+        } else {
+            fprintf(stderr, "%s", "cache: syntax error\n");
+            return -1;
+        }
+        return 1;
+    }
+
+    // This checks if the command is "hash". With no arguments it prints the
+    // remembered command paths, "hash -r" forgets all of them, and any other
+    // arguments are command names to look up and remember
+    if (strcmp(argv[0], "hash") == 0) {
+        if (argv[1] == NULL) {
+            print_command_hash(command_hash);
+            return 1;
+        }
+
+        if (strcmp(argv[1], "-r") == 0) {
+            if (argv[2] != NULL) {
+                fprintf(stderr, "%s", "hash: syntax error\n");
+                return -1;
+            }
+            clear_command_hash(command_hash);
+            return 1;
+        }
+
+        int result = 1;
+        for (int i = 1; argv[i] != NULL; i++) {
+            // Forgetting the command first makes hash re-resolve its path
+            forget_command(command_hash, argv[i]);
+            if (strchr(argv[i], '/') != NULL ||
+                lookup_command(command_hash, argv[i]) == NULL) {
+                fprintf(stderr, "hash: %s: not found\n", argv[i]);
+                result = -1;
+            }
+        }
+        return result;
+    }
+
+    // This checks if the command is "parallel". If it is, the commands it
+    // reads are run with a bounded number of them running at once
+    if (strcmp(argv[0], "parallel") == 0) {
+        return run_parallel(argv, job_list);
+    }
+
     // This checks if the command is "jobs". If it is, it first error checks
     // to ensure that there are no other commands besides "jobs" input
     // into the terminal. If the error-checking passes, the jobs are printed
     // to standard output
 
     if (strcmp(argv[0], "jobs") == 0) {
-        if (argv[1] != NULL) {
+        // The only flag accepted is -l, which also lists the time each job
+        // has been running and the resources it has used so far
+        if (argv[1] != NULL &&
+            (strcmp(argv[1], "-l") != 0 || argv[2] != NULL)) {
             fprintf(stderr, "%s", "jobs: syntax error\n");
             return -1;
         }
 
         // Calling the jobs function if there was no error
-        jobs(job_list);
+        if (argv[1] != NULL) {
+            jobs_long(job_list);
+        } else {
+            jobs(job_list);
+        }
         return 1;
     }
 
@@ -523,6 +2588,11 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
 
         child_job_id = atoi(job_id_number + 1);
 
+        // A queued job is started in the background now, ahead of the queue
+        if (get_job_state_jid(job_list, child_job_id) == QUEUED) {
+            return run_queued_job(job_list, child_job_id, 1);
+        }
+
         // Checking to ensure that a valid job_id was input
         if ((child_pid = get_job_pid(job_list, child_job_id)) == -1) {
             fprintf(stderr, "%s", "job not found\n");
@@ -532,7 +2602,16 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
         // This sends the SIGCONT signal to the entire process group in
         // question, then updates the status in the jobs list
 
-        kill(-child_pid, SIGCONT);
+        if (signal_job_pid(job_list, child_pid, SIGCONT) == -1) {
+            perror("bg");
+            return -1;
+        }
+
+        // The job is reported as resumed here, rather than once for each of
+        // its processes as they report that they have continued
+        if (get_job_state_pid(job_list, child_pid) == STOPPED) {
+            printf("[%d] (%d) resumed\n", child_job_id, child_pid);
+        }
         update_job_pid(job_list, child_pid, RUNNING);
         return 1;
     }
@@ -566,6 +2645,11 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
 
         child_job_id = atoi(job_id_number + 1);
 
+        // A queued job is started in the foreground now, ahead of the queue
+        if (get_job_state_jid(job_list, child_job_id) == QUEUED) {
+            return run_queued_job(job_list, child_job_id, 0);
+        }
+
         // Checking to ensure that a valid job_id was input
         if ((child_pid = get_job_pid(job_list, child_job_id)) == -1) {
             fprintf(stderr, "%s", "job not found\n");
@@ -574,50 +2658,74 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
 
         // This sends the SIGCONT signal to the entire process group in
         // question,
-        kill(-child_pid, SIGCONT);
+        if (signal_job_pid(job_list, child_pid, SIGCONT) == -1) {
+            perror("fg");
+            return -1;
+        }
+        update_job_jid(job_list, child_job_id, RUNNING);
 
-        // This sets the foreground process to be the resumed process group
-        if (tcsetpgrp(0, getpgid(child_pid)) == -1) {
+        // This sets the foreground process to be the resumed process group,
+        // whose ID is the PID of the job's first process
+        if (interactive && tcsetpgrp(0, child_pid) == -1) {
             perror("tcsetpgrp");
             return -1;
         }
 
-        // This uses waitpid to wait for the child process to complete execution
-        // before continuing
-        int status;
-        if (waitpid(child_pid, &status, WUNTRACED) == -1) {
-            perror("wait");
+        // If the job's output has been captured, the output kept so far is
+        // written out first, and the rest is written out as it arrives
+        int relayed = 0;
+        if (capture_set != NULL) {
+            fflush(stdout);
+            drain_captures(capture_set);
+            relayed = print_capture(capture_set, child_job_id, 1) == 0 &&
+                      relay_capture(capture_set, child_job_id, 1) == 0;
+        }
+
+        // This waits for every process of the job to complete execution
+        // before continuing, through the job's process group so that the wait
+        // can only ever collect this job
+        int status = 0;
+        struct rusage usage;
+        struct timespec start;
+        get_job_start_pid(job_list, child_pid, &start);
+        wait_foreground_job(job_list, child_job_id, &status, &usage);
+        set_last_status(exit_status(status));
+        if (relayed) {
+            drain_captures(capture_set);
+            relay_capture(capture_set, child_job_id, 0);
+        }
+
+        if (!WIFSTOPPED(status)) {
+            foreground_usage = usage;
+            foreground_start = start;
+            foreground_usage_valid = 1;
         }
 
         // Setting the shell  to be the foreground process by changing
         // the process group ID of standard input to that of the shell
-        if (tcsetpgrp(0, getpgrp()) == -1) {
+        if (interactive && tcsetpgrp(0, getpgrp()) == -1) {
             perror("tcsetpgrp");
             return -1;
         }
 
         // If the process was terminated by a signal, the job ID and the process
-        // ID of the process are printed to the terminal
+        // ID of the process are printed to the terminal. A job that has
+        // terminated has already been removed from the job list
         if (WIFSIGNALED(status)) {
-            printf("[%d] (%d) terminated by signal %d\n", child_job_id,
-                   child_pid, WTERMSIG(status));
-            remove_job_pid(job_list, child_pid);
+            char usage_string[256];
+            format_usage(usage_string, sizeof(usage_string), &start, NULL,
+                         &usage);
+            printf("[%d] (%d) terminated by signal %d (%s)\n", child_job_id,
+                   child_pid, WTERMSIG(status), usage_string);
         }
 
         // If the process was stopped by a signal, the job ID and the process ID
-        // of the process are printed to the terminal. The job is then added
-        // to the job list
+        // of the process are printed to the terminal. The job stays in the
+        // job list, marked as stopped
 
         if (WIFSTOPPED(status)) {
             printf("[%d] (%d) suspended by signal %d\n", child_job_id,
                    child_pid, WSTOPSIG(status));
-            update_job_jid(job_list, child_job_id, STOPPED);
-        }
-
-        // If the process completed normally, the process is removed from the
-        // job_list
-        if (WIFEXITED(status)) {
-            remove_job_pid(job_list, child_pid);
         }
 
         // End of new code
@@ -632,170 +2740,45 @@ int execute_built_in_commmands(char *argv[], int *argc, job_list_t *job_list) {
 // by the user. It returns -1 if there was an erroneous input, 0 if nothing was
 // input by the user, and 1 if the user input was valid and parsed correctly
 
-int parse_input(char *argv[], char *redirect[], int *argc,
-                job_list_t *job_list) {
-    // This is a local variable used to hold the number of bytes which were read
-    // into the buffer
-    ssize_t end_of_buffer = 0;
-
-    // These are local variables used to determine the total number of output
-    // and input redirects
-    int output_redirects = 0;
-    int input_redirects = 0;
-
-    // This resets the global buffer variable to null
-    memset(buffer, 0, 1024);
-
-    // This is a buffer which the read command reads into, and a pointer used by
-    // strtok as well. The delimiter is set to be a space or a tab
-
-    char *buffer_pointer = NULL;
-    char *delimiter = " \t";
+int parse_input(command_t *command, job_list_t *job_list) {
+    // These are local variables used to hold the line handed out by the input
+    // reader and its length
+    char *line = NULL;
+    size_t line_length = 0;
+    int read_result = 0;
 
-    // Reading in the input into the buffer
-    end_of_buffer = read(0, buffer, 1024);
+    // Reading in the next line of input. The reader fills a large buffer with
+    // each read call and hands it out one line at a time, so no line of piped
+    // input is lost and lines of any length are read in whole
+    TRACE_BEGIN("read_line");
+    read_result = read_line(input_reader, &line, &line_length);
+    TRACE_END("read_line");
 
     // Error checking the read command
-    if (end_of_buffer == -1) {
+    if (read_result == -1) {
         perror("read");
         return -1;
     }
 
-    // This exits the shell if the read command returns a 0, which means that
-    // the CTRL_D comman was input by the user
-    if (end_of_buffer == 0) {
-        cleanup_job_list(job_list);
+    // This exits the shell if the reader reached the end of input, which means
+    // that the CTRL_D comman was input by the user
+    if (read_result == 0) {
+        cleanup_shell(job_list);
         exit(0);
     }
 
-    // Setting the last character after all data has been read in from standard
-    // input to null
-    buffer[end_of_buffer - 1] = '\0';
-
-    buffer_pointer = strtok(buffer, delimiter);
-
-    // If buffer pointer is NULL, this means that a string of all spaces was
-    // passed in, or that enter was pressed without actually inputting anything
-    // into the terminal. In this case, parse_input exits with code 0
-
-    if (buffer_pointer == NULL) {
-        return 0;
-    }
-
-    // This tokenizes the buffer, inserting all commands into the argv array and
-    // all redirect symbols as well as redirect pathnames into the redirect
-    // array. This array is used within the main function. This also performs
-    // extensive error checking on the user input into the command line. The
-    // token to be used in the function is " " since all commands must be
-    // separated by white space
-
-    while (buffer_pointer != NULL) {
-        // If the buffer pointer is a left redirect, the function inserts it
-        // into the redirect array at index 0, then inserts the following token
-        // as the next element in the redirect array. If the next argument is
-        // another redirect symbol, or does not exist, the function returns an
-        // error message and returns with code 0 to refresh the shell
-
-        if (strcmp(buffer_pointer, "<") == 0) {
-            redirect[INPUT_REDIRECTION] = buffer_pointer;
-            input_redirects++;
-            buffer_pointer = strtok(NULL, delimiter);
-
-            // If there is more than one redirect of the same type, the shell
-            // prints an error code and exits with code 0, so that the shell can
-            // refresh
-            if (input_redirects > 1) {
-                fprintf(stderr, "%s", "syntax error: multiple input files\n");
-                return -1;
-            }
-
-            // Printing an error if there is no input following the redirection
-            // symbol
-            if (buffer_pointer == NULL) {
-                fprintf(stderr, "%s", "syntax error: no input file\n");
-                return -1;
-            }
-
-            // Printing an error if the input following the redirection symbol
-            // is another redirection symbol
-
-            if (strcmp(buffer_pointer, "<") == 0 ||
-                strcmp(buffer_pointer, ">") == 0 ||
-                strcmp(buffer_pointer, ">>") == 0) {
-                fprintf(stderr, "%s",
-                        "syntax error: input file is a redirection symbol\n");
-                return -1;
-            }
-
-            // If there is valid input following the input redirection, it is
-            // input into the redirect array at index 1, then iterates to the
-            // next token
-            redirect[INPUT_REDIRECTION_FILE] = buffer_pointer;
-            buffer_pointer = strtok(NULL, delimiter);
-            continue;
-        }
-
-        // If the buffer pointer is a output redirect, the function inserts it
-        // into the redirect array at index 2, then inserts the following token
-        // as the next element in the redirect array. If the next argument is
-        // another redirect symbol, or does not exist, the function returns an
-        // error message and returns with code 0 to refresh the shell
-
-        if (strcmp(buffer_pointer, ">") == 0 ||
-            strcmp(buffer_pointer, ">>") == 0) {
-            redirect[OUTPUT_REDIRECTION] = buffer_pointer;
-            buffer_pointer = strtok(NULL, delimiter);
-            output_redirects++;
-
-            // If there is more than one redirect of the same type, the shell
-            // prints an error code and exits with code 0, so that the shell can
-            // refresh
-            if (output_redirects > 1) {
-                fprintf(stderr, "%s", "syntax error: multiple output files\n");
-                return -1;
-            }
-
-            // Printing an error if there is no input following the redirection
-            // symbol
-            if (buffer_pointer == NULL) {
-                fprintf(stderr, "%s", "syntax error: no output file\n");
-                return -1;
-            }
-
-            // Printing an error if the input following the redirection symbol
-            // is another redirection symbol
-
-            if (strcmp(buffer_pointer, "<") == 0 ||
-                strcmp(buffer_pointer, ">") == 0 ||
-                strcmp(buffer_pointer, ">>") == 0) {
-                fprintf(stderr, "%s",
-                        "syntax error: output file is a redirection symbol\n");
-                return -1;
-            }
-
-            // If there is valid input following the input redirection, it is
-            // input into the redirect array at spot 3, then iterates to the
-            // next token
-            redirect[OUTPUT_REDIRECTION_FILE] = buffer_pointer;
-            buffer_pointer = strtok(NULL, delimiter);
-            continue;
-        }
-
-        // If the passed in input was not a redirection symbol, it is presumed
-        // to be a command or parameters and added to the argv array, which
-        // holds the command in argv[0] and parameters in the subsequent array
-        // indices. It increments *argc to keep a running count of the number of
-        // arguments passed into the function
-
-        argv[*argc] = buffer_pointer;
-        (*argc)++;
-        buffer_pointer = strtok(NULL, delimiter);
+    // This lexes the line in a single pass, inserting all words into the argv
+    // array and all redirect symbols as well as redirect pathnames into the
+    // redirect array. It also performs extensive error checking on the user
+    // input into the command line, and returns 0 if the line held nothing but
+    // white space. A line that is in the parse cache is not lexed at all, and
+    // its command is the one parsed before
+    shell_stats.bytes_read += line_length + 1;
+    TRACE_BEGIN("parse");
+    int parse_result = parse_cached(parse_cache, line, line_length, command);
+    TRACE_END("parse");
+    if (parse_result == 1) {
+        shell_stats.lines_parsed++;
     }
-
-    // Setting the last character in the argv array to null, once the while loop
-    // has terminated
-    argv[*argc] = NULL;
-
-    // Returning 1 if the parsing was successfully completed
-    return 1;
+    return parse_result;
 }
@@ -0,0 +1,179 @@
+#include "./stats.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// The launches that can be in flight at once, each timed in a slot of its own
+#define LAUNCH_SLOTS 256
+// The number of recent launch times that the percentiles are taken over
+#define LATENCY_SAMPLES 4096
+
+// A launch in flight: the time it started and the time its process
+// executed, or 0 until it has, and the error its exec failed with, or 0
+typedef struct launch_slot {
+    uint64_t start_ns;
+    uint64_t exec_ns;
+    int exec_error;
+} launch_slot_t;
+
+shell_stats_t shell_stats;
+
+// slots is shared with forked children, which inherit current_slot, the slot
+// of the launch that forked them. samples holds the most recent launch
+// times, in nanoseconds, and the mean is taken over every launch
+static launch_slot_t *slots = NULL;
+static unsigned long next_slot = 0;
+static launch_slot_t *current_slot = NULL;
+static double samples[LATENCY_SAMPLES];
+static unsigned long sample_count = 0;
+static double sample_total = 0;
+
+/* returns the time on the monotonic clock, in nanoseconds */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/* initializes the timing of launches */
+int init_stats() {
+    memset(&shell_stats, 0, sizeof(shell_stats));
+    void *memory = mmap(NULL, sizeof(launch_slot_t) * LAUNCH_SLOTS,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+    if (memory == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    slots = (launch_slot_t *)memory;
+    return 0;
+}
+
+/* releases the memory of the launch timing */
+void cleanup_stats() {
+    if (slots != NULL) {
+        munmap(slots, sizeof(launch_slot_t) * LAUNCH_SLOTS);
+        slots = NULL;
+    }
+}
+
+/*
+ * takes the time of a slot whose process has executed as a sample, or counts
+ * its failed exec, and empties the slot
+ */
+static void collect_slot(launch_slot_t *slot) {
+    uint64_t exec_ns = __atomic_load_n(&slot->exec_ns, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->exec_error, __ATOMIC_ACQUIRE) != 0) {
+        shell_stats.exec_failures++;
+    } else if (slot->start_ns != 0 && exec_ns >= slot->start_ns) {
+        double sample = (double)(exec_ns - slot->start_ns);
+        samples[sample_count % LATENCY_SAMPLES] = sample;
+        sample_count++;
+        sample_total += sample;
+    }
+    slot->start_ns = 0;
+    __atomic_store_n(&slot->exec_ns, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->exec_error, 0, __ATOMIC_RELEASE);
+}
+
+/* records that the shell is about to start a process */
+void start_launch() {
+    shell_stats.launches++;
+    if (slots == NULL) {
+        return;
+    }
+
+    // A slot is collected as it is reused, and dropped if its process never
+    // executed
+    current_slot = &slots[next_slot++ % LAUNCH_SLOTS];
+    collect_slot(current_slot);
+    current_slot->start_ns = now_ns();
+}
+
+/* records that the process of the last launch is executing */
+void record_exec() {
+    if (current_slot != NULL) {
+        __atomic_store_n(&current_slot->exec_ns, now_ns(), __ATOMIC_RELEASE);
+    }
+}
+
+/* records that the process of the last launch could not execute */
+void record_exec_failure(int error) {
+    if (current_slot != NULL) {
+        __atomic_store_n(&current_slot->exec_error, error, __ATOMIC_RELEASE);
+    }
+}
+
+/* gets the error the process of the last launch failed to execute with */
+int get_exec_failure() {
+    if (current_slot == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(&current_slot->exec_error, __ATOMIC_ACQUIRE);
+}
+
+/* compares two samples, for qsort */
+static int compare_samples(const void *a, const void *b) {
+    double first = *(const double *)a;
+    double second = *(const double *)b;
+    return (first > second) - (first < second);
+}
+
+/* shstat command, prints out the counters */
+void print_stats(int json) {
+    static double sorted[LATENCY_SAMPLES];
+    double mean_us = 0;
+    double p99_us = 0;
+
+    // Every launch whose process has executed, or failed to, is collected
+    // first
+    for (int i = 0; i < LAUNCH_SLOTS && slots != NULL; i++) {
+        if (__atomic_load_n(&slots[i].exec_ns, __ATOMIC_ACQUIRE) != 0 ||
+            __atomic_load_n(&slots[i].exec_error, __ATOMIC_ACQUIRE) != 0) {
+            collect_slot(&slots[i]);
+        }
+    }
+
+    size_t count =
+        sample_count < LATENCY_SAMPLES ? sample_count : LATENCY_SAMPLES;
+    if (count > 0) {
+        memcpy(sorted, samples, sizeof(double) * count);
+        qsort(sorted, count, sizeof(double), compare_samples);
+        mean_us = sample_total / (double)sample_count / 1e3;
+        p99_us = sorted[count * 99 / 100] / 1e3;
+    }
+    double reaps_per_call =
+        shell_stats.reap_calls > 0
+            ? (double)shell_stats.reaped / (double)shell_stats.reap_calls
+            : 0;
+
+    if (json) {
+        printf("{\"lines_parsed\":%lu,\"bytes_read\":%lu,\"builtins\":%lu,"
+               "\"launches\":%lu,\"launch_failures\":%lu,"
+               "\"exec_failures\":%lu,\"launch_to_exec_mean_us\":%.1f,"
+               "\"launch_to_exec_p99_us\":%.1f,\"reap_calls\":%lu,"
+               "\"reaped\":%lu,\"reaps_per_call\":%.3f,\"peak_jobs\":%d}\n",
+               shell_stats.lines_parsed, shell_stats.bytes_read,
+               shell_stats.builtins, shell_stats.launches,
+               shell_stats.launch_failures, shell_stats.exec_failures, mean_us,
+               p99_us, shell_stats.reap_calls, shell_stats.reaped,
+               reaps_per_call, shell_stats.peak_jobs);
+        return;
+    }
+
+    printf("lines parsed          %lu\n", shell_stats.lines_parsed);
+    printf("bytes read            %lu\n", shell_stats.bytes_read);
+    printf("builtins              %lu\n", shell_stats.builtins);
+    printf("launches              %lu\n", shell_stats.launches);
+    printf("launch failures       %lu\n", shell_stats.launch_failures);
+    printf("exec failures         %lu\n", shell_stats.exec_failures);
+    printf("launch to exec mean   %.1fus\n", mean_us);
+    printf("launch to exec p99    %.1fus\n", p99_us);
+    printf("reap calls            %lu\n", shell_stats.reap_calls);
+    printf("reaped                %lu (%.3f per call)\n", shell_stats.reaped,
+           reaps_per_call);
+    printf("peak jobs             %d\n", shell_stats.peak_jobs);
+}
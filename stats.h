@@ -0,0 +1,77 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stddef.h>
+
+/*
+ * the counters the shell keeps as it runs, which the shell increments
+ * directly, since most of them are counted on every command
+ *   lines_parsed: lines that held a command, and bytes_read the bytes of
+ *     every line read, with its newline
+ *   builtins: commands run inside the shell, and launches the processes
+ *     started for executables
+ *   launch_failures: processes that could not be started, because fork,
+ *     posix_spawn or the launcher failed, and exec_failures executables that
+ *     could not be executed, as reported by posix_spawn, by the launcher, or
+ *     by a forked child through record_exec_failure
+ *   reap_calls: calls to reap_children, and reaped the changes of state of
+ *     children that they collected
+ *   peak_jobs: the most jobs that any job list has held at once
+ */
+typedef struct shell_stats {
+    unsigned long lines_parsed;
+    unsigned long bytes_read;
+    unsigned long builtins;
+    unsigned long launches;
+    unsigned long launch_failures;
+    unsigned long exec_failures;
+    unsigned long reap_calls;
+    unsigned long reaped;
+    int peak_jobs;
+} shell_stats_t;
+
+extern shell_stats_t shell_stats;
+
+/*
+ * initializes the timing of launches, which is kept in memory shared with
+ * forked children, so that a child can record the moment it executes.
+ * returns 0 on success, -1 on failure, in which case launches are not timed
+ */
+int init_stats();
+/* releases the memory of the launch timing */
+void cleanup_stats();
+
+/*
+ * records that the shell is about to start a process. The launch is timed
+ * from now to the call to record_exec, which is made either by a forked
+ * child just before its execv, or by the shell once a launch path that
+ * returns after the exec has returned
+ */
+void start_launch();
+/*
+ * records that the process of the last launch is about to execute, or has
+ * executed. A launch whose process never executes is not timed
+ */
+void record_exec();
+/*
+ * records that the process of the last launch could not execute, with the
+ * error its exec failed with. A forked child calls it when its execv fails,
+ * in the memory it shares with the shell, and the shell calls it when the
+ * launcher reports the failure. The failure is counted once the launch is
+ * collected, and the launch is not timed
+ */
+void record_exec_failure(int error);
+/*
+ * gets the error that the process of the last launch failed to execute
+ * with, returns 0 if it executed, or has not tried to yet
+ */
+int get_exec_failure();
+
+/*
+ * shstat command, prints out the counters and the mean and 99th percentile
+ * of the time from launch to exec of recent launches, one per line, or as a
+ * single JSON object if json is set
+ */
+void print_stats(int json);
+
+#endif  // STATS_H_
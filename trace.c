@@ -0,0 +1,145 @@
+#include "./trace.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// The number of events held in memory before they are written out
+#define TRACE_CAPACITY 4096
+#define DETAIL_SIZE 32
+// The longest an event can be once it has been formatted as JSON
+#define EVENT_TEXT_SIZE 160
+
+typedef struct trace_record {
+    const char *name;
+    uint64_t time_ns;
+    char phase;
+    char detail[DETAIL_SIZE];
+} trace_record_t;
+
+int trace_enabled = 0;
+
+// The file the trace is appended to, the PID the events are recorded under,
+// and the events that have not been written out yet
+static int trace_fd = -1;
+static pid_t trace_pid = 0;
+static trace_record_t *records = NULL;
+static int record_count = 0;
+static char *text = NULL;
+
+/* writes out the trace, once the shell exits */
+static void finish_trace() { flush_trace(); }
+
+/* starts tracing if the environment asks for it */
+int init_trace() {
+    const char *path = getenv(TRACE_VARIABLE);
+    struct stat trace_stat;
+
+    if (path == NULL || *path == '\0') {
+        return 0;
+    }
+
+    // The file is appended to, by the shell and by its children, each with
+    // writes of whole events, so that the events of several processes can
+    // share it. An empty file is started with the opening of the array, and
+    // the closing bracket, which the format lets a trace leave out, is never
+    // written, so that the trace can be read at any time
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (trace_fd == -1) {
+        perror(path);
+        return -1;
+    }
+    if (fstat(trace_fd, &trace_stat) == 0 && trace_stat.st_size == 0 &&
+        write(trace_fd, "[\n", 2) == -1) {
+        perror(path);
+    }
+
+    records = (trace_record_t *)malloc(sizeof(trace_record_t) * TRACE_CAPACITY);
+    text = (char *)malloc(EVENT_TEXT_SIZE * TRACE_CAPACITY);
+    trace_pid = getpid();
+    trace_enabled = 1;
+    atexit(finish_trace);
+    return 0;
+}
+
+/* records an event with the current time */
+void trace_event(const char *name, char phase, const char *detail) {
+    struct timespec now;
+
+    if (record_count == TRACE_CAPACITY) {
+        flush_trace();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    trace_record_t *record = &records[record_count++];
+    record->name = name;
+    record->phase = phase;
+    record->time_ns =
+        (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+    record->detail[0] = '\0';
+    if (detail != NULL) {
+        strncpy(record->detail, detail, DETAIL_SIZE - 1);
+        record->detail[DETAIL_SIZE - 1] = '\0';
+    }
+}
+
+/*
+ * formats a detail as a JSON string into buffer, leaving out anything that
+ * would need escaping, returns buffer
+ */
+static const char *json_detail(const char *detail, char *buffer) {
+    size_t used = 0;
+    for (; *detail != '\0'; detail++) {
+        if (*detail != '"' && *detail != '\\' &&
+            (unsigned char)*detail >= ' ') {
+            buffer[used++] = *detail;
+        }
+    }
+    buffer[used] = '\0';
+    return buffer;
+}
+
+/* writes out the events recorded so far, with a single write */
+void flush_trace() {
+    char detail[DETAIL_SIZE];
+    size_t used = 0;
+
+    if (!trace_enabled || record_count == 0) {
+        return;
+    }
+
+    // Times are in microseconds, with the nanoseconds kept as a fraction,
+    // and an instant is scoped to its thread
+    for (int i = 0; i < record_count; i++) {
+        trace_record_t *record = &records[i];
+        int length = snprintf(
+            text + used, EVENT_TEXT_SIZE,
+            "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":%d,"
+            "\"tid\":%d%s%s%s%s},\n",
+            record->name, record->phase,
+            (unsigned long long)(record->time_ns / 1000),
+            (unsigned long long)(record->time_ns % 1000), trace_pid, trace_pid,
+            record->phase == 'i' ? ",\"s\":\"t\"" : "",
+            record->detail[0] != '\0' ? ",\"args\":{\"detail\":\"" : "",
+            json_detail(record->detail, detail),
+            record->detail[0] != '\0' ? "\"}" : "");
+        if (length > 0 && length < EVENT_TEXT_SIZE) {
+            used += (size_t)length;
+        }
+    }
+    record_count = 0;
+
+    if (write(trace_fd, text, used) == -1) {
+        perror("trace");
+    }
+}
+
+/* starts the trace of a forked child */
+void trace_child() {
+    record_count = 0;
+    trace_pid = getpid();
+}
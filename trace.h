@@ -0,0 +1,74 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// The environment variable that names the file the trace is written to
+#define TRACE_VARIABLE "SH33_TRACE"
+
+// Set once tracing has been started. Every trace point tests it first, so
+// that a shell that is not tracing pays for a single predictable branch
+extern int trace_enabled;
+
+/*
+ * records the start or the end of a phase, or a single instant, named by a
+ * string literal, with a detail, such as the name of a command, that may be
+ * NULL. These do nothing unless tracing has been started
+ */
+#define TRACE_BEGIN(name)                                                     \
+    do {                                                                      \
+        if (__builtin_expect(trace_enabled, 0)) {                             \
+            trace_event(name, 'B', NULL);                                     \
+        }                                                                     \
+    } while (0)
+#define TRACE_BEGIN_DETAIL(name, detail)                                      \
+    do {                                                                      \
+        if (__builtin_expect(trace_enabled, 0)) {                             \
+            trace_event(name, 'B', detail);                                   \
+        }                                                                     \
+    } while (0)
+#define TRACE_END(name)                                                       \
+    do {                                                                      \
+        if (__builtin_expect(trace_enabled, 0)) {                             \
+            trace_event(name, 'E', NULL);                                     \
+        }                                                                     \
+    } while (0)
+#define TRACE_INSTANT(name)                                                   \
+    do {                                                                      \
+        if (__builtin_expect(trace_enabled, 0)) {                             \
+            trace_event(name, 'i', NULL);                                     \
+        }                                                                     \
+    } while (0)
+#define TRACE_FLUSH()                                                         \
+    do {                                                                      \
+        if (__builtin_expect(trace_enabled, 0)) {                             \
+            flush_trace();                                                    \
+        }                                                                     \
+    } while (0)
+
+/*
+ * starts tracing if the environment variable TRACE_VARIABLE names a file, to
+ * which events are then appended in the Chrome trace-event JSON format, as
+ * one array that chrome://tracing and Perfetto can load. The events are
+ * kept in a buffer in memory, which is written out with a single write when
+ * it fills up, when flush_trace is called, and when the shell exits.
+ * returns 0 if tracing was started or is not wanted, -1 on failure
+ */
+int init_trace();
+
+/*
+ * records an event of the given phase, 'B' for the start of a phase, 'E' for
+ * its end or 'i' for an instant, with the time on the monotonic clock, which
+ * all processes share. detail is copied, and may be NULL
+ */
+void trace_event(const char *name, char phase, const char *detail);
+
+/* writes out the events recorded so far */
+void flush_trace();
+
+/*
+ * starts the trace of a child forked by the shell, which forgets the events
+ * it inherited, since the shell writes them itself, and records its own
+ * events under its own PID, until it calls flush_trace before it executes
+ */
+void trace_child();
+
+#endif  // TRACE_H_